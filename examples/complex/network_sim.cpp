@@ -14,10 +14,10 @@ bool connect_to_server(const std::string& host, int port) {
     yinfo("attempting connection to %s:%d", host.c_str(), port);
     std::this_thread::sleep_for(std::chrono::milliseconds(800));
     
-    ytrace("resolving DNS for %s", host.c_str());
+    ylog_cat(net, "trace", "resolving DNS for %s", host.c_str());
     std::this_thread::sleep_for(std::chrono::milliseconds(200));
     
-    ytrace("establishing TCP connection");
+    ylog_cat(net, "trace", "establishing TCP connection");
     std::this_thread::sleep_for(std::chrono::milliseconds(300));
     
     connected_ = true;
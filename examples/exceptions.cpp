@@ -0,0 +1,30 @@
+// Exception-throw site accounting: build with -DYTRACE_EXCEPTION_HOOK=ON, then list the
+// throw sites with ytrace-ctl exceptions. Enable the "throw" points (ytrace-ctl enable
+// --level throw) to also get a record per throw and the throw-to-catch latency.
+#include <ytrace/ytrace.hpp>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+int parse_port(const std::string& text) {
+    if (text.empty()) throw std::invalid_argument("empty port");
+    int port = std::stoi(text);
+    if (port <= 0 || port > 65535) throw std::out_of_range("port out of range");
+    return port;
+}
+
+int main() {
+    ytrace::TraceManager::instance().open_ctrl_socket(
+        ytrace::TraceManager::instance().get_socket_path().c_str());
+
+    const char* inputs[] = {"8080", "", "70000", "x", "443"};
+    for (int i = 0; i < 600; ++i) {
+        try {
+            parse_port(inputs[i % 5]);
+        } catch (const std::exception&) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+// Automatic function instrumentation: no yfunc() anywhere, every function is a
+// trace point. Build with -DYTRACE_INSTRUMENT_FUNCTIONS=ON and run with
+// YTRACE_DEFAULT_ON=1, or enable functions at runtime with ytrace-ctl.
+#include <ytrace/ytrace.hpp>
+#include <chrono>
+#include <thread>
+
+int parse(int v) {
+    return v * 2;
+}
+
+int validate(int v) {
+    return v > 10 ? parse(v) : 0;
+}
+
+void handle(int v) {
+    validate(v);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+int main() {
+    ytrace::TraceManager::instance().open_ctrl_socket(
+        ytrace::TraceManager::instance().get_socket_path().c_str());
+
+    for (int i = 0; i < 50; ++i) {
+        handle(i);
+    }
+    return 0;
+}
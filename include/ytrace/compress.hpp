@@ -0,0 +1,191 @@
+#pragma once
+
+// Block compression of trace output (FileSink, ytrace-ctl cat/decode)
+//
+// A small LZ77 codec in the LZ4 family, no external dependency. Output is a sequence of
+// independent blocks, each with a fixed header:
+//
+//   "YTZB"  raw length (u32 LE)  stored length (u32 LE)  payload
+//
+// A stored length equal to the raw length means the payload is uncompressed (the block
+// did not shrink). Blocks can be skipped by their header alone, so a reader can seek to
+// any block boundary and decode from there.
+//
+// Sequence format inside a compressed payload: token byte (literal count << 4 | match
+// length - 4), extra literal count bytes when the nibble is 15 (255-runs), literals,
+// 16-bit LE match offset, extra match length bytes when the nibble is 15. The last
+// sequence carries literals only.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <string_view>
+
+namespace ytrace::lz {
+
+inline constexpr char kBlockMagic[4] = {'Y', 'T', 'Z', 'B'};
+inline constexpr size_t kBlockHeaderBytes = 12;
+inline constexpr size_t kMinMatch = 4;
+inline constexpr size_t kMaxOffset = 65535;
+inline constexpr size_t kHashBits = 12;
+inline constexpr size_t kMaxBlockBytes = size_t(16) << 20;  // largest raw block writers produce
+
+// Worst-case compressed size of n bytes
+inline constexpr size_t compress_bound(size_t n) { return n + n / 255 + 16; }
+
+namespace detail {
+    inline uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline size_t hash(uint32_t v) { return (v * 2654435761u) >> (32 - kHashBits); }
+
+    inline uint8_t* put_length(uint8_t* op, size_t n) {
+        for (; n >= 255; n -= 255) *op++ = 255;
+        *op++ = static_cast<uint8_t>(n);
+        return op;
+    }
+
+    inline void put32le(char* p, uint32_t v) {
+        for (int i = 0; i < 4; ++i) p[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+
+    inline uint32_t get32le(const char* p) {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+        return v;
+    }
+}
+
+// Compress n bytes of src into dst (compress_bound(n) bytes); returns the compressed size
+inline size_t compress(const void* source, size_t n, void* destination) {
+    const uint8_t* src = static_cast<const uint8_t*>(source);
+    uint8_t* op = static_cast<uint8_t*>(destination);
+    uint32_t table[size_t(1) << kHashBits] = {};   // position + 1 of the last 4-byte sequence per hash
+    size_t anchor = 0;
+
+    auto emit = [&](size_t literals_end, size_t offset, size_t match) {
+        size_t literals = literals_end - anchor;
+        uint8_t* token = op++;
+        *token = static_cast<uint8_t>(std::min<size_t>(literals, 15) << 4);
+        if (literals >= 15) op = detail::put_length(op, literals - 15);
+        std::memcpy(op, src + anchor, literals);
+        op += literals;
+        if (!match) return;
+        *op++ = static_cast<uint8_t>(offset & 0xff);
+        *op++ = static_cast<uint8_t>(offset >> 8);
+        *token |= static_cast<uint8_t>(std::min<size_t>(match - kMinMatch, 15));
+        if (match - kMinMatch >= 15) op = detail::put_length(op, match - kMinMatch - 15);
+    };
+
+    for (size_t i = 0; i + kMinMatch <= n;) {
+        uint32_t seq = detail::read32(src + i);
+        size_t h = detail::hash(seq);
+        size_t ref = table[h];
+        table[h] = static_cast<uint32_t>(i + 1);
+        if (ref == 0 || i - (ref - 1) > kMaxOffset || detail::read32(src + ref - 1) != seq) {
+            ++i;
+            continue;
+        }
+        --ref;
+        size_t match = kMinMatch;
+        while (i + match < n && src[ref + match] == src[i + match]) ++match;
+        emit(i, i - ref, match);
+        i += match;
+        anchor = i;
+    }
+    emit(n, 0, 0);
+    return static_cast<size_t>(op - static_cast<uint8_t*>(destination));
+}
+
+// Decompress a payload into dst of exactly raw bytes; false if it is malformed
+inline bool decompress(const void* source, size_t n, void* destination, size_t raw) {
+    const uint8_t* ip = static_cast<const uint8_t*>(source);
+    const uint8_t* end = ip + n;
+    uint8_t* dst = static_cast<uint8_t*>(destination);
+    size_t out = 0;
+
+    auto get_length = [&](size_t& len) {
+        for (;;) {
+            if (ip == end) return false;
+            uint8_t b = *ip++;
+            len += b;
+            if (b != 255) return true;
+        }
+    };
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !get_length(literals)) return false;
+        if (literals > static_cast<size_t>(end - ip) || literals > raw - out) return false;
+        std::memcpy(dst + out, ip, literals);
+        ip += literals;
+        out += literals;
+        if (ip == end) break;   // last sequence: literals only
+
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | (size_t(ip[1]) << 8);
+        ip += 2;
+        size_t match = (token & 15);
+        if (match == 15 && !get_length(match)) return false;
+        match += kMinMatch;
+        if (offset == 0 || offset > out || match > raw - out) return false;
+        for (size_t k = 0; k < match; ++k, ++out) dst[out] = dst[out - offset];   // may overlap
+    }
+    return out == raw;
+}
+
+// Append one framed block holding raw to out (stored uncompressed if it does not shrink)
+inline void encode_block(std::string_view raw, std::string& out) {
+    size_t at = out.size();
+    out.resize(at + kBlockHeaderBytes + compress_bound(raw.size()));
+    char* header = out.data() + at;
+    size_t stored = compress(raw.data(), raw.size(), header + kBlockHeaderBytes);
+    if (stored >= raw.size()) {
+        std::memcpy(header + kBlockHeaderBytes, raw.data(), raw.size());
+        stored = raw.size();
+    }
+    std::memcpy(header, kBlockMagic, sizeof(kBlockMagic));
+    detail::put32le(header + 4, static_cast<uint32_t>(raw.size()));
+    detail::put32le(header + 8, static_cast<uint32_t>(stored));
+    out.resize(at + kBlockHeaderBytes + stored);
+}
+
+// True if data starts with a block header
+inline bool is_block_stream(std::string_view data) {
+    return data.size() >= sizeof(kBlockMagic) && std::memcmp(data.data(), kBlockMagic, sizeof(kBlockMagic)) == 0;
+}
+
+enum class BlockStatus { ok, end, corrupt };
+
+// Read and decode the next block of in into raw. magic_read: the caller already consumed
+// the block's magic (to sniff the format of a non-seekable stream). A header claiming more
+// than kMaxBlockBytes is corrupt: nothing is allocated for it.
+inline BlockStatus read_block(std::istream& in, std::string& raw, bool magic_read = false) {
+    char header[kBlockHeaderBytes];
+    size_t skip = magic_read ? sizeof(kBlockMagic) : 0;
+    if (magic_read) std::memcpy(header, kBlockMagic, sizeof(kBlockMagic));
+    if (!in.read(header + skip, static_cast<std::streamsize>(sizeof(header) - skip))) {
+        return in.gcount() == 0 && !magic_read ? BlockStatus::end : BlockStatus::corrupt;
+    }
+    if (std::memcmp(header, kBlockMagic, sizeof(kBlockMagic)) != 0) return BlockStatus::corrupt;
+    uint32_t raw_len = detail::get32le(header + 4);
+    uint32_t stored = detail::get32le(header + 8);
+    if (raw_len > kMaxBlockBytes || stored > compress_bound(raw_len)) return BlockStatus::corrupt;
+    std::string payload(stored, '\0');
+    if (!in.read(payload.data(), stored)) return BlockStatus::corrupt;
+    raw.resize(raw_len);
+    if (stored == raw_len) {
+        std::memcpy(raw.data(), payload.data(), raw_len);
+        return BlockStatus::ok;
+    }
+    return decompress(payload.data(), stored, raw.data(), raw_len) ? BlockStatus::ok : BlockStatus::corrupt;
+}
+
+} // namespace ytrace::lz
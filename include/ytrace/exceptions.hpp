@@ -0,0 +1,32 @@
+#pragma once
+
+// Exception-throw site accounting (Itanium C++ ABI: GCC, Clang on Linux)
+//
+// ytrace::exceptions defines __cxa_throw and __cxa_begin_catch, which take precedence
+// over the C++ runtime's and forward to them. Every throw is counted in ExceptionTable
+// under the pc of its throw expression: one lock-free probe and an atomic increment on
+// top of the cost of the throw itself. On its first throw, a site is registered as a
+// "throw" trace point (file = module, function = enclosing function, message = exception
+// type). Enabling the point emits a record per throw and times throw-to-catch, up to the
+// __cxa_begin_catch of the handler that receives the exception.
+//
+// Use the CMake helper (requires -DYTRACE_EXCEPTION_HOOK=ON):
+//   ytrace_exception_hook(myapp)
+// and list the sites with ytrace-ctl exceptions.
+//
+// Limitations: the C++ runtime must be linked dynamically (not -static-libstdc++);
+// rethrows (throw;, std::rethrow_exception) do not go through __cxa_throw and are not
+// counted again; throws from std:: helpers inside the runtime library (std::vector::at,
+// std::stoi, ...) are attributed to the runtime's throw sites.
+
+#include <ytrace/ytrace.hpp>
+
+#if YTRACE_ENABLED
+
+// Timed exceptions in flight per thread (throws from destructors or handlers nest).
+// Beyond this, the oldest is no longer timed.
+#ifndef YTRACE_EXCEPTION_INFLIGHT
+#define YTRACE_EXCEPTION_INFLIGHT 8
+#endif
+
+#endif // YTRACE_ENABLED
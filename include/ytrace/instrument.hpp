@@ -0,0 +1,112 @@
+#pragma once
+
+// Automatic function instrumentation (-finstrument-functions)
+//
+// Targets compiled with -finstrument-functions call __cyg_profile_func_enter/exit
+// around every function. ytrace::instrument implements those hooks: each function
+// address is mapped to a pair of lazily registered trace points (func-entry and
+// func-exit) that are listed and enabled like any other trace point.
+//
+// Use the CMake helper (requires -DYTRACE_INSTRUMENT_FUNCTIONS=ON):
+//   ytrace_instrument_functions(myapp)
+
+#include <ytrace/ytrace.hpp>
+
+#if YTRACE_ENABLED
+
+// Number of slots in the address table (power of two). Functions that find no free
+// slot are not traced; each of their calls is counted in FunctionTable::dropped().
+#ifndef YTRACE_INSTRUMENT_TABLE_SIZE
+#define YTRACE_INSTRUMENT_TABLE_SIZE 65536
+#endif
+
+// Slots probed per lookup. Bounds the cost of a call to an untraced function once the
+// table (or the function's neighbourhood in it) is full.
+#ifndef YTRACE_INSTRUMENT_MAX_PROBE
+#define YTRACE_INSTRUMENT_MAX_PROBE 64
+#endif
+
+namespace ytrace {
+
+// Open-addressing (linear probing) table keyed by function address.
+// Slots are never removed, so a found slot stays valid for the process lifetime and
+// the enabled flags can be handed to TraceManager like the static bools of the macros.
+class FunctionTable {
+public:
+    static_assert((YTRACE_INSTRUMENT_TABLE_SIZE & (YTRACE_INSTRUMENT_TABLE_SIZE - 1)) == 0,
+                  "YTRACE_INSTRUMENT_TABLE_SIZE must be a power of two");
+
+    struct Slot {
+        std::atomic<void*> fn{nullptr};
+        std::atomic<bool> ready{false};   // set once the trace points are registered
+        bool entry_enabled = false;
+        bool exit_enabled = false;
+        const char* module = nullptr;     // shared object path (from dladdr)
+        const char* function = nullptr;   // demangled symbol, or the address in hex
+    };
+
+    static FunctionTable& instance() {
+        static FunctionTable table;
+        return table;
+    }
+
+    static constexpr size_t capacity() { return YTRACE_INSTRUMENT_TABLE_SIZE; }
+    static constexpr size_t max_probe() {
+        return YTRACE_INSTRUMENT_MAX_PROBE < capacity() ? YTRACE_INSTRUMENT_MAX_PROBE : capacity();
+    }
+
+    // Fast path: returns the slot of a registered function, or nullptr if the function
+    // has not been seen yet (or is still being registered by another thread).
+    Slot* find(void* fn) noexcept {
+        size_t i = hash(fn);
+        for (size_t n = 0; n < max_probe(); ++n, i = (i + 1) & (capacity() - 1)) {
+            void* key = slots_[i].fn.load(std::memory_order_acquire);
+            if (key == fn) {
+                return slots_[i].ready.load(std::memory_order_acquire) ? &slots_[i] : nullptr;
+            }
+            if (key == nullptr) return nullptr;
+        }
+        return nullptr;
+    }
+
+    // Claim a slot for fn. Returns {slot, true} if this call inserted it (the caller must
+    // register the trace points and then mark the slot ready), {slot, false} if it already
+    // existed, or {nullptr, false} if none of the max_probe() slots from its hash is free.
+    std::pair<Slot*, bool> insert(void* fn) noexcept {
+        size_t i = hash(fn);
+        for (size_t n = 0; n < max_probe(); ++n, i = (i + 1) & (capacity() - 1)) {
+            void* key = slots_[i].fn.load(std::memory_order_acquire);
+            if (key == fn) return {&slots_[i], false};
+            if (key != nullptr) continue;  // occupied: no read-modify-write on its line
+            void* expected = nullptr;
+            if (slots_[i].fn.compare_exchange_strong(expected, fn, std::memory_order_acq_rel)) {
+                size_.fetch_add(1, std::memory_order_relaxed);
+                return {&slots_[i], true};
+            }
+            if (expected == fn) return {&slots_[i], false};
+        }
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return {nullptr, false};
+    }
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    // Calls of functions that could not be given a slot (not a count of functions)
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    FunctionTable() = default;
+
+    static size_t hash(void* fn) noexcept {
+        // Fibonacci hashing of the address; low bits are mostly alignment zeros
+        uint64_t x = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(fn));
+        return static_cast<size_t>((x * 0x9E3779B97F4A7C15ull) >> 32) & (capacity() - 1);
+    }
+
+    Slot slots_[YTRACE_INSTRUMENT_TABLE_SIZE];
+    std::atomic<size_t> size_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+} // namespace ytrace
+
+#endif // YTRACE_ENABLED
@@ -0,0 +1,451 @@
+#pragma once
+
+// Linear-time pattern matching (ytrace-ctl filters, predicate '~', thread filters)
+//
+// ytrace::Pattern compiles a glob or a regex subset to a DFA, so matching costs one table
+// lookup per input byte, and no pattern can backtrack. Supported regex syntax:
+//   literals, '.', [abc] [^a-z] classes, \d \w \s \D \W \S, escapes (\. \* ...),
+//   grouping ( ) (?: ), alternation |, quantifiers * + ?, anchors ^ $.
+// Counted repetition {n,m}, backreferences and lookaround are rejected. Matching is
+// bytewise: '.' matches one byte of a UTF-8 sequence.
+//
+// A literal every match must contain (the longest one on the top level) is looked up
+// with a substring search first, which rejects most non-matching input without
+// running the automaton. Past kMaxDfaStates the DFA is not built and the NFA is
+// simulated instead (still linear in the input, times the pattern size, but allocating;
+// predicates reject such patterns).
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ytrace {
+
+class Pattern {
+public:
+    enum class Syntax {
+        regex,  // matches anywhere in the text (like std::regex_search) unless anchored
+        glob    // '*' any run, '?' one byte, [..] classes; matches the whole text
+    };
+
+    static constexpr size_t kMaxNfaStates = 4096;
+    static constexpr size_t kMaxDfaStates = 2048;
+
+    // Returns false and sets error if the pattern is malformed or unsupported
+    bool compile(std::string_view pattern, Syntax syntax, std::string& error) {
+        *this = Pattern();
+        source_ = std::string(pattern);
+        std::string regex = syntax == Syntax::glob ? glob_to_regex(pattern) : source_;
+        Parser parser(*this, regex);
+        int start = -1;
+        if (!parser.parse(start)) {
+            error = parser.error;
+            return false;
+        }
+        start_ = start;
+        literal_ = parser.literal;
+        std::vector<int> first{start_};
+        closure(first, false, false);
+        anchored_ = std::all_of(first.begin(), first.end(), [&](int n) { return nodes_[n].kind == Node::Begin; });
+        build_byte_classes();
+        build_dfa();
+        compiled_ = true;
+        return true;
+    }
+
+    bool search(std::string_view text) const {
+        if (!compiled_) return false;
+        if (!literal_.empty() && text.find(literal_) == std::string_view::npos) return false;
+        if (dfa_built_) {
+            uint32_t s = 0;
+            if (dfa_[s].accept) return true;
+            for (unsigned char c : text) {
+                s = dfa_[s].next[byte_class_[c]];
+                if (s == kDead) return false;
+                if (dfa_[s].accept) return true;
+            }
+            return dfa_[s].accept_at_end;
+        }
+        return simulate(text);
+    }
+
+    const std::string& source() const { return source_; }
+    const std::string& required_literal() const { return literal_; }
+    bool uses_dfa() const { return dfa_built_; }
+    size_t dfa_states() const { return dfa_.size(); }
+
+private:
+    static constexpr uint32_t kDead = UINT32_MAX;
+
+    struct Node {
+        enum Kind : uint8_t { Byte, Split, Empty, Begin, End, Match } kind;
+        uint16_t cls = 0;       // Byte: index into classes_
+        int out = -1;
+        int out1 = -1;          // Split: second branch
+    };
+
+    using ByteSet = std::array<uint64_t, 4>;
+
+    struct DfaState {
+        std::vector<uint32_t> next;    // per byte class; kDead = no match possible
+        bool accept = false;           // Match reached: the text matches whatever follows
+        bool accept_at_end = false;    // matches if the text ends here ($ satisfied)
+    };
+
+    static bool has(const ByteSet& set, unsigned char c) { return (set[c >> 6] >> (c & 63)) & 1; }
+    static void add(ByteSet& set, unsigned char c) { set[c >> 6] |= uint64_t(1) << (c & 63); }
+
+    static std::string glob_to_regex(std::string_view glob) {
+        std::string re = "^";
+        for (size_t i = 0; i < glob.size(); ++i) {
+            char c = glob[i];
+            if (c == '*') re += ".*";
+            else if (c == '?') re += '.';
+            else if (c == '[') {
+                size_t end = glob.find(']', i + 2);
+                if (end == std::string_view::npos) { re += "\\["; continue; }
+                std::string_view body = glob.substr(i + 1, end - i - 1);
+                re += '[';
+                if (!body.empty() && body[0] == '!') { re += '^'; body.remove_prefix(1); }
+                for (char b : body) {
+                    if (b == '\\' || b == '[') re += '\\';
+                    re += b;
+                }
+                re += ']';
+                i = end;
+            } else {
+                if (std::string_view("\\.+()|^$[]{}").find(c) != std::string_view::npos) re += '\\';
+                re += c;
+            }
+        }
+        return re + "$";
+    }
+
+    // Thompson construction by recursive descent:
+    //   alt := concat ('|' concat)*   concat := repeat*   repeat := atom [*+?]*
+    struct Frag {
+        int start;
+        std::vector<std::pair<int, bool>> outs;  // dangling exits: (node, second branch)
+    };
+
+    struct Parser {
+        Pattern& pat;
+        std::string_view src;
+        size_t pos = 0;
+        std::string error;
+        std::string literal;    // longest literal run of the top-level concatenation
+        int depth = 0;
+
+        Parser(Pattern& p, std::string_view s) : pat(p), src(s) {}
+
+        bool fail(const std::string& msg) {
+            if (error.empty()) error = msg + " at " + std::to_string(pos);
+            return false;
+        }
+
+        bool node(Node::Kind kind, int& id, uint16_t cls = 0) {
+            if (pat.nodes_.size() >= kMaxNfaStates) return fail("pattern too large");
+            pat.nodes_.push_back(Node{kind, cls, -1, -1});
+            id = static_cast<int>(pat.nodes_.size() - 1);
+            return true;
+        }
+
+        void patch(const Frag& f, int target) {
+            for (auto [n, second] : f.outs) (second ? pat.nodes_[n].out1 : pat.nodes_[n].out) = target;
+        }
+
+        bool parse(int& start) {
+            Frag f;
+            if (!parse_alt(f)) return false;
+            if (pos != src.size()) return fail("unexpected ')'");
+            int match;
+            if (!node(Node::Match, match)) return false;
+            patch(f, match);
+            start = f.start;
+            return true;
+        }
+
+        bool parse_alt(Frag& out) {
+            std::string first_literal;
+            if (!parse_concat(out, first_literal)) return false;
+            bool alternated = false;
+            while (pos < src.size() && src[pos] == '|') {
+                ++pos;
+                alternated = true;
+                Frag rhs;
+                std::string ignored;
+                if (!parse_concat(rhs, ignored)) return false;
+                int split;
+                if (!node(Node::Split, split)) return false;
+                pat.nodes_[split].out = out.start;
+                pat.nodes_[split].out1 = rhs.start;
+                out.start = split;
+                out.outs.insert(out.outs.end(), rhs.outs.begin(), rhs.outs.end());
+            }
+            if (depth == 0 && !alternated) literal = first_literal;
+            return true;
+        }
+
+        bool parse_concat(Frag& out, std::string& best_literal) {
+            int empty;
+            if (!node(Node::Empty, empty)) return false;
+            out = Frag{empty, {{empty, false}}};
+            std::string run;
+            while (pos < src.size() && src[pos] != '|' && src[pos] != ')') {
+                Frag atom;
+                int literal_char = -1;
+                if (!parse_repeat(atom, literal_char)) return false;
+                patch(out, atom.start);
+                out.outs = std::move(atom.outs);
+                if (literal_char >= 0) {
+                    run += static_cast<char>(literal_char);
+                    if (run.size() > best_literal.size()) best_literal = run;
+                } else {
+                    run.clear();
+                }
+            }
+            return true;
+        }
+
+        // literal_char: the byte if the atom is a plain literal matched exactly once, else -1
+        bool parse_repeat(Frag& out, int& literal_char) {
+            if (!parse_atom(out, literal_char)) return false;
+            while (pos < src.size() && (src[pos] == '*' || src[pos] == '+' || src[pos] == '?')) {
+                char q = src[pos++];
+                int split;
+                if (!node(Node::Split, split)) return false;
+                pat.nodes_[split].out = out.start;
+                if (q == '*') {
+                    patch(out, split);
+                    out = Frag{split, {{split, true}}};
+                } else if (q == '+') {
+                    patch(out, split);
+                    out.outs = {{split, true}};
+                } else {
+                    out.outs.push_back({split, true});
+                    out.start = split;
+                }
+                literal_char = -1;
+            }
+            if (pos < src.size() && src[pos] == '{') return fail("counted repetition is not supported");
+            return true;
+        }
+
+        bool byte_atom(Frag& out, const ByteSet& set) {
+            auto it = std::find(pat.classes_.begin(), pat.classes_.end(), set);
+            uint16_t cls = static_cast<uint16_t>(it - pat.classes_.begin());
+            if (it == pat.classes_.end()) {
+                if (pat.classes_.size() >= UINT16_MAX) return fail("too many classes");
+                pat.classes_.push_back(set);
+            }
+            int id;
+            if (!node(Node::Byte, id, cls)) return false;
+            out = Frag{id, {{id, false}}};
+            return true;
+        }
+
+        static ByteSet escape_set(char c, bool& ok) {
+            ByteSet set{};
+            ok = true;
+            auto range = [&](int lo, int hi) { for (int b = lo; b <= hi; ++b) add(set, static_cast<unsigned char>(b)); };
+            switch (c) {
+            case 'd': case 'D': range('0', '9'); break;
+            case 'w': case 'W': range('0', '9'); range('a', 'z'); range('A', 'Z'); add(set, '_'); break;
+            case 's': case 'S': for (char s : std::string_view(" \t\n\r\f\v")) add(set, static_cast<unsigned char>(s)); break;
+            case 'n': add(set, '\n'); return set;
+            case 't': add(set, '\t'); return set;
+            case 'r': add(set, '\r'); return set;
+            default:
+                if (std::isalnum(static_cast<unsigned char>(c))) { ok = false; return set; }  // \b, \1, ...
+                add(set, static_cast<unsigned char>(c));
+                return set;
+            }
+            if (std::isupper(static_cast<unsigned char>(c))) for (auto& w : set) w = ~w;
+            return set;
+        }
+
+        bool parse_class(ByteSet& set) {
+            bool negate = pos < src.size() && src[pos] == '^';
+            if (negate) ++pos;
+            bool first = true;
+            while (pos < src.size() && (src[pos] != ']' || first)) {
+                first = false;
+                unsigned char lo = static_cast<unsigned char>(src[pos++]);
+                if (lo == '\\') {
+                    if (pos >= src.size()) return fail("trailing '\\'");
+                    bool ok;
+                    ByteSet esc = escape_set(src[pos++], ok);
+                    if (!ok) return fail("unsupported escape");
+                    for (size_t w = 0; w < set.size(); ++w) set[w] |= esc[w];
+                    continue;
+                }
+                if (pos + 1 < src.size() && src[pos] == '-' && src[pos + 1] != ']') {
+                    unsigned char hi = static_cast<unsigned char>(src[pos + 1]);
+                    pos += 2;
+                    if (hi < lo) return fail("bad class range");
+                    for (int b = lo; b <= hi; ++b) add(set, static_cast<unsigned char>(b));
+                } else {
+                    add(set, lo);
+                }
+            }
+            if (pos >= src.size()) return fail("missing ']'");
+            ++pos;
+            if (negate) for (auto& w : set) w = ~w;
+            return true;
+        }
+
+        bool parse_atom(Frag& out, int& literal_char) {
+            literal_char = -1;
+            char c = src[pos];
+            if (c == '*' || c == '+' || c == '?') return fail("nothing to repeat");
+            ++pos;
+            if (c == '(') {
+                if (src.substr(pos, 2) == "?:") pos += 2;
+                else if (pos < src.size() && src[pos] == '?') return fail("unsupported group");
+                ++depth;
+                if (!parse_alt(out)) return false;
+                --depth;
+                if (pos >= src.size() || src[pos] != ')') return fail("missing ')'");
+                ++pos;
+                return true;
+            }
+            if (c == '^' || c == '$') {
+                int id;
+                if (!node(c == '^' ? Node::Begin : Node::End, id)) return false;
+                out = Frag{id, {{id, false}}};
+                return true;
+            }
+            ByteSet set{};
+            if (c == '.') {
+                for (auto& w : set) w = ~uint64_t(0);
+            } else if (c == '[') {
+                if (!parse_class(set)) return false;
+            } else if (c == '\\') {
+                if (pos >= src.size()) return fail("trailing '\\'");
+                bool ok;
+                char e = src[pos++];
+                set = escape_set(e, ok);
+                if (!ok) return fail(std::string("unsupported escape \\") + e);
+                if (!std::isalpha(static_cast<unsigned char>(e))) literal_char = static_cast<unsigned char>(e);
+            } else {
+                add(set, static_cast<unsigned char>(c));
+                literal_char = static_cast<unsigned char>(c);
+            }
+            return byte_atom(out, set);
+        }
+    };
+
+    // Bytes no class tells apart share a column of the DFA table
+    void build_byte_classes() {
+        std::map<std::vector<bool>, uint8_t> ids;
+        for (int c = 0; c < 256; ++c) {
+            std::vector<bool> signature(classes_.size());
+            for (size_t k = 0; k < classes_.size(); ++k) signature[k] = has(classes_[k], static_cast<unsigned char>(c));
+            auto [it, inserted] = ids.emplace(std::move(signature), static_cast<uint8_t>(ids.size()));
+            byte_class_[c] = it->second;
+            if (inserted) class_rep_.push_back(static_cast<unsigned char>(c));
+        }
+    }
+
+    // Epsilon closure; Begin passes only at the start of the text, End only at its end
+    void closure(std::vector<int>& set, bool at_begin, bool at_end) const {
+        std::vector<char> seen(nodes_.size(), 0);
+        std::vector<int> stack(set.begin(), set.end());
+        set.clear();
+        while (!stack.empty()) {
+            int n = stack.back();
+            stack.pop_back();
+            if (n < 0 || seen[n]) continue;
+            seen[n] = 1;
+            const Node& node = nodes_[n];
+            switch (node.kind) {
+            case Node::Split: stack.push_back(node.out1); stack.push_back(node.out); break;
+            case Node::Empty: stack.push_back(node.out); break;
+            case Node::Begin: if (at_begin) stack.push_back(node.out); else set.push_back(n); break;
+            case Node::End:   if (at_end) stack.push_back(node.out); else set.push_back(n); break;
+            default:          set.push_back(n); break;
+            }
+        }
+        std::sort(set.begin(), set.end());
+    }
+
+    bool contains_match(const std::vector<int>& set) const {
+        for (int n : set) if (nodes_[n].kind == Node::Match) return true;
+        return false;
+    }
+
+    // States reached from set by byte c, closed, plus a fresh start unless anchored with ^
+    std::vector<int> step(const std::vector<int>& set, unsigned char c) const {
+        std::vector<int> next;
+        for (int n : set) {
+            if (nodes_[n].kind == Node::Byte && has(classes_[nodes_[n].cls], c)) next.push_back(nodes_[n].out);
+        }
+        if (!anchored_) next.push_back(start_);
+        closure(next, false, false);
+        return next;
+    }
+
+    bool accepts_at_end(std::vector<int> set) const {
+        closure(set, false, true);
+        return contains_match(set);
+    }
+
+    void build_dfa() {
+        std::map<std::vector<int>, uint32_t> ids;
+        std::vector<std::vector<int>> sets;
+        std::vector<int> initial{start_};
+        closure(initial, true, false);
+        ids.emplace(initial, 0);
+        sets.push_back(initial);
+        dfa_.clear();
+        for (size_t i = 0; i < sets.size(); ++i) {
+            if (sets.size() > kMaxDfaStates) {
+                dfa_.clear();
+                return;     // too many states: simulate() instead
+            }
+            DfaState state;
+            state.accept = contains_match(sets[i]);
+            state.accept_at_end = state.accept || accepts_at_end(sets[i]);
+            state.next.resize(class_rep_.size(), kDead);
+            for (size_t k = 0; k < class_rep_.size(); ++k) {
+                std::vector<int> next = step(sets[i], class_rep_[k]);
+                if (next.empty()) continue;     // kDead
+                auto [it, inserted] = ids.emplace(next, static_cast<uint32_t>(sets.size()));
+                if (inserted) sets.push_back(std::move(next));
+                state.next[k] = it->second;
+            }
+            dfa_.push_back(std::move(state));
+        }
+        dfa_built_ = true;
+    }
+
+    bool simulate(std::string_view text) const {
+        std::vector<int> set{start_};
+        closure(set, true, false);
+        for (unsigned char c : text) {
+            if (contains_match(set)) return true;
+            set = step(set, c);
+            if (set.empty()) return false;
+        }
+        return accepts_at_end(set);
+    }
+
+    std::string source_;
+    std::string literal_;
+    std::vector<Node> nodes_;
+    std::vector<ByteSet> classes_;
+    int start_ = -1;
+    bool anchored_ = false;                 // every match starts at the beginning (^)
+    std::array<uint8_t, 256> byte_class_{};
+    std::vector<unsigned char> class_rep_;  // one byte of each byte class
+    std::vector<DfaState> dfa_;
+    bool dfa_built_ = false;
+    bool compiled_ = false;
+};
+
+} // namespace ytrace
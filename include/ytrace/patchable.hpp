@@ -0,0 +1,68 @@
+#pragma once
+
+// ftrace-style function tracing (-fpatchable-function-entry), x86-64 Linux only
+//
+// Targets compiled with -fpatchable-function-entry=5 start every function with five
+// single-byte NOPs and record their addresses in the __patchable_function_entries
+// section. At startup, before other threads exist, ytrace::patchable rewrites each site
+// into one five-byte NOP (so no thread can be stopped inside it) and registers it as a
+// func-entry/func-exit trace point pair. Disabled functions run the NOP and nothing
+// else; enabling a point (from ytrace-ctl or yenable_*) rewrites the NOP into a call to a
+// trampoline that emits the entry record and, for func-exit, hooks the return address to
+// emit the exit record and record the elapsed time in TimerManager like ytimeit() does.
+//
+// Use the CMake helper (requires -DYTRACE_PATCHABLE_FUNCTIONS=ON):
+//   ytrace_patchable_functions(myapp)
+//
+// Limitations: only sites of the executable the runtime is linked into are found; an
+// exception or longjmp unwinding through a function whose func-exit point is enabled
+// terminates the process, because its return address is redirected.
+
+#include <ytrace/ytrace.hpp>
+
+#if YTRACE_ENABLED
+
+#include <cstdint>
+
+// Maximum nesting of functions with func-exit enabled per thread; deeper calls still
+// emit entry records but are not timed.
+#ifndef YTRACE_PATCHABLE_SHADOW_DEPTH
+#define YTRACE_PATCHABLE_SHADOW_DEPTH 256
+#endif
+
+namespace ytrace {
+
+// One patchable function entry
+struct PatchableSite {
+    uint8_t* addr = nullptr;        // first NOP byte
+    bool entry_enabled = false;
+    bool exit_enabled = false;
+    bool patched = false;
+    uint8_t original[5] = {};       // the five-byte NOP, restored when both points are disabled
+    const char* module = nullptr;
+    const char* function = nullptr;
+    std::string timer_key;          // TimerManager label, same shape as ScopeTimer's
+};
+
+namespace detail {
+    // Encode "call target" as it would be placed at site (E8 rel32).
+    // Returns false if target is out of rel32 range.
+    inline bool encode_call(const uint8_t* site, const void* target, uint8_t out[5]) {
+        int64_t rel = reinterpret_cast<intptr_t>(target) - (reinterpret_cast<intptr_t>(site) + 5);
+        if (rel < INT32_MIN || rel > INT32_MAX) return false;
+        int32_t rel32 = static_cast<int32_t>(rel);
+        out[0] = 0xE8;
+        std::memcpy(out + 1, &rel32, sizeof(rel32));
+        return true;
+    }
+
+    // True if the 5 bytes at addr can be replaced by a single atomic store:
+    // within an aligned 8-byte word, or an aligned 16-byte block (cmpxchg16b).
+    inline bool is_patchable_alignment(const uint8_t* addr) {
+        return (reinterpret_cast<uintptr_t>(addr) & 15) <= 11;
+    }
+}
+
+} // namespace ytrace
+
+#endif // YTRACE_ENABLED
@@ -0,0 +1,36 @@
+#pragma once
+
+// System-call latency shim (Linux): libytrace_preload.so
+//
+// Loaded with LD_PRELOAD, the shim interposes read, write, send, recv, fsync, fdatasync,
+// poll and epoll_wait. Each call is a "syscall" trace point (file = libytrace_preload.so,
+// function = the call), off at startup. An enabled call is timed and recorded in
+// TimerManager under "<call>(<fd kind>) in <scope>": the kind of the descriptor (file,
+// socket, pipe, device, other) and the innermost yfunc()/ytimeit() function of the
+// calling thread. A disabled call costs one load and a branch on top of the call.
+//
+//   LD_PRELOAD=/path/to/libytrace_preload.so ./myapp
+//   ytrace-ctl enable -L syscall        # or -F '^(read|write)$'
+//   ytrace-ctl timers
+//
+// The shim opens the control socket at startup. An application that uses ytrace itself
+// must export its symbols (ENABLE_EXPORTS / -rdynamic): the shim then shares its
+// TraceManager, TimerManager and scopes instead of running a second, unconnected copy.
+// Such a copy listens on <socket path>.preload.sock, not on the application's path.
+//
+// Build with -DYTRACE_PRELOAD_SHIM=ON.
+//
+// Limitations: calls libc makes internally (stdio, getaddrinfo, ...) bypass the shim;
+// descriptor kinds are cached per fd number, reset by close() but not by dup2() over an
+// open descriptor; the control thread's own socket calls are counted too.
+
+#include <ytrace/ytrace.hpp>
+
+#if YTRACE_ENABLED
+
+// Descriptors whose kind is cached; calls on higher fds are recorded as "other"
+#ifndef YTRACE_PRELOAD_FDS
+#define YTRACE_PRELOAD_FDS 4096
+#endif
+
+#endif // YTRACE_ENABLED
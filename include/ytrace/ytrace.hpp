@@ -10,18 +10,34 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <mutex>
 #include <functional>
 #include <cstdio>
 #include <utility>
 #include <thread>
 #include <atomic>
+#include <condition_variable>
 #include <cstring>
 #include <sstream>
 #include <optional>
 #include <chrono>
 #include <unordered_map>
+#include <map>
+#include <set>
+#include <deque>
 #include <cinttypes>
+#include <type_traits>
+#include <string_view>
+#include <cctype>
+#include <new>
+#include <array>
+#include <memory_resource>
+#include <memory>
+#include <fstream>
+
+#include <ytrace/compress.hpp>
+#include <ytrace/match.hpp>
 
 // Formatting backend selection (compile-time flag)
 // - YTRACE_USE_SPDLOG: Use spdlog for logging (requires spdlog)
@@ -39,6 +55,28 @@
     #endif
 #endif
 
+// Stack capture (StackTable), module maps (loaded_modules), huge-page advice (MemoryBudget),
+// drain worker affinity and nice level (DrainPool), spliced streaming (SpliceSink)
+#if defined(__linux__)
+    #include <link.h>
+    #include <unistd.h>
+    #include <pthread.h>
+    #include <sched.h>
+    #include <cerrno>
+    #include <csignal>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/mman.h>
+    #include <sys/resource.h>
+    #include <sys/syscall.h>
+    #include <sys/uio.h>
+#endif
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__)) && !defined(YTRACE_STACK_UNWIND)
+    #include <pthread.h>
+#elif defined(__GNUC__) && !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    #include <unwind.h>
+#endif
+
 // Control socket and config persistence (disable for Emscripten/WASM)
 #if !defined(YTRACE_NO_CONTROL_SOCKET)
     #ifdef _WIN32
@@ -58,10 +96,204 @@
     #include <filesystem>
 #endif
 
+// Fixed-capacity build for embedded/real-time targets: set YTRACE_FIXED_CAPACITY=1 and the
+// registry, categories, timer table and tail-sampling arenas live in static storage sized
+// by the limits below. Registrations beyond a limit are dropped and counted.
+#ifndef YTRACE_FIXED_CAPACITY
+#define YTRACE_FIXED_CAPACITY 0
+#endif
+
+#if YTRACE_FIXED_CAPACITY
+#ifndef YTRACE_MAX_TRACE_POINTS
+#define YTRACE_MAX_TRACE_POINTS 4096  // registry slots
+#endif
+#ifndef YTRACE_MAX_CATEGORIES
+#define YTRACE_MAX_CATEGORIES 64
+#endif
+#ifndef YTRACE_MAX_PREDICATES
+#define YTRACE_MAX_PREDICATES 64      // distinct enable-when expressions
+#endif
+#ifndef YTRACE_MAX_TIMERS
+#define YTRACE_MAX_TIMERS 256         // timer labels (power of two)
+#endif
+#ifndef YTRACE_NAME_SIZE
+#define YTRACE_NAME_SIZE 64           // category names and displayed timer labels, longer ones are truncated
+#endif
+#endif
+
 namespace ytrace {
 
-// Forward declaration
+// Forward declarations
 struct TracePointInfo;
+struct Category;
+class Predicate;
+
+// Memory resource adapter that counts what ytrace's internal storage holds
+class CountingResource : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream) : upstream_(upstream) {}
+
+    size_t bytes_in_use() const { return in_use_.load(std::memory_order_relaxed); }
+    size_t peak_bytes() const { return peak_.load(std::memory_order_relaxed); }
+    uint64_t allocations() const { return allocations_.load(std::memory_order_relaxed); }
+    std::pmr::memory_resource* upstream() const { return upstream_; }
+
+private:
+    void* do_allocate(size_t bytes, size_t align) override {
+        void* p = upstream_->allocate(bytes, align);
+        size_t now = in_use_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        size_t peak = peak_.load(std::memory_order_relaxed);
+        while (now > peak && !peak_.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t align) override {
+        upstream_->deallocate(p, bytes, align);
+        in_use_.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    std::pmr::memory_resource* upstream_;
+    std::atomic<size_t> in_use_{0};
+    std::atomic<size_t> peak_{0};
+    std::atomic<uint64_t> allocations_{0};
+};
+
+namespace detail {
+    // Resource installed by set_memory_resource(), and whether storage has been bound yet
+    struct MemoryConfig {
+        std::atomic<std::pmr::memory_resource*> upstream{nullptr};
+        std::atomic<bool> bound{false};
+    };
+
+    inline MemoryConfig& memory_config() {
+        static MemoryConfig config;
+        return config;
+    }
+}
+
+// Install the resource ytrace's internal storage (registry, timer table, tail-sampling
+// arenas, config cache, rate history) allocates from. Call it at init, before the first
+// trace point or timer: once storage is bound it returns false and changes nothing.
+inline bool set_memory_resource(std::pmr::memory_resource* resource) {
+    auto& config = detail::memory_config();
+    if (config.bound.load(std::memory_order_acquire)) return false;
+    config.upstream.store(resource, std::memory_order_release);
+    return true;
+}
+
+// The resource all internal storage uses, counting on top of the installed one. By default
+// a synchronized pool: registry growth, timer nodes and strings are small, same-sized
+// blocks that are freed and reused, which a monotonic buffer would leak.
+inline CountingResource& memory_resource() {
+    static CountingResource resource([] {
+        auto& config = detail::memory_config();
+        config.bound.store(true, std::memory_order_release);
+        if (auto* upstream = config.upstream.load(std::memory_order_acquire)) return upstream;
+        static std::pmr::synchronized_pool_resource pool(std::pmr::pool_options{0, 4096});
+        return static_cast<std::pmr::memory_resource*>(&pool);
+    }());
+    return resource;
+}
+
+namespace detail {
+    // Append-only array in static storage; elements never move, like in a deque
+    template<typename T, size_t N>
+    class FixedVector {
+    public:
+        FixedVector() = default;
+        explicit FixedVector(std::pmr::memory_resource*) {}  // same construction as the pmr containers
+        FixedVector(const FixedVector&) = delete;
+        FixedVector& operator=(const FixedVector&) = delete;
+        ~FixedVector() {
+            for (size_t i = size_; i > 0; --i) (*this)[i - 1].~T();
+        }
+
+        // nullptr when full
+        template<typename... Args>
+        T* try_emplace_back(Args&&... args) {
+            if (size_ == N) return nullptr;
+            T* p = new (storage_ + size_ * sizeof(T)) T(std::forward<Args>(args)...);
+            ++size_;
+            return p;
+        }
+
+        void pop_back() { (*this)[--size_].~T(); }
+
+        T& operator[](size_t i) { return *std::launder(reinterpret_cast<T*>(storage_ + i * sizeof(T))); }
+        const T& operator[](size_t i) const {
+            return *std::launder(reinterpret_cast<const T*>(storage_ + i * sizeof(T)));
+        }
+        T* begin() { return size_ ? &(*this)[0] : nullptr; }
+        T* end() { return begin() + size_; }
+        const T* begin() const { return size_ ? &(*this)[0] : nullptr; }
+        const T* end() const { return begin() + size_; }
+        size_t size() const { return size_; }
+        static constexpr size_t capacity() { return N; }
+
+    private:
+        alignas(T) unsigned char storage_[N * sizeof(T)];
+        size_t size_ = 0;
+    };
+
+    // Growing counterparts: never full
+    template<typename Container, typename... Args>
+    auto* try_emplace_back(Container& c, Args&&... args) {
+        if constexpr (requires { c.try_emplace_back(std::forward<Args>(args)...); }) {
+            return c.try_emplace_back(std::forward<Args>(args)...);
+        } else {
+            return &c.emplace_back(std::forward<Args>(args)...);
+        }
+    }
+
+    // Truncating inline string for names kept in static storage
+    template<size_t N>
+    class FixedString {
+    public:
+        FixedString(std::string_view s = {}) {
+            len_ = std::min(s.size(), N - 1);
+            std::memcpy(buf_, s.data(), len_);
+            buf_[len_] = '\0';
+        }
+        const char* c_str() const { return buf_; }
+        size_t size() const { return len_; }
+        operator std::string_view() const { return {buf_, len_}; }
+        friend bool operator==(const FixedString& a, std::string_view b) { return std::string_view(a) == b; }
+        friend std::ostream& operator<<(std::ostream& os, const FixedString& s) { return os << std::string_view(s); }
+
+    private:
+        char buf_[N];
+        size_t len_;
+    };
+
+#if YTRACE_FIXED_CAPACITY
+    using PointList = FixedVector<TracePointInfo, YTRACE_MAX_TRACE_POINTS>;
+    using CategoryList = FixedVector<Category, YTRACE_MAX_CATEGORIES>;
+    using PredicateList = FixedVector<Predicate, YTRACE_MAX_PREDICATES>;
+    using Name = FixedString<YTRACE_NAME_SIZE>;
+#else
+    using PointList = std::pmr::vector<TracePointInfo>;
+    using CategoryList = std::pmr::deque<Category>;
+    using PredicateList = std::pmr::deque<Predicate>;
+    using Name = std::pmr::string;
+#endif
+
+    inline Name make_name(std::string_view s) {
+#if YTRACE_FIXED_CAPACITY
+        return Name(s);
+#else
+        return Name(s, &memory_resource());
+#endif
+    }
+
+    // Heterogeneous lookup of string keys by string_view (no temporary key strings)
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+}
 
 #if !defined(YTRACE_NO_CONTROL_SOCKET)
 // Config persistence utility (requires filesystem and socket APIs)
@@ -70,11 +302,11 @@ public:
     // Stored config entry (loaded from file, used to restore state on registration)
     struct ConfigEntry {
         bool enabled;
-        std::string file;
+        std::pmr::string file;
         int line;
-        std::string function;
-        std::string level;
-        std::string message;
+        std::pmr::string function;
+        std::pmr::string level;
+        std::pmr::string message;
     };
 
     static std::string compute_path_hash(const std::string& path) {
@@ -135,100 +367,3177 @@ public:
 #endif
     }
 
-    static void save_state(const std::string& config_file, const std::vector<TracePointInfo>& points);
+    // Stored category state ("category <name> 0/1" lines)
+    struct CategoryEntry {
+        std::pmr::string name;
+        bool enabled;
+    };
+
+    static void save_state(const std::string& config_file, const detail::PointList& points,
+                           const detail::CategoryList& categories);
 
     // Load config entries from file (call once at startup)
-    static std::vector<ConfigEntry> load_config_entries(const std::string& config_file);
+    // Entries are allocated from ytrace::memory_resource()
+    static std::pmr::vector<ConfigEntry> load_config_entries(const std::string& config_file);
+    static std::pmr::vector<CategoryEntry> load_category_entries(const std::string& config_file);
 
     // Apply saved state to a trace point (call on each registration)
-    static bool apply_saved_state(const std::vector<ConfigEntry>& entries, TracePointInfo& point);
+    static bool apply_saved_state(const std::pmr::vector<ConfigEntry>& entries, TracePointInfo& point);
 };
 #endif // !YTRACE_NO_CONTROL_SOCKET
 
-// Info stored for each trace point
-struct TracePointInfo {
-    bool* enabled;
-    const char* file;
-    int line;
-    const char* function;
-    const char* level;      // "trace", "debug", "info", "warn", "func-entry", "func-exit"
-    const char* message;    // format string
+// Adaptive sampler for very hot points: passes 1 of every `interval` calls, where the
+// interval (a power of two) is re-tuned every window to keep the passed rate under
+// max_per_sec. calls() * 1/interval() scales sampled counts back to true totals.
+// Calls are counted per thread (Local) and folded into the shared total only when a call
+// is sampled, so skipped calls never write a shared cache line; calls() lags by up to
+// interval() - 1 calls per thread.
+class AdaptiveSampler {
+public:
+    static constexpr int64_t kWindowNs = 100000000;  // 100 ms
+
+    // Per-thread, per-site state (a static thread_local next to the sampler)
+    struct Local {
+        uint64_t count = 0;  // calls not yet folded into calls()
+        uint64_t due = 0;    // sample when count reaches it: the interval at the last sample
+    };
+
+    explicit AdaptiveSampler(uint32_t max_per_sec) : max_per_sec_(max_per_sec ? max_per_sec : 1) {}
+
+    bool sample(Local& local) {
+        if (++local.count < local.due) return false;
+        uint64_t n = calls_.fetch_add(local.count, std::memory_order_relaxed) + local.count;
+        local.count = 0;
+        // Only sampled calls read the clock, so retuning costs at most max_per_sec clock reads
+        retune(n);
+        local.due = interval_.load(std::memory_order_relaxed);
+        return true;
+    }
+
+    uint64_t interval() const { return interval_.load(std::memory_order_relaxed); }
+    uint64_t calls() const { return calls_.load(std::memory_order_relaxed); }
+    uint32_t max_per_sec() const { return max_per_sec_; }
+
+private:
+    void retune(uint64_t calls_now) {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t start = window_start_ns_.load(std::memory_order_relaxed);
+        if (start != 0 && now - start < kWindowNs) return;
+        if (!window_start_ns_.compare_exchange_strong(start, now, std::memory_order_relaxed)) return;
+
+        uint64_t prev = window_calls_.exchange(calls_now, std::memory_order_relaxed);
+        if (start == 0) return;  // first window just opened
+
+        double rate = static_cast<double>(calls_now - prev) * 1e9 / static_cast<double>(now - start);
+        uint64_t interval = 1;
+        while (interval < (uint64_t(1) << 40) && rate / static_cast<double>(interval) > max_per_sec_) {
+            interval <<= 1;
+        }
+        interval_.store(interval, std::memory_order_relaxed);
+    }
+
+    const uint32_t max_per_sec_;
+    std::atomic<uint64_t> calls_{0};
+    std::atomic<uint64_t> interval_{1};
+    std::atomic<int64_t> window_start_ns_{0};
+    std::atomic<uint64_t> window_calls_{0};
 };
 
-// Adaptive time unit formatting
-inline std::string format_duration(double ns) {
-    char buf[64];
-    if (ns < 1000.0) {
-        std::snprintf(buf, sizeof(buf), "%.1f ns", ns);
-    } else if (ns < 1000000.0) {
-        std::snprintf(buf, sizeof(buf), "%.1f us", ns / 1000.0);
-    } else if (ns < 1000000000.0) {
-        std::snprintf(buf, sizeof(buf), "%.1f ms", ns / 1000000.0);
-    } else {
-        std::snprintf(buf, sizeof(buf), "%.3f s", ns / 1000000000.0);
+#ifndef YTRACE_OBJECT_FILTER_SIZE
+#define YTRACE_OBJECT_FILTER_SIZE 64  // slots in the object key set (power of two)
+#endif
+
+// Set of object keys (pointers or ids) traced by points in object-filtered mode
+// (ylog_obj/ytrace_obj/yfunc_obj). Key 0 is reserved. contains() is lock-free; add and
+// remove are serialized. Removed keys leave tombstones, which lengthen probes: once they
+// fill a quarter of the slots, the live keys are rehashed into the second table and
+// readers switch to it in one store.
+class ObjectFilter {
+public:
+    static_assert((YTRACE_OBJECT_FILTER_SIZE & (YTRACE_OBJECT_FILTER_SIZE - 1)) == 0,
+                  "YTRACE_OBJECT_FILTER_SIZE must be a power of two");
+
+    static ObjectFilter& instance() {
+        static ObjectFilter filter;
+        return filter;
     }
-    return buf;
+
+    bool contains(uintptr_t key) const {
+        if (size_.load(std::memory_order_relaxed) == 0) return false;
+        const auto& slots = tables_[active_.load(std::memory_order_acquire)];
+        size_t i = hash(key);
+        for (size_t n = 0; n < YTRACE_OBJECT_FILTER_SIZE; ++n, i = (i + 1) & kMask) {
+            uintptr_t k = slots[i].load(std::memory_order_acquire);
+            if (k == key) return true;
+            if (k == kEmpty) return false;
+        }
+        return false;
+    }
+
+    // Returns false if the key is 0 or the set is full
+    bool add(uintptr_t key) {
+        if (key == kEmpty || key == kTombstone) return false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (contains(key)) return true;
+        auto& slots = tables_[active_.load(std::memory_order_relaxed)];
+        size_t i = hash(key);
+        for (size_t n = 0; n < YTRACE_OBJECT_FILTER_SIZE; ++n, i = (i + 1) & kMask) {
+            uintptr_t k = slots[i].load(std::memory_order_relaxed);
+            if (k == kEmpty || k == kTombstone) {
+                if (k == kTombstone) --tombstones_;
+                slots[i].store(key, std::memory_order_release);
+                size_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool remove(uintptr_t key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& slots = tables_[active_.load(std::memory_order_relaxed)];
+        size_t i = hash(key);
+        for (size_t n = 0; n < YTRACE_OBJECT_FILTER_SIZE; ++n, i = (i + 1) & kMask) {
+            uintptr_t k = slots[i].load(std::memory_order_relaxed);
+            if (k == key) {
+                slots[i].store(kTombstone, std::memory_order_release);
+                size_.fetch_sub(1, std::memory_order_relaxed);
+                if (++tombstones_ > YTRACE_OBJECT_FILTER_SIZE / 4) rehash();
+                return true;
+            }
+            if (k == kEmpty) return false;
+        }
+        return false;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& slot : tables_[active_.load(std::memory_order_relaxed)]) slot.store(kEmpty, std::memory_order_relaxed);
+        size_.store(0, std::memory_order_relaxed);
+        tombstones_ = 0;
+    }
+
+    std::vector<uintptr_t> keys() const {
+        std::vector<uintptr_t> result;
+        for (const auto& slot : tables_[active_.load(std::memory_order_acquire)]) {
+            uintptr_t k = slot.load(std::memory_order_relaxed);
+            if (k != kEmpty && k != kTombstone) result.push_back(k);
+        }
+        return result;
+    }
+
+    size_t tombstones() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tombstones_;
+    }
+
+private:
+    static constexpr uintptr_t kEmpty = 0;
+    static constexpr uintptr_t kTombstone = ~uintptr_t(0);
+    static constexpr size_t kMask = YTRACE_OBJECT_FILTER_SIZE - 1;
+
+    ObjectFilter() = default;
+
+    static size_t hash(uintptr_t key) {
+        return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> 32) & kMask;
+    }
+
+    // Caller holds mutex_: copy the live keys into the idle table and make it the active one.
+    // A reader still probing the old table sees it unchanged until the next rehash.
+    void rehash() {
+        unsigned from = active_.load(std::memory_order_relaxed);
+        auto& next = tables_[1 - from];
+        for (auto& slot : next) slot.store(kEmpty, std::memory_order_relaxed);
+        for (const auto& slot : tables_[from]) {
+            uintptr_t key = slot.load(std::memory_order_relaxed);
+            if (key == kEmpty || key == kTombstone) continue;
+            size_t i = hash(key);
+            while (next[i].load(std::memory_order_relaxed) != kEmpty) i = (i + 1) & kMask;
+            next[i].store(key, std::memory_order_relaxed);
+        }
+        active_.store(1 - from, std::memory_order_release);
+        tombstones_ = 0;
+    }
+
+    std::atomic<uintptr_t> tables_[2][YTRACE_OBJECT_FILTER_SIZE] = {};
+    std::atomic<unsigned> active_{0};
+    std::atomic<size_t> size_{0};
+    std::mutex mutex_;                    // add, remove, clear
+    size_t tombstones_ = 0;
+};
+
+namespace detail {
+    // Object keys: pointers by address, integral ids by value
+    template<typename T>
+    uintptr_t object_key(T* obj) { return reinterpret_cast<uintptr_t>(obj); }
+
+    template<typename T, typename = std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>>>
+    uintptr_t object_key(T id) { return static_cast<uintptr_t>(id); }
 }
 
-// Per-label timer statistics
-struct TimerStats {
-    uint64_t count = 0;
-    double avg = 0.0;
-    double min = 0.0;
-    double max = 0.0;
+#if defined(_MSC_VER)
+#define YTRACE_NOINLINE __declspec(noinline)
+#define YTRACE_ALWAYS_INLINE __forceinline
+#else
+#define YTRACE_NOINLINE __attribute__((noinline))
+#define YTRACE_ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
+#ifndef YTRACE_STACK_DEPTH
+#define YTRACE_STACK_DEPTH 32         // frames kept per captured stack
+#endif
+
+#ifndef YTRACE_STACK_TABLE_SIZE
+#define YTRACE_STACK_TABLE_SIZE 1024  // unique stacks kept (power of two)
+#endif
+
+namespace detail {
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__)) && !defined(YTRACE_STACK_UNWIND)
+    // Bounds of the calling thread's stack, looked up once per thread
+    inline std::pair<uintptr_t, uintptr_t> thread_stack_bounds() {
+        thread_local std::pair<uintptr_t, uintptr_t> bounds = [] {
+            std::pair<uintptr_t, uintptr_t> b{0, 0};
+            pthread_attr_t attr;
+            if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+                void* addr = nullptr;
+                size_t size = 0;
+                if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+                    b = {reinterpret_cast<uintptr_t>(addr), reinterpret_cast<uintptr_t>(addr) + size};
+                }
+                pthread_attr_destroy(&attr);
+            }
+            return b;
+        }();
+        return bounds;
+    }
+
+    // Walk the frame pointer chain. Frames of code built without frame pointers are
+    // skipped or end the walk early; reads never leave the thread's stack.
+    YTRACE_NOINLINE inline size_t capture_stack(void** out, size_t max, size_t skip) {
+        struct Frame {
+            Frame* next;
+            void* ret;
+        };
+        auto [lo, hi] = thread_stack_bounds();
+        auto* fp = static_cast<Frame*>(__builtin_frame_address(0));
+        size_t n = 0;
+        while (fp && n < max) {
+            auto addr = reinterpret_cast<uintptr_t>(fp);
+            if (addr < lo || addr + sizeof(Frame) > hi || (addr & (sizeof(void*) - 1))) break;
+            if (!fp->ret) break;
+            if (skip > 0) --skip;
+            else out[n++] = fp->ret;
+            if (fp->next <= fp) break;
+            fp = fp->next;
+        }
+        return n;
+    }
+#elif defined(__GNUC__) && !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    // Unwind with the C++ runtime unwinder (slower, works without frame pointers)
+    YTRACE_NOINLINE inline size_t capture_stack(void** out, size_t max, size_t skip) {
+        struct State {
+            void** out;
+            size_t max, skip, n;
+        } state{out, max, skip + 1, 0};  // the first frame reported is capture_stack itself
+        _Unwind_Backtrace([](_Unwind_Context* ctx, void* arg) -> _Unwind_Reason_Code {
+            auto& s = *static_cast<State*>(arg);
+            uintptr_t ip = _Unwind_GetIP(ctx);
+            if (!ip || s.n >= s.max) return _URC_END_OF_STACK;
+            if (s.skip > 0) --s.skip;
+            else s.out[s.n++] = reinterpret_cast<void*>(ip);
+            return _URC_NO_REASON;
+        }, &state);
+        return state.n;
+    }
+#else
+    inline size_t capture_stack(void**, size_t, size_t) { return 0; }
+#endif
+}
+
+// Lock-free table of unique call stacks. Points in "with stack" mode capture the
+// stack, look it up by hash and carry only the id ([stack #N]); stacks are stored
+// once and symbolized on demand by ytrace-ctl stacks. Entries are never removed.
+class StackTable {
+public:
+    static_assert((YTRACE_STACK_TABLE_SIZE & (YTRACE_STACK_TABLE_SIZE - 1)) == 0,
+                  "YTRACE_STACK_TABLE_SIZE must be a power of two");
+
+    struct Stack {
+        std::atomic<uint64_t> hash{0};   // 0 = free
+        std::atomic<bool> ready{false};  // frames written
+        uint32_t depth = 0;
+        void* frames[YTRACE_STACK_DEPTH] = {};  // return addresses, innermost first
+    };
+
+    static StackTable& instance() {
+        static StackTable table;
+        return table;
+    }
+
+    static constexpr size_t capacity() { return YTRACE_STACK_TABLE_SIZE; }
+
+    // Capture the caller's stack (minus skip frames) and return its id, 0 if the table is full
+    YTRACE_NOINLINE uint32_t capture(size_t skip = 0) {
+        void* frames[YTRACE_STACK_DEPTH];
+        size_t depth = detail::capture_stack(frames, YTRACE_STACK_DEPTH, skip + 1);
+        return intern(frames, depth);
+    }
+
+    uint32_t intern(void* const* frames, size_t depth) {
+        depth = std::min<size_t>(depth, YTRACE_STACK_DEPTH);
+        uint64_t h = hash(frames, depth);
+        size_t i = static_cast<size_t>(h) & (capacity() - 1);
+        for (size_t n = 0; n < capacity(); ++n, i = (i + 1) & (capacity() - 1)) {
+            Stack& s = stacks_[i];
+            uint64_t key = s.hash.load(std::memory_order_acquire);
+            if (key == 0 && s.hash.compare_exchange_strong(key, h, std::memory_order_acq_rel)) {
+                std::memcpy(s.frames, frames, depth * sizeof(void*));
+                s.depth = static_cast<uint32_t>(depth);
+                s.ready.store(true, std::memory_order_release);
+                size_.fetch_add(1, std::memory_order_relaxed);
+                return static_cast<uint32_t>(i + 1);
+            }
+            // Same hash: the same stack, unless a full compare says otherwise (a stack
+            // still being written by another thread is assumed equal)
+            if (key == h && (!s.ready.load(std::memory_order_acquire) ||
+                             (s.depth == depth && std::memcmp(s.frames, frames, depth * sizeof(void*)) == 0))) {
+                return static_cast<uint32_t>(i + 1);
+            }
+        }
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    // Stack of an id, nullptr if unknown
+    const Stack* get(uint32_t id) const {
+        if (id == 0 || id > capacity()) return nullptr;
+        const Stack& s = stacks_[id - 1];
+        return s.ready.load(std::memory_order_acquire) ? &s : nullptr;
+    }
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    StackTable() = default;
+
+    static uint64_t hash(void* const* frames, size_t depth) {
+        uint64_t h = 0xcbf29ce484222325ull ^ depth;
+        for (size_t i = 0; i < depth; ++i) {
+            h = (h ^ static_cast<uint64_t>(reinterpret_cast<uintptr_t>(frames[i]))) * 0x9E3779B97F4A7C15ull;
+            h ^= h >> 29;
+        }
+        return h ? h : 1;
+    }
+
+    Stack stacks_[YTRACE_STACK_TABLE_SIZE];
+    std::atomic<size_t> size_{0};
+    std::atomic<uint64_t> dropped_{0};
 };
 
-// Singleton manager that collects timer statistics and prints summary on exit
-class TimerManager {
+// Executable segment of a loaded module, as reported by the "maps" command
+struct LoadedModule {
+    uintptr_t start = 0;
+    uintptr_t end = 0;
+    uintptr_t base = 0;         // load bias: pc - base is the address within the ELF file
+    std::string build_id;       // GNU build-id in hex, "" if the module has none
+    std::string path;
+};
+
+namespace detail {
+    // Executable segments and build-ids of all loaded modules, read from the dynamic
+    // loader's program headers in memory: no file I/O, dladdr or demangling.
+    inline std::vector<LoadedModule> loaded_modules() {
+        std::vector<LoadedModule> modules;
+#ifdef __linux__
+        dl_iterate_phdr([](dl_phdr_info* info, size_t, void* data) -> int {
+            auto& out = *static_cast<std::vector<LoadedModule>*>(data);
+            std::string path = info->dlpi_name ? info->dlpi_name : "";
+            if (path.empty() && out.empty()) {
+                // The main program is reported first, without a name
+                char exe[4096];
+                ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+                if (n > 0) path.assign(exe, static_cast<size_t>(n));
+            }
+            std::string build_id;
+            for (int i = 0; i < info->dlpi_phnum; ++i) {
+                const auto& ph = info->dlpi_phdr[i];
+                if (ph.p_type != PT_NOTE) continue;
+                auto* p = reinterpret_cast<const unsigned char*>(info->dlpi_addr + ph.p_vaddr);
+                auto* end = p + ph.p_memsz;
+                while (build_id.empty() && p + sizeof(ElfW(Nhdr)) <= end) {
+                    auto* note = reinterpret_cast<const ElfW(Nhdr)*>(p);
+                    const unsigned char* name = p + sizeof(ElfW(Nhdr));
+                    const unsigned char* desc = name + ((note->n_namesz + 3) & ~3u);
+                    if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                        std::memcmp(name, "GNU", 4) == 0 && desc + note->n_descsz <= end) {
+                        static const char hex[] = "0123456789abcdef";
+                        for (size_t j = 0; j < note->n_descsz; ++j) {
+                            build_id += hex[desc[j] >> 4];
+                            build_id += hex[desc[j] & 15];
+                        }
+                    }
+                    p = desc + ((note->n_descsz + 3) & ~3u);
+                }
+            }
+            for (int i = 0; i < info->dlpi_phnum; ++i) {
+                const auto& ph = info->dlpi_phdr[i];
+                if (ph.p_type != PT_LOAD || !(ph.p_flags & PF_X)) continue;
+                uintptr_t start = info->dlpi_addr + ph.p_vaddr;
+                out.push_back({start, start + ph.p_memsz, info->dlpi_addr, build_id, path});
+            }
+            return 0;
+        }, &modules);
+#endif
+        return modules;
+    }
+}
+
+// Compiled argument predicate of a conditional trace point (ytrace-ctl enable --when).
+// Expressions compare the point's arguments (arg0, arg1, ...) with literals:
+//   arg0 > 1000 && (arg1 == "GET" || !(arg2 < 0.5))
+// and compile to a small stack bytecode that runs before formatting. Comparisons with a
+// missing argument or mismatched types (number vs string) are false.
+class Predicate {
 public:
-    static TimerManager& instance() {
-        static TimerManager mgr;
-        return mgr;
+    // An argument or constant as seen by the interpreter
+    struct Value {
+        enum Kind : uint8_t { None, Int, Float, Str } kind = None;
+        int64_t i = 0;
+        double f = 0.0;
+        const char* s = nullptr;
+    };
+
+    static constexpr size_t kMaxStack = 16;
+
+    Predicate() = default;
+    Predicate(const Predicate&) = delete;             // string constants are referenced by pointer
+    Predicate& operator=(const Predicate&) = delete;
+
+    // Returns false and sets error on a syntax error
+    bool compile(std::string_view expr, std::string& error) {
+        source_ = std::string(expr);
+        code_.clear();
+        consts_.clear();
+        strings_.clear();
+        patterns_.clear();
+        Parser parser(*this, source_);
+        if (!parser.parse_or()) {
+            error = parser.error;
+            return false;
+        }
+        parser.skip_space();
+        if (parser.pos != source_.size()) {
+            error = "unexpected '" + source_.substr(parser.pos, 1) + "' at " + std::to_string(parser.pos);
+            return false;
+        }
+        return true;
     }
 
-    void record(const std::string& label, double duration_ns) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto& s = stats_[label];
-        s.count++;
-        if (s.count == 1) {
-            s.avg = duration_ns;
-            s.min = duration_ns;
-            s.max = duration_ns;
+    bool eval(const Value* args, size_t count) const {
+        Value stack[kMaxStack];
+        size_t sp = 0;
+        for (const Insn& insn : code_) {
+            switch (insn.op) {
+            case Op::Arg:   stack[sp++] = insn.index < count ? args[insn.index] : Value{}; break;
+            case Op::Const: stack[sp++] = consts_[insn.index]; break;
+            case Op::Not:   stack[sp - 1] = boolean(!truthy(stack[sp - 1])); break;
+            case Op::And:   --sp; stack[sp - 1] = boolean(truthy(stack[sp - 1]) && truthy(stack[sp])); break;
+            case Op::Or:    --sp; stack[sp - 1] = boolean(truthy(stack[sp - 1]) || truthy(stack[sp])); break;
+            case Op::Match: stack[sp - 1] = boolean(stack[sp - 1].kind == Value::Str && stack[sp - 1].s &&
+                                                    patterns_[insn.index].search(stack[sp - 1].s)); break;
+            default:        --sp; stack[sp - 1] = boolean(compare(insn.op, stack[sp - 1], stack[sp])); break;
+            }
+        }
+        return sp == 1 && truthy(stack[0]);
+    }
+
+    const std::string& source() const { return source_; }
+
+private:
+    enum class Op : uint8_t { Arg, Const, Not, And, Or, Eq, Ne, Lt, Le, Gt, Ge, Match };
+
+    struct Insn {
+        Op op;
+        uint8_t index;  // argument (Arg), constant (Const) or pattern (Match) index
+    };
+
+    static Value boolean(bool b) { Value v; v.kind = Value::Int; v.i = b; return v; }
+
+    static bool truthy(const Value& v) {
+        switch (v.kind) {
+        case Value::Int:   return v.i != 0;
+        case Value::Float: return v.f != 0.0;
+        case Value::Str:   return v.s != nullptr;
+        default:           return false;
+        }
+    }
+
+    static bool compare(Op op, const Value& a, const Value& b) {
+        int c;
+        if (a.kind == Value::Int && b.kind == Value::Int) {
+            c = (a.i < b.i) ? -1 : (a.i > b.i);
+        } else if ((a.kind == Value::Int || a.kind == Value::Float) &&
+                   (b.kind == Value::Int || b.kind == Value::Float)) {
+            double x = a.kind == Value::Int ? static_cast<double>(a.i) : a.f;
+            double y = b.kind == Value::Int ? static_cast<double>(b.i) : b.f;
+            if (x != x || y != y) return false;  // NaN
+            c = (x < y) ? -1 : (x > y);
+        } else if (a.kind == Value::Str && b.kind == Value::Str && a.s && b.s) {
+            c = std::strcmp(a.s, b.s);
         } else {
-            s.avg += (duration_ns - s.avg) / static_cast<double>(s.count);
-            if (duration_ns < s.min) s.min = duration_ns;
-            if (duration_ns > s.max) s.max = duration_ns;
+            return false;
+        }
+        switch (op) {
+        case Op::Eq: return c == 0;
+        case Op::Ne: return c != 0;
+        case Op::Lt: return c < 0;
+        case Op::Le: return c <= 0;
+        case Op::Gt: return c > 0;
+        default:     return c >= 0;
         }
     }
 
-    std::string summary() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (stats_.empty()) return "";
-        std::ostringstream oss;
-        for (const auto& [label, s] : stats_) {
-            char line[256];
-            std::snprintf(line, sizeof(line), "  %-40s  count=%" PRIu64 "  avg=%s  min=%s  max=%s\n",
-                label.c_str(), s.count,
-                format_duration(s.avg).c_str(),
-                format_duration(s.min).c_str(),
-                format_duration(s.max).c_str());
-            oss << line;
+    // Recursive descent parser emitting postfix code:
+    //   or := and ('||' and)*   and := not ('&&' not)*   not := '!' not | cmp
+    //   cmp := primary (op primary | '~' "regex")?   primary := '(' or ')' | argN | number | "string"
+    struct Parser {
+        Predicate& pred;
+        std::string_view src;
+        size_t pos = 0;
+        size_t depth = 0;
+        std::string error;
+
+        Parser(Predicate& p, std::string_view s) : pred(p), src(s) {}
+
+        void skip_space() {
+            while (pos < src.size() && std::isspace(static_cast<unsigned char>(src[pos]))) ++pos;
+        }
+
+        bool accept(std::string_view tok) {
+            skip_space();
+            if (src.substr(pos, tok.size()) != tok) return false;
+            pos += tok.size();
+            return true;
+        }
+
+        bool fail(const std::string& msg) {
+            if (error.empty()) error = msg + " at " + std::to_string(pos);
+            return false;
+        }
+
+        bool emit(Op op, uint8_t index = 0) {
+            if (op == Op::Arg || op == Op::Const) {
+                if (++depth > kMaxStack) return fail("expression too deep");
+            } else if (op != Op::Not) {
+                --depth;
+            }
+            if (pred.code_.size() >= 255) return fail("expression too long");
+            pred.code_.push_back({op, index});
+            return true;
+        }
+
+        bool parse_or() {
+            if (!parse_and()) return false;
+            while (accept("||")) {
+                if (!parse_and() || !emit(Op::Or)) return false;
+            }
+            return true;
+        }
+
+        bool parse_and() {
+            if (!parse_not()) return false;
+            while (accept("&&")) {
+                if (!parse_not() || !emit(Op::And)) return false;
+            }
+            return true;
+        }
+
+        bool parse_not() {
+            skip_space();
+            if (pos < src.size() && src[pos] == '!' && src.substr(pos, 2) != "!=") {
+                ++pos;
+                return parse_not() && emit(Op::Not);
+            }
+            return parse_cmp();
+        }
+
+        bool parse_cmp() {
+            if (!parse_primary()) return false;
+            if (accept("~")) return parse_match();
+            static constexpr std::pair<std::string_view, Op> ops[] = {
+                {"==", Op::Eq}, {"!=", Op::Ne}, {"<=", Op::Le}, {">=", Op::Ge}, {"<", Op::Lt}, {">", Op::Gt}};
+            for (const auto& [tok, op] : ops) {
+                if (accept(tok)) return parse_primary() && emit(op);
+            }
+            return true;
+        }
+
+        bool parse_primary() {
+            skip_space();
+            if (pos >= src.size()) return fail("unexpected end");
+            char c = src[pos];
+            if (c == '(') {
+                ++pos;
+                if (!parse_or()) return false;
+                return accept(")") || fail("expected ')'");
+            }
+            if (c == '"') {
+                size_t end = src.find('"', pos + 1);
+                if (end == std::string_view::npos) return fail("unterminated string");
+                pred.strings_.emplace_back(src.substr(pos + 1, end - pos - 1));
+                Value v;
+                v.kind = Value::Str;
+                v.s = pred.strings_.back().c_str();
+                pos = end + 1;
+                return push_const(v);
+            }
+            if (src.substr(pos, 3) == "arg") {
+                size_t start = pos + 3, end = start;
+                while (end < src.size() && std::isdigit(static_cast<unsigned char>(src[end]))) ++end;
+                if (end == start || end - start > 2) return fail("expected argument index");
+                int index = std::stoi(std::string(src.substr(start, end - start)));
+                pos = end;
+                return emit(Op::Arg, static_cast<uint8_t>(index));
+            }
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '-' || c == '.') {
+                size_t end = pos + 1;
+                while (end < src.size() && (std::isalnum(static_cast<unsigned char>(src[end])) || src[end] == '.' ||
+                       ((src[end] == '-' || src[end] == '+') && (src[end - 1] == 'e' || src[end - 1] == 'E')))) ++end;
+                std::string text(src.substr(pos, end - pos));
+                bool hex = text.find("0x") != std::string::npos || text.find("0X") != std::string::npos;
+                bool fp = !hex && text.find_first_of(".eE") != std::string::npos;
+                char* parsed_end = nullptr;
+                Value v;
+                if (fp) {
+                    v.kind = Value::Float;
+                    v.f = std::strtod(text.c_str(), &parsed_end);
+                } else {
+                    v.kind = Value::Int;
+                    v.i = std::strtoll(text.c_str(), &parsed_end, hex ? 16 : 10);
+                }
+                if (parsed_end != text.c_str() + text.size()) return fail("bad number '" + text + "'");
+                pos = end;
+                return push_const(v);
+            }
+            return fail("unexpected '" + std::string(1, c) + "'");
+        }
+
+        // The regex of '~' must be a string constant; it is compiled once, here
+        bool parse_match() {
+            size_t at = pos;
+            if (!parse_primary()) return false;
+            const Insn& last = pred.code_.back();
+            if (last.op != Op::Const || pred.consts_[last.index].kind != Value::Str) {
+                pos = at;
+                return fail("expected a \"regex\" after '~'");
+            }
+            std::string pattern_error;
+            Pattern pattern;
+            if (!pattern.compile(pred.consts_[last.index].s, Pattern::Syntax::regex, pattern_error)) {
+                pos = at;
+                return fail("bad regex (" + pattern_error + ")");
+            }
+            // Predicates run on the traced thread: only DFA-backed patterns, never the
+            // allocating NFA simulation
+            if (!pattern.uses_dfa()) {
+                pos = at;
+                return fail("regex too complex (more than " + std::to_string(Pattern::kMaxDfaStates) + " DFA states)");
+            }
+            if (pred.patterns_.size() >= 255) return fail("too many patterns");
+            pred.patterns_.push_back(std::move(pattern));
+            pred.code_.back() = {Op::Match, static_cast<uint8_t>(pred.patterns_.size() - 1)};
+            --depth;
+            return true;
+        }
+
+        bool push_const(const Value& v) {
+            if (pred.consts_.size() >= 255) return fail("too many constants");
+            pred.consts_.push_back(v);
+            return emit(Op::Const, static_cast<uint8_t>(pred.consts_.size() - 1));
+        }
+    };
+
+    std::string source_;
+    std::vector<Insn> code_;
+    std::vector<Value> consts_;
+    std::deque<std::string> strings_;  // storage of string constants (stable addresses)
+    std::vector<Pattern> patterns_;    // compiled '~' regexes
+};
+
+namespace detail {
+    // Bits of the call-path scopes (CallPath) active on this thread
+    inline thread_local uint64_t t_call_path = 0;
+
+    // Function of the innermost yfunc()/ytimeit() scope on this thread, kept only while
+    // scope tracking is on (libytrace_preload attributes I/O latency to it)
+    inline thread_local const char* t_scope = nullptr;
+}
+
+// Call-path scopes: functions that points can be enabled "under" (ytrace-ctl enable
+// --under FUNC, yenable_func_under). Each yfunc()/ytimeit() site registers an anchor that
+// holds its function's bit, 0 until some point is enabled under that function; while the
+// scope runs, the bit is set in the thread's path (CallPathGuard). A point enabled under
+// FUNC then emits only when (path & bit) != 0. Up to 63 functions at a time: once all bits
+// are taken, a bit no point is enabled under any more (an old scope, a misspelt name) is
+// taken back from its function for the new one. The top bit of every anchor says whether
+// scope tracking is on, so a scope reads a single word either way.
+class CallPath {
+public:
+    static CallPath& instance() {
+        static CallPath paths;
+        return paths;
+    }
+
+    static constexpr size_t capacity() { return 63; }
+
+    // Anchor flag: the scope records itself as the thread's innermost one (detail::t_scope)
+    static constexpr uint64_t kTrackScope = uint64_t(1) << 63;
+
+    // Called once per yfunc()/ytimeit() site: stores the site's current bit in *bit, which
+    // later assignments update. false if the site stays untracked (registry full).
+    bool register_anchor(std::atomic<uint64_t>* bit, const char* function) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!detail::try_emplace_back(anchors_, Anchor{bit, function})) return false;
+        bit->store(find_locked(function) | track_, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Scope tracking, off by default (libytrace_preload turns it on): sets or clears
+    // kTrackScope in every anchor
+    void track_scopes(bool on) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        track_ = on ? kTrackScope : 0;
+        for (auto& anchor : anchors_) {
+            uint64_t b = anchor.bit->load(std::memory_order_relaxed) & ~kTrackScope;
+            anchor.bit->store(b | track_, std::memory_order_relaxed);
+        }
+    }
+
+    // Bit of function, assigned on first use and published to its anchors. in_use: bits
+    // some point is enabled under, which are never taken back. 0 if all bits are in use.
+    uint64_t bit(std::string_view function, uint64_t in_use = ~uint64_t(0)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (uint64_t b = find_locked(function)) return b;
+        size_t slot = names_.size();
+        if (slot == capacity()) {
+            for (slot = 0; slot < capacity() && (in_use >> slot & 1); ++slot) {}
+            if (slot == capacity()) return 0;
+            publish_locked(names_[slot], 0);  // scopes of the old function no longer set it
+            names_[slot] = function;
+        } else {
+            detail::try_emplace_back(names_, function);  // pmr: the string uses the vector's resource
+        }
+        uint64_t b = uint64_t(1) << slot;
+        publish_locked(function, b);
+        return b;
+    }
+
+    // Function names of the bits in mask, comma-separated
+    std::string names(uint64_t mask) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string out;
+        for (size_t i = 0; i < names_.size(); ++i) {
+            if (!(mask >> i & 1)) continue;
+            if (!out.empty()) out += ',';
+            out += std::string_view(names_[i]);
+        }
+        return out;
+    }
+
+private:
+    CallPath() = default;
+
+    uint64_t find_locked(std::string_view function) const {
+        for (size_t i = 0; i < names_.size(); ++i) {
+            if (names_[i] == function) return uint64_t(1) << i;
+        }
+        return 0;
+    }
+
+    void publish_locked(std::string_view function, uint64_t b) {
+        for (auto& anchor : anchors_) {
+            if (function == anchor.function) anchor.bit->store(b | track_, std::memory_order_relaxed);
+        }
+    }
+
+    struct Anchor {
+        std::atomic<uint64_t>* bit;
+        const char* function;
+    };
+#if YTRACE_FIXED_CAPACITY
+    detail::FixedVector<Anchor, YTRACE_MAX_TRACE_POINTS> anchors_;
+#else
+    std::pmr::vector<Anchor> anchors_{&memory_resource()};
+#endif
+#if YTRACE_FIXED_CAPACITY
+    detail::FixedVector<detail::Name, 63> names_;
+#else
+    std::pmr::vector<detail::Name> names_{&memory_resource()};
+#endif
+    uint64_t track_ = 0;  // kTrackScope while scope tracking is on
+    mutable std::mutex mutex_;
+};
+
+// Marks a yfunc()/ytimeit() scope on the thread's call path while it runs, and as the
+// thread's innermost scope while scope tracking is on. bit is the anchor's word, with
+// CallPath::kTrackScope; free (the anchor load and a branch) when it is 0.
+class CallPathGuard {
+public:
+    CallPathGuard(uint64_t bit, const char* scope) : bit_(bit) {
+        if (!bit_) return;
+        saved_ = detail::t_call_path;
+        detail::t_call_path = saved_ | bit_;  // kTrackScope is never a point's "under" bit
+        if (bit_ & CallPath::kTrackScope) {
+            saved_scope_ = detail::t_scope;
+            detail::t_scope = scope;
+        }
+    }
+    ~CallPathGuard() {
+        if (!bit_) return;
+        detail::t_call_path = saved_;
+        if (bit_ & CallPath::kTrackScope) detail::t_scope = saved_scope_;
+    }
+    CallPathGuard(const CallPathGuard&) = delete;
+    CallPathGuard& operator=(const CallPathGuard&) = delete;
+
+private:
+    uint64_t bit_;
+    uint64_t saved_ = 0;
+    const char* saved_scope_ = nullptr;
+};
+
+namespace detail {
+    inline thread_local uint64_t t_thread_bits = 0;        // ThreadFilter bits matching this thread
+    inline thread_local uint64_t t_thread_generation = 0;  // ThreadFilter generation of t_thread_bits
+    inline thread_local std::string t_thread_name;         // ThreadFilter::set_thread_name()
+}
+
+// Thread filters: glob patterns points can be enabled for (ytrace-ctl enable --thread
+// 'io-*', yenable_func_on_thread). A pattern matches a thread by name (set_thread_name(),
+// else pthread_getname_np) or by decimal thread id. Each pattern gets one of 64 bits;
+// a thread caches the bits of the patterns matching it and recomputes them only when the
+// generation changes, i.e. when a pattern is added or the thread is renamed through
+// set_thread_name(). Renames by pthread_setname_np alone are seen at the next pattern.
+class ThreadFilter {
+public:
+    static ThreadFilter& instance() {
+        static ThreadFilter filter;
+        return filter;
+    }
+
+    static constexpr size_t capacity() { return 64; }
+
+    // Bit of glob, assigned on first use; 0 (with error set) if it does not compile or
+    // all bits are taken
+    uint64_t bit(std::string_view glob, std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < count_; ++i) {
+            if (patterns_[i].source() == glob) return uint64_t(1) << i;
+        }
+        if (count_ == capacity()) {
+            error = "too many thread patterns (max 64)";
+            return 0;
+        }
+        if (!patterns_[count_].compile(glob, Pattern::Syntax::glob, error)) return 0;
+        generation_.fetch_add(1, std::memory_order_release);
+        return uint64_t(1) << count_++;
+    }
+
+    // Patterns of the bits in mask, comma-separated
+    std::string patterns(uint64_t mask) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string out;
+        for (size_t i = 0; i < count_; ++i) {
+            if (!(mask >> i & 1)) continue;
+            if (!out.empty()) out += ',';
+            out += patterns_[i].source();
+        }
+        return out;
+    }
+
+    // Bits of the patterns matching the calling thread: a generation compare unless
+    // patterns changed since the thread last looked
+    uint64_t current() {
+        if (detail::t_thread_generation != generation_.load(std::memory_order_acquire)) refresh();
+        return detail::t_thread_bits;
+    }
+
+    // Name the calling thread for thread filters
+    static void set_thread_name(std::string_view name) {
+        detail::t_thread_name = name;
+        detail::t_thread_generation = 0;
+    }
+
+    // Name thread filters match the calling thread by
+    static std::string thread_name() {
+        if (!detail::t_thread_name.empty()) return detail::t_thread_name;
+#ifdef __linux__
+        char buf[64] = {};
+        if (pthread_getname_np(pthread_self(), buf, sizeof(buf)) == 0) return buf;
+#endif
+        return "";
+    }
+
+private:
+    ThreadFilter() = default;
+
+    void refresh() {
+        std::string name = thread_name();
+#ifdef __linux__
+        std::string id = std::to_string(static_cast<long>(syscall(SYS_gettid)));
+#else
+        std::string id;
+#endif
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t bits = 0;
+        for (size_t i = 0; i < count_; ++i) {
+            if (patterns_[i].search(name) || (!id.empty() && patterns_[i].search(id))) bits |= uint64_t(1) << i;
+        }
+        detail::t_thread_bits = bits;
+        detail::t_thread_generation = generation_.load(std::memory_order_relaxed);
+    }
+
+    Pattern patterns_[64];
+    size_t count_ = 0;
+    std::atomic<uint64_t> generation_{1};   // t_thread_generation starts stale
+    mutable std::mutex mutex_;
+};
+
+// Runtime controls of a ylog point beyond on/off
+struct PointControl {
+    std::atomic<const Predicate*> predicate{nullptr};  // nullptr = unconditional
+    std::atomic<uint64_t> under{0};                    // CallPath bits; 0 = on any path
+    std::atomic<uint64_t> threads{0};                  // ThreadFilter bits; 0 = on any thread
+    bool with_stack = false;                           // append [stack #N] (StackTable id)
+    mutable std::atomic<uint64_t> hits{0};             // emitted records while history is on
+};
+
+namespace detail {
+    // Set while RateHistory is on. Points only count hits then, so an enabled ylog does not
+    // write a shared counter on every record.
+    inline std::atomic<bool>& count_hits() {
+        static std::atomic<bool> on{false};
+        return on;
+    }
+
+    YTRACE_ALWAYS_INLINE void note_hit(const PointControl& ctl) {
+        if (count_hits().load(std::memory_order_relaxed)) [[unlikely]]
+            ctl.hits.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+namespace detail {
+    // Typed argument -> predicate value (chosen at compile time from the point's Args...)
+    template<typename T>
+    Predicate::Value predicate_value(const T& arg) {
+        using U = std::decay_t<T>;
+        Predicate::Value v;
+        if constexpr (std::is_same_v<U, bool> || std::is_enum_v<U>) {
+            v.kind = Predicate::Value::Int;
+            v.i = static_cast<int64_t>(arg);
+        } else if constexpr (std::is_integral_v<U>) {
+            if constexpr (std::is_unsigned_v<U> && sizeof(U) >= sizeof(int64_t)) {
+                if (arg > static_cast<U>(INT64_MAX)) {
+                    v.kind = Predicate::Value::Float;
+                    v.f = static_cast<double>(arg);
+                    return v;
+                }
+            }
+            v.kind = Predicate::Value::Int;
+            v.i = static_cast<int64_t>(arg);
+        } else if constexpr (std::is_floating_point_v<U>) {
+            v.kind = Predicate::Value::Float;
+            v.f = static_cast<double>(arg);
+        } else if constexpr (std::is_same_v<U, const char*> || std::is_same_v<U, char*>) {
+            v.kind = Predicate::Value::Str;
+            v.s = arg;
+        } else if constexpr (std::is_same_v<U, std::string>) {
+            v.kind = Predicate::Value::Str;
+            v.s = arg.c_str();
+        } else if constexpr (std::is_pointer_v<U>) {
+            v.kind = Predicate::Value::Int;
+            v.i = static_cast<int64_t>(reinterpret_cast<uintptr_t>(arg));
+        }
+        return v;
+    }
+
+    // True unless the point has a predicate that rejects these arguments
+    template<typename... Args>
+    bool condition_passes(const PointControl& cond, const Args&... args) {
+        uint64_t under = cond.under.load(std::memory_order_relaxed);
+        if (under && !(t_call_path & under)) return false;
+        uint64_t threads = cond.threads.load(std::memory_order_relaxed);
+        if (threads && !(ThreadFilter::instance().current() & threads)) return false;
+        const Predicate* pred = cond.predicate.load(std::memory_order_acquire);
+        if (!pred) return true;
+        if constexpr (sizeof...(Args) == 0) {
+            return pred->eval(nullptr, 0);
+        } else {
+            const Predicate::Value values[] = {predicate_value(args)...};
+            return pred->eval(values, sizeof...(Args));
+        }
+    }
+}
+
+// Category (subsystem tag) shared by points in many files, e.g. ylog_cat(net, ...).
+// A categorized point is on if it is enabled itself or its category is enabled.
+struct Category {
+    detail::Name name;
+    std::atomic<bool> enabled{false};
+    size_t first_point = SIZE_MAX;  // registry index of the newest member, chained through
+    size_t point_count = 0;         // TracePointInfo::next_in_category (under the manager lock)
+
+    explicit Category(std::string_view n) : name(detail::make_name(n)) {}
+};
+
+// Info stored for each trace point
+struct TracePointInfo {
+    bool* enabled;
+    const char* file;
+    int line;
+    const char* function;
+    const char* level;      // "trace", "debug", "info", "warn", "func-entry", "func-exit"
+    const char* message;    // format string
+    // Optional: called (under the manager lock) after *enabled changes, for points whose
+    // activation needs more than a flag write (e.g. patching code)
+    void (*on_change)(const TracePointInfo&) = nullptr;
+    void* context = nullptr;
+    AdaptiveSampler* sampler = nullptr;   // set for adaptively sampled points (yfunc_adaptive)
+    Category* category = nullptr;         // set for categorized points (ylog_cat)
+    bool self_enabled = false;            // categorized points: the point's own state
+    size_t next_in_category = SIZE_MAX;   // categorized points: next member (registry index)
+    bool* object_filtered = nullptr;      // set for object points (ylog_obj): true = only keys in ObjectFilter
+    PointControl* control = nullptr;      // set for ylog points: predicate and stack capture
+};
+
+// How an enable applies to points with object filtering or predicates
+struct EnableMode {
+    bool object_filtered = false;         // object points: trace only keys in ObjectFilter
+    const Predicate* condition = nullptr; // conditional points: emit only when this matches
+    bool with_stack = false;              // ylog points: capture the call stack
+    uint64_t under = 0;                   // ylog points: emit only beneath these CallPath scopes
+    uint64_t threads = 0;                 // ylog points: emit only on threads of these ThreadFilter patterns
+};
+
+// The state a user set on the point itself (*enabled may also reflect its category)
+inline bool own_state(const TracePointInfo& info) {
+    return info.category ? info.self_enabled : *info.enabled;
+}
+
+// Per-point state appended to a "list" line after the message
+inline void append_point_state(std::ostream& os, const TracePointInfo& info) {
+    if (info.sampler) {
+        os << " sample=1/" << info.sampler->interval() << " calls=" << info.sampler->calls();
+    }
+    if (info.category) {
+        os << " cat=" << info.category->name;
+    }
+    if (info.object_filtered) {
+        os << (*info.object_filtered ? " obj=filtered" : " obj=any");
+    }
+    if (info.control) {
+        if (info.control->with_stack) {
+            os << " stack=on";
+        }
+        if (uint64_t hits = info.control->hits.load(std::memory_order_relaxed)) {
+            os << " hits=" << hits;
+        }
+        if (const Predicate* pred = info.control->predicate.load(std::memory_order_relaxed)) {
+            os << " when=" << pred->source();
+        }
+        if (uint64_t under = info.control->under.load(std::memory_order_relaxed)) {
+            os << " under=" << CallPath::instance().names(under);
+        }
+        if (uint64_t threads = info.control->threads.load(std::memory_order_relaxed)) {
+            os << " thread=" << ThreadFilter::instance().patterns(threads);
+        }
+    }
+}
+
+namespace detail {
+    // Where records go, in one word so that output() costs a single load:
+    // kRouteDrain while the DrainPool runs (see drain_push()), kRouteHold while an enable
+    // profile is being switched in (ProfileSet::apply). Held records wait out the switch
+    // instead of being written while the flags are half switched.
+    enum : uint32_t { kRouteDrain = 1, kRouteHold = 2 };
+
+    inline std::atomic<uint32_t>& route() {
+        static std::atomic<uint32_t> bits{0};
+        return bits;
+    }
+
+    // Route of a record about to be written, after any profile switch in progress
+    inline uint32_t settled_route() {
+        uint32_t bits = route().load(std::memory_order_acquire);
+        while (bits & kRouteHold) [[unlikely]] {
+            std::this_thread::yield();
+            bits = route().load(std::memory_order_acquire);
+        }
+        return bits;
+    }
+}
+
+// Named enable profiles ("net-debug", "quiet"): the points and categories that are on,
+// captured from the current state by "profile save" and switched in by "profile use".
+// Points not in a profile are turned off by it. Each profile keeps a precomputed flag
+// table by registry index (the registry only grows), extended as points register, so
+// a switch writes only the flags that differ.
+class ProfileSet {
+public:
+    struct Profile {
+        std::string name;
+        std::set<std::string> points;      // point_key() of the points that are on
+        std::set<std::string> categories;  // enabled categories
+        std::vector<uint8_t> table;        // registry index -> target state
+    };
+
+    static std::string point_key(const TracePointInfo& info) {
+        return std::string(info.file) + " " + std::to_string(info.line) + " " + info.function + " " + info.level +
+               " " + info.message;
+    }
+
+    // Profile names are single words (they appear in commands and in the profiles file)
+    static bool valid_name(std::string_view name) {
+        return !name.empty() && std::none_of(name.begin(), name.end(), [](char c) {
+            return std::isspace(static_cast<unsigned char>(c)) || std::iscntrl(static_cast<unsigned char>(c));
+        });
+    }
+
+    // Create or replace a profile from the current own state of points and categories
+    Profile& capture(std::string_view name, const detail::PointList& points, const detail::CategoryList& categories) {
+        Profile* profile = find(name);
+        if (!profile) profile = &profiles_.emplace_back(Profile{std::string(name), {}, {}, {}});
+        profile->points.clear();
+        profile->categories.clear();
+        profile->table.clear();
+        for (const auto& info : points) {
+            if (own_state(info)) profile->points.insert(point_key(info));
+        }
+        for (const auto& cat : categories) {
+            if (cat.enabled.load(std::memory_order_relaxed)) profile->categories.emplace(std::string_view(cat.name));
+        }
+        return *profile;
+    }
+
+    Profile* find(std::string_view name) {
+        for (auto& profile : profiles_) {
+            if (profile.name == name) return &profile;
+        }
+        return nullptr;
+    }
+
+    bool remove(std::string_view name) {
+        for (auto it = profiles_.begin(); it != profiles_.end(); ++it) {
+            if (it->name == name) {
+                profiles_.erase(it);
+                if (active_ == name) active_.clear();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Switch profile in: categories first, then the points whose state differs, inside
+    // one kRouteHold window. set_point(info, state) and refresh_point(info) are the
+    // manager's (the caller holds its lock).
+    template<typename SetPoint, typename RefreshPoint>
+    void apply(Profile& profile, detail::PointList& points, detail::CategoryList& categories,
+               SetPoint&& set_point, RefreshPoint&& refresh_point) {
+        for (size_t i = profile.table.size(); i < points.size(); ++i) {
+            profile.table.push_back(profile.points.count(point_key(points[i])) ? 1 : 0);
+        }
+        detail::route().fetch_or(detail::kRouteHold, std::memory_order_acq_rel);
+        bool categories_changed = false;
+        for (auto& cat : categories) {
+            bool on = profile.categories.count(std::string(std::string_view(cat.name))) > 0;
+            if (cat.enabled.exchange(on, std::memory_order_relaxed) != on) categories_changed = true;
+        }
+        size_t i = 0;
+        for (auto& info : points) {
+            bool on = profile.table[i++] != 0;
+            if (own_state(info) != on) set_point(info, on);
+            else if (categories_changed && info.category) refresh_point(info);
+        }
+        detail::route().fetch_and(~uint32_t(detail::kRouteHold), std::memory_order_release);
+        active_ = profile.name;
+    }
+
+    // "name (N points, M categories)" per profile, the active one marked with '*'
+    std::string list() const {
+        std::ostringstream oss;
+        for (const auto& profile : profiles_) {
+            oss << (profile.name == active_ ? "* " : "  ") << profile.name << " (" << profile.points.size()
+                << " point(s), " << profile.categories.size() << " categor"
+                << (profile.categories.size() == 1 ? "y" : "ies") << ")\n";
+        }
+        return oss.str();
+    }
+
+    // Profiles file: "profile <name>" followed by its "category <name>" and
+    // "point <file> <line> <function> <level> <message>" lines
+    void save(const std::string& path) const {
+        std::ofstream file(path);
+        if (!file) return;
+        for (const auto& profile : profiles_) {
+            file << "profile " << profile.name << "\n";
+            for (const auto& cat : profile.categories) file << "category " << cat << "\n";
+            for (const auto& point : profile.points) file << "point " << point << "\n";
+        }
+    }
+
+    void load(const std::string& path) {
+        std::ifstream file(path);
+        std::string line;
+        Profile* profile = nullptr;
+        while (std::getline(file, line)) {
+            size_t space = line.find(' ');
+            if (space == std::string::npos) continue;
+            std::string_view tag(line.data(), space);
+            std::string rest = line.substr(space + 1);
+            if (tag == "profile" && valid_name(rest)) {
+                remove(rest);
+                profile = &profiles_.emplace_back(Profile{rest, {}, {}, {}});
+            } else if (profile && tag == "category") {
+                profile->categories.insert(rest);
+            } else if (profile && tag == "point") {
+                profile->points.insert(rest);
+            }
+        }
+    }
+
+    bool empty() const { return profiles_.empty(); }
+    const std::string& active() const { return active_; }
+
+private:
+    std::deque<Profile> profiles_;
+    std::string active_;
+};
+
+// Default output handler (now includes level)
+inline void default_trace_handler(const char* level, const char* file, int line, const char* function, const char* msg) {
+    std::fprintf(stderr, "[%s] %s:%d (%s): %s\n", level, file, line, function, msg);
+}
+
+// Configurable trace output
+inline std::function<void(const char*, const char*, int, const char*, const char*)>& trace_handler() {
+    static std::function<void(const char*, const char*, int, const char*, const char*)> handler = default_trace_handler;
+    return handler;
+}
+
+inline void set_trace_handler(std::function<void(const char*, const char*, int, const char*, const char*)> handler) {
+    trace_handler() = std::move(handler);
+}
+
+namespace detail {
+    using RecordFn = void (*)(const char*, const char*, int, const char*, const char*);
+
+    // Target of kRouteDrain: while the DrainPool runs, records go to its queues instead of
+    // trace_handler(), which is never rewritten under the traced threads
+    inline std::atomic<RecordFn>& drain_push() {
+        static std::atomic<RecordFn> push{nullptr};
+        return push;
+    }
+
+    // Final output of a record: the drain pool if running, else trace_handler()
+    inline void output(const char* level, const char* file, int line, const char* function, const char* msg) {
+        if (settled_route() & kRouteDrain) drain_push().load(std::memory_order_relaxed)(level, file, line, function, msg);
+        else trace_handler()(level, file, line, function, msg);
+    }
+}
+
+// Byte counts for reports: "512 B", "16.0 KiB", "1.5 MiB"
+inline std::string format_bytes(size_t bytes) {
+    char buf[64];
+    if (bytes < 1024) {
+        std::snprintf(buf, sizeof(buf), "%zu B", bytes);
+    } else if (bytes < (size_t(1) << 20)) {
+        std::snprintf(buf, sizeof(buf), "%.1f KiB", static_cast<double>(bytes) / 1024.0);
+    } else if (bytes < (size_t(1) << 30)) {
+        std::snprintf(buf, sizeof(buf), "%.1f MiB", static_cast<double>(bytes) / (1024.0 * 1024.0));
+    } else {
+        std::snprintf(buf, sizeof(buf), "%.2f GiB", static_cast<double>(bytes) / (1024.0 * 1024.0 * 1024.0));
+    }
+    return buf;
+}
+
+// Adaptive time unit formatting
+inline std::string format_duration(double ns) {
+    char buf[64];
+    if (ns < 1000.0) {
+        std::snprintf(buf, sizeof(buf), "%.1f ns", ns);
+    } else if (ns < 1000000.0) {
+        std::snprintf(buf, sizeof(buf), "%.1f us", ns / 1000.0);
+    } else if (ns < 1000000000.0) {
+        std::snprintf(buf, sizeof(buf), "%.1f ms", ns / 1000000.0);
+    } else {
+        std::snprintf(buf, sizeof(buf), "%.3f s", ns / 1000000000.0);
+    }
+    return buf;
+}
+
+// Per-label timer statistics
+struct TimerStats {
+    uint64_t count = 0;
+    double avg = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+    uint32_t one_in = 1;    // ytimeit_every: one execution in one_in is timed
+    uint32_t batch = 1;     // ytimeit_batch: each sample is the mean of batch executions
+};
+
+#ifndef YTRACE_DYN_LABELS
+#define YTRACE_DYN_LABELS 256        // distinct ytimeit_dyn() labels (power of two); later ones share "(other)"
+#endif
+#ifndef YTRACE_DYN_LABEL_SIZE
+#define YTRACE_DYN_LABEL_SIZE 64     // longer ytimeit_dyn() labels are truncated
+#endif
+#ifndef YTRACE_DYN_LABEL_CACHE
+#define YTRACE_DYN_LABEL_CACHE 4     // labels remembered per thread and ytimeit_dyn() site
+#endif
+
+// Lock-free interning table for the runtime labels of ytimeit_dyn(), keyed by call site
+// and label. Interned labels are stable C strings, as ScopeTimer needs; entries are never
+// removed. Once YTRACE_DYN_LABELS labels are interned, new ones are all timed under
+// kOverflow, so a label taken from request data cannot grow the timer table unbounded.
+class LabelTable {
+public:
+    static_assert((YTRACE_DYN_LABELS & (YTRACE_DYN_LABELS - 1)) == 0, "YTRACE_DYN_LABELS must be a power of two");
+
+    static constexpr const char* kOverflow = "(other)";
+
+    static LabelTable& instance() {
+        static LabelTable table;
+        return table;
+    }
+
+    // Interned copy of label for site (any address unique to the call site), or kOverflow
+    const char* intern(const void* site, std::string_view label) noexcept {
+        label = label.substr(0, YTRACE_DYN_LABEL_SIZE - 1);
+        return intern(site, label, hash(site, label));
+    }
+
+    // The same for a label already cut to YTRACE_DYN_LABEL_SIZE - 1 bytes, h = hash(site, label)
+    const char* intern(const void* site, std::string_view label, uint64_t h) noexcept {
+        size_t i = static_cast<size_t>(h) & (kSlots - 1);
+        for (size_t n = 0; n < kSlots; ++n, i = (i + 1) & (kSlots - 1)) {
+            Slot& slot = slots_[i];
+            uint64_t key = slot.hash.load(std::memory_order_acquire);
+            if (key == 0) {
+                // Full: a plain load, no shared write but the count, for every label past the limit
+                if (size_.load(std::memory_order_relaxed) >= YTRACE_DYN_LABELS) {
+                    overflowed_.fetch_add(1, std::memory_order_relaxed);
+                    return kOverflow;
+                }
+                if (size_.fetch_add(1, std::memory_order_relaxed) >= YTRACE_DYN_LABELS) {
+                    size_.fetch_sub(1, std::memory_order_relaxed);
+                    overflowed_.fetch_add(1, std::memory_order_relaxed);
+                    return kOverflow;
+                }
+                if (slot.hash.compare_exchange_strong(key, h, std::memory_order_acq_rel)) {
+                    std::memcpy(slot.label, label.data(), label.size());
+                    slot.label[label.size()] = '\0';
+                    slot.site = site;
+                    slot.ready.store(true, std::memory_order_release);
+                    return slot.label;
+                }
+                size_.fetch_sub(1, std::memory_order_relaxed);  // lost the slot; key is the winner's
+            }
+            if (key != h) continue;
+            while (!slot.ready.load(std::memory_order_acquire)) std::this_thread::yield();  // a memcpy away
+            if (slot.site == site && label == slot.label) return slot.label;
+        }
+        overflowed_.fetch_add(1, std::memory_order_relaxed);
+        return kOverflow;
+    }
+
+    size_t size() const { return std::min<size_t>(size_.load(std::memory_order_relaxed), YTRACE_DYN_LABELS); }
+
+    // Lookups answered with kOverflow (a thread remembers its refused labels, see LabelCache)
+    uint64_t overflowed() const { return overflowed_.load(std::memory_order_relaxed); }
+
+    static uint64_t hash(const void* site, std::string_view label) noexcept {
+        uint64_t h = 14695981039346656037ull ^ (static_cast<uint64_t>(reinterpret_cast<uintptr_t>(site)) *
+                                                0x9E3779B97F4A7C15ull);  // FNV-1a seeded with the site
+        for (char c : label) h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        return h ? h : 1;  // 0 marks a free slot
+    }
+
+private:
+    LabelTable() = default;
+
+    static constexpr size_t kSlots = 2 * YTRACE_DYN_LABELS;  // at most half full: probes stay short
+
+    struct Slot {
+        std::atomic<uint64_t> hash{0};
+        std::atomic<bool> ready{false};
+        const void* site = nullptr;
+        char label[YTRACE_DYN_LABEL_SIZE] = {};
+    };
+    Slot slots_[kSlots];
+    std::atomic<size_t> size_{0};
+    std::atomic<uint64_t> overflowed_{0};
+};
+
+namespace detail {
+    // Per-thread, per-site memory of the last labels a ytimeit_dyn() interned: a repeat
+    // is found by length and memcmp, without hashing or touching the shared table. Labels
+    // the full table refused are remembered by hash, so they do not go back to it either.
+    struct LabelCache {
+        struct Entry {
+            const char* label = nullptr;
+            size_t size = 0;
+        };
+        Entry entries[YTRACE_DYN_LABEL_CACHE];
+        size_t next = 0;
+        uint64_t refused[YTRACE_DYN_LABEL_CACHE] = {};  // LabelTable::hash() values, never 0
+        size_t next_refused = 0;
+
+        const char* intern(const void* site, std::string_view label) noexcept {
+            std::string_view key = label.substr(0, YTRACE_DYN_LABEL_SIZE - 1);
+            for (const Entry& entry : entries) {
+                if (entry.size == key.size() && entry.label && std::memcmp(entry.label, key.data(), key.size()) == 0) {
+                    return entry.label;
+                }
+            }
+            uint64_t h = LabelTable::hash(site, key);
+            for (uint64_t r : refused) {
+                if (r == h) return LabelTable::kOverflow;
+            }
+            const char* interned = LabelTable::instance().intern(site, key, h);
+            if (interned != LabelTable::kOverflow) {
+                entries[next] = Entry{interned, key.size()};
+                next = (next + 1) % YTRACE_DYN_LABEL_CACHE;
+            } else {
+                refused[next_refused] = h;
+                next_refused = (next_refused + 1) % YTRACE_DYN_LABEL_CACHE;
+            }
+            return interned;
+        }
+    };
+}
+
+#ifndef YTRACE_TIMER_UNRELIABLE_FACTOR
+#define YTRACE_TIMER_UNRELIABLE_FACTOR 4   // means below this many times the overhead are flagged
+#endif
+
+// Singleton manager that collects timer statistics and prints summary on exit
+class TimerManager {
+public:
+    static TimerManager& instance() {
+        static TimerManager mgr;
+        return mgr;
+    }
+
+    // one_in/batch describe sampled timers (see ytimeit_every / ytimeit_batch); the
+    // summary marks their statistics so they are not read as exact per-call figures
+    void record(std::string_view label, double duration_ns, uint32_t one_in = 1, uint32_t batch = 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+#if YTRACE_FIXED_CAPACITY
+        TimerStats* found = find_locked(label);
+        if (!found) {
+            ++dropped_;
+            return;
+        }
+        auto& s = *found;
+#else
+        auto it = stats_.find(label);
+        if (it == stats_.end()) it = stats_.emplace(label, TimerStats{}).first;
+        auto& s = it->second;
+#endif
+        s.count++;
+        s.one_in = one_in;
+        s.batch = batch;
+        if (s.count == 1) {
+            s.avg = duration_ns;
+            s.min = duration_ns;
+            s.max = duration_ns;
+        } else {
+            s.avg += (duration_ns - s.avg) / static_cast<double>(s.count);
+            if (duration_ns < s.min) s.min = duration_ns;
+            if (duration_ns > s.max) s.max = duration_ns;
+        }
+    }
+
+    // Record a duration measured with two steady_clock reads (ScopeTimer, BatchTimer, the
+    // patchable trampoline). With subtraction on, the calibrated overhead (per execution
+    // for batches) is taken off, clamping at zero.
+    void record_measured(std::string_view label, double duration_ns, uint32_t one_in = 1, uint32_t batch = 1) {
+        if (subtract_.load(std::memory_order_relaxed)) {
+            duration_ns = std::max(0.0, duration_ns - overhead_ns_ / batch);
+        }
+        record(label, duration_ns, one_in, batch);
+    }
+
+    // Cost a measurement adds to every sample, calibrated at startup as the median of
+    // back-to-back reads of the clock (clock_name())
+    double overhead_ns() const { return overhead_ns_; }
+    static const char* clock_name() { return "steady_clock"; }
+
+    // Subtract overhead_ns() from measured samples (also: YTRACE_TIMER_SUBTRACT=1)
+    void set_subtract_overhead(bool on) { subtract_.store(on, std::memory_order_relaxed); }
+    bool subtract_overhead() const { return subtract_.load(std::memory_order_relaxed); }
+
+    std::string summary() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream oss;
+        bool any = false;
+        for_each_locked([&](const auto& label, const TimerStats& s) {
+            any = true;
+            char line[320];
+            int n = std::snprintf(line, sizeof(line), "  %-40s  count=%" PRIu64 "  avg=%s  min=%s  max=%s",
+                label.c_str(), s.count,
+                format_duration(s.avg).c_str(),
+                format_duration(s.min).c_str(),
+                format_duration(s.max).c_str());
+            if (n > 0 && static_cast<size_t>(n) < sizeof(line)) {
+                if (s.one_in > 1) {
+                    std::snprintf(line + n, sizeof(line) - n, "  [sampled 1/%u, ~%" PRIu64 " calls]",
+                                  s.one_in, s.count * s.one_in);
+                } else if (s.batch > 1) {
+                    std::snprintf(line + n, sizeof(line) - n, "  [batch avg of %u, %" PRIu64 " calls]",
+                                  s.batch, s.count * s.batch);
+                }
+            }
+            oss << line;
+            if (s.avg < YTRACE_TIMER_UNRELIABLE_FACTOR * overhead_ns_ / s.batch) {
+                oss << "  [unreliable: within " << YTRACE_TIMER_UNRELIABLE_FACTOR << "x timer overhead]";
+            }
+            oss << "\n";
+        });
+        if (dropped_) oss << "  (" << dropped_ << " record(s) dropped: timer table full)\n";
+        if (uint64_t overflowed = LabelTable::instance().overflowed()) {
+            oss << "  (" << overflowed << " ytimeit_dyn() label lookup(s) answered " << LabelTable::kOverflow
+                << ": more than " << YTRACE_DYN_LABELS << " labels)\n";
+        }
+        if (any) {
+            oss << "  (timer overhead " << format_duration(overhead_ns_) << " per sample on " << clock_name()
+                << (subtract_overhead() ? ", subtracted" : ", not subtracted") << ")\n";
+        }
+        return oss.str();
+    }
+
+    std::optional<TimerStats> stats(std::string_view label) {
+        std::lock_guard<std::mutex> lock(mutex_);
+#if YTRACE_FIXED_CAPACITY
+        if (const Slot* slot = probe_locked(label); slot && slot->used) return slot->stats;
+        for (const auto& slot : slots_) {
+            if (slot.used && slot.label == label) return slot.stats;  // a name from counts()
+        }
+        return std::nullopt;
+#else
+        auto it = stats_.find(label);
+        if (it == stats_.end()) return std::nullopt;
+        return it->second;
+#endif
+    }
+
+    // Snapshot of the per-label call counts (monotonic)
+    std::vector<std::pair<std::string, uint64_t>> counts() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::pair<std::string, uint64_t>> out;
+        for_each_locked([&](const auto& label, const TimerStats& s) {
+            out.emplace_back(std::string(std::string_view(label)), s.count);
+        });
+        return out;
+    }
+
+    ~TimerManager() {
+        auto s = summary();
+        if (!s.empty()) {
+            std::fprintf(stderr, "\n[ytrace] Timer summary:\n%s", s.c_str());
+        }
+    }
+
+private:
+    TimerManager() : overhead_ns_(calibrate()) {
+        if (const char* env = std::getenv("YTRACE_TIMER_SUBTRACT")) set_subtract_overhead(std::string_view(env) == "1");
+    }
+
+    static double calibrate() {
+        constexpr int kRounds = 1001;
+        std::array<int64_t, kRounds> samples;
+        for (auto& sample : samples) {
+            auto start = std::chrono::steady_clock::now();
+            auto end = std::chrono::steady_clock::now();
+            sample = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        }
+        std::nth_element(samples.begin(), samples.begin() + kRounds / 2, samples.end());
+        return static_cast<double>(samples[kRounds / 2]);
+    }
+
+#if YTRACE_FIXED_CAPACITY
+    static_assert((YTRACE_MAX_TIMERS & (YTRACE_MAX_TIMERS - 1)) == 0, "YTRACE_MAX_TIMERS must be a power of two");
+
+    struct Slot {
+        bool used = false;
+        uint64_t hash = 0;      // of the full label
+        detail::Name label;     // for display, see display_name()
+        TimerStats stats;
+    };
+
+    static uint64_t hash(std::string_view label) noexcept {
+        uint64_t h = 14695981039346656037ull;  // FNV-1a
+        for (char c : label) h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        return h;
+    }
+
+    // Labels are "file:line label" keys, so a long one keeps its end: "...er.cpp:42 parse"
+    static detail::Name display_name(std::string_view label) {
+        if (label.size() < YTRACE_NAME_SIZE) return detail::Name(label);
+        char buf[YTRACE_NAME_SIZE] = "...";
+        std::string_view tail = label.substr(label.size() - (YTRACE_NAME_SIZE - 4));
+        std::memcpy(buf + 3, tail.data(), tail.size());
+        return detail::Name(std::string_view(buf, YTRACE_NAME_SIZE - 1));
+    }
+
+    // Open-addressing (linear probing) slot of a label: its own, or the free slot it would
+    // take. Labels are matched by a hash of the whole label, so keys that differ only past
+    // YTRACE_NAME_SIZE stay apart. nullptr if the table is full.
+    Slot* probe_locked(std::string_view label) {
+        uint64_t h = hash(label);
+        size_t i = static_cast<size_t>(h) & (YTRACE_MAX_TIMERS - 1);
+        for (size_t n = 0; n < YTRACE_MAX_TIMERS; ++n, i = (i + 1) & (YTRACE_MAX_TIMERS - 1)) {
+            Slot& slot = slots_[i];
+            if (!slot.used || slot.hash == h) return &slot;
+        }
+        return nullptr;
+    }
+
+    // Lookup by label, inserting it if absent. nullptr if the table is full.
+    TimerStats* find_locked(std::string_view label) {
+        Slot* slot = probe_locked(label);
+        if (!slot) return nullptr;
+        if (!slot->used) {
+            slot->used = true;
+            slot->hash = hash(label);
+            slot->label = display_name(label);
+        }
+        return &slot->stats;
+    }
+
+    template<typename Func>
+    void for_each_locked(Func&& func) const {
+        for (const auto& slot : slots_) {
+            if (slot.used) func(slot.label, slot.stats);
+        }
+    }
+
+    Slot slots_[YTRACE_MAX_TIMERS];
+#else
+    template<typename Func>
+    void for_each_locked(Func&& func) const {
+        for (const auto& [label, s] : stats_) func(label, s);
+    }
+
+    std::pmr::unordered_map<std::pmr::string, TimerStats, detail::StringHash, std::equal_to<>> stats_{
+        &memory_resource()};
+#endif
+    std::mutex mutex_;
+    uint64_t dropped_ = 0;   // records whose label did not fit in the table
+    double overhead_ns_;
+    std::atomic<bool> subtract_{false};
+};
+
+#ifndef YTRACE_EXCEPTION_TABLE_SIZE
+#define YTRACE_EXCEPTION_TABLE_SIZE 1024  // throw sites kept (power of two)
+#endif
+
+// Lock-free table of throw sites, keyed by the pc of the throw expression. Filled by the
+// __cxa_throw hook of ytrace::exceptions (see exceptions.hpp) and listed by the
+// "exceptions" command. Entries are never removed.
+class ExceptionTable {
+public:
+    static_assert((YTRACE_EXCEPTION_TABLE_SIZE & (YTRACE_EXCEPTION_TABLE_SIZE - 1)) == 0,
+                  "YTRACE_EXCEPTION_TABLE_SIZE must be a power of two");
+
+    struct Site {
+        std::atomic<uintptr_t> pc{0};      // 0 = free
+        std::atomic<bool> ready{false};    // names written, trace point registered
+        bool enabled = false;              // "throw" trace point: emit a record, time throw-to-catch
+        const char* module = nullptr;
+        const char* function = nullptr;
+        const char* type = nullptr;        // demangled exception type
+        uintptr_t base = 0;                // load address of module
+        std::atomic<uint64_t> throws{0};
+        std::atomic<uint64_t> caught{0};   // timed throws that reached a handler
+        std::atomic<uint64_t> catch_ns{0}; // total throw-to-catch time of those
+        std::atomic<uint64_t> max_catch_ns{0};
+    };
+
+    static ExceptionTable& instance() {
+        static ExceptionTable table;
+        return table;
+    }
+
+    static constexpr size_t capacity() { return YTRACE_EXCEPTION_TABLE_SIZE; }
+
+    // Site of pc once registered, nullptr if unseen (or still being registered)
+    Site* find(uintptr_t pc) noexcept {
+        size_t i = hash(pc);
+        for (size_t n = 0; n < capacity(); ++n, i = (i + 1) & (capacity() - 1)) {
+            uintptr_t key = sites_[i].pc.load(std::memory_order_acquire);
+            if (key == pc) return sites_[i].ready.load(std::memory_order_acquire) ? &sites_[i] : nullptr;
+            if (key == 0) return nullptr;
+        }
+        return nullptr;
+    }
+
+    // Claim a site for pc: {site, true} if this call inserted it (the caller names it and
+    // marks it ready), {site, false} if it existed, {nullptr, false} if the table is full
+    std::pair<Site*, bool> insert(uintptr_t pc) noexcept {
+        size_t i = hash(pc);
+        for (size_t n = 0; n < capacity(); ++n, i = (i + 1) & (capacity() - 1)) {
+            uintptr_t expected = 0;
+            if (sites_[i].pc.compare_exchange_strong(expected, pc, std::memory_order_acq_rel)) {
+                size_.fetch_add(1, std::memory_order_relaxed);
+                return {&sites_[i], true};
+            }
+            if (expected == pc) return {&sites_[i], false};
+        }
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return {nullptr, false};
+    }
+
+    void record_catch(Site& site, uint64_t ns) noexcept {
+        site.caught.fetch_add(1, std::memory_order_relaxed);
+        site.catch_ns.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = site.max_catch_ns.load(std::memory_order_relaxed);
+        while (ns > max && !site.max_catch_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+    }
+
+    // One line per site, most frequent first:
+    //   "<throws> <type> <function> <module>+0x<pc offset> [caught=N avg=X max=Y]"
+    std::string report() const {
+        std::vector<const Site*> sites;
+        for (const Site& site : sites_) {
+            if (site.ready.load(std::memory_order_acquire)) sites.push_back(&site);
+        }
+        std::sort(sites.begin(), sites.end(), [](const Site* a, const Site* b) {
+            return a->throws.load(std::memory_order_relaxed) > b->throws.load(std::memory_order_relaxed);
+        });
+        std::ostringstream oss;
+        oss << "# " << sites.size() << " throw site(s), " << dropped() << " dropped\n";
+        for (const Site* site : sites) {
+            oss << site->throws.load(std::memory_order_relaxed) << " " << site->type << " " << site->function << " "
+                << site->module << "+0x" << std::hex << (site->pc.load(std::memory_order_relaxed) - site->base)
+                << std::dec;
+            if (uint64_t caught = site->caught.load(std::memory_order_relaxed)) {
+                oss << " [caught=" << caught
+                    << " avg=" << format_duration(double(site->catch_ns.load(std::memory_order_relaxed)) / caught)
+                    << " max=" << format_duration(double(site->max_catch_ns.load(std::memory_order_relaxed))) << "]";
+            }
+            oss << "\n";
+        }
+        return oss.str();
+    }
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    ExceptionTable() = default;
+
+    static size_t hash(uintptr_t pc) noexcept {
+        return static_cast<size_t>((static_cast<uint64_t>(pc) * 0x9E3779B97F4A7C15ull) >> 32) & (capacity() - 1);
+    }
+
+    Site sites_[YTRACE_EXCEPTION_TABLE_SIZE];
+    std::atomic<size_t> size_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+#ifndef YTRACE_HISTORY_SECONDS
+#define YTRACE_HISTORY_SECONDS 600  // default length of per-second rate history (10 minutes)
+#endif
+
+// Per-second counts for the last N seconds, derived from a monotonic counter by the
+// reading side (the control thread): traced code never touches the ring.
+class HistoryRing {
+public:
+    HistoryRing(size_t seconds, uint64_t total, int64_t now_sec)
+        : counts_(seconds ? seconds : 1, 0, &memory_resource()), last_total_(total), last_sec_(now_sec) {}
+
+    // Record the counter value seen at now_sec; the increase since the previous observation
+    // is spread evenly over the seconds in between (the sampler may have been late)
+    void observe(uint64_t total, int64_t now_sec) {
+        int64_t elapsed = now_sec - last_sec_;
+        if (elapsed <= 0) return;
+        uint64_t delta = total >= last_total_ ? total - last_total_ : 0;
+        uint64_t steps = static_cast<uint64_t>(elapsed);
+        for (uint64_t i = steps > counts_.size() ? steps - counts_.size() : 0; i < steps; ++i) {
+            uint64_t n = delta / steps + (i < delta % steps ? 1 : 0);
+            counts_[head_] = static_cast<uint32_t>(std::min<uint64_t>(n, UINT32_MAX));
+            head_ = (head_ + 1) % counts_.size();
+            if (filled_ < counts_.size()) ++filled_;
+        }
+        last_total_ = total;
+        last_sec_ = now_sec;
+    }
+
+    // Recorded seconds, oldest first; the last entry is the second ending at the last observation
+    std::vector<uint32_t> values() const {
+        std::vector<uint32_t> out;
+        out.reserve(filled_);
+        size_t start = (head_ + counts_.size() - filled_) % counts_.size();
+        for (size_t i = 0; i < filled_; ++i) out.push_back(counts_[(start + i) % counts_.size()]);
+        return out;
+    }
+
+    size_t capacity() const { return counts_.size(); }
+
+private:
+    std::pmr::vector<uint32_t> counts_;
+    size_t head_ = 0;    // next slot to write
+    size_t filled_ = 0;
+    uint64_t last_total_;
+    int64_t last_sec_;
+};
+
+// History rings of every point with a hit counter (ylog family: PointControl::hits,
+// adaptive points: AdaptiveSampler::calls) and every timer (call count). Rings are only
+// allocated for counters that moved. Not thread-safe: TraceManager serializes access.
+class RateHistory {
+public:
+    // Turning history off (or changing its length) drops all series. Series start at the
+    // counters' values at the first sample, so earlier activity is not replayed.
+    void configure(bool on, size_t seconds) {
+        if (!on || seconds != seconds_) {
+            points_.clear();
+            timers_.clear();
+            last_sec_ = -1;
+        }
+        seconds_ = seconds ? seconds : 1;
+        enabled_.store(on, std::memory_order_relaxed);
+        detail::count_hits().store(on, std::memory_order_relaxed);
+    }
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+    size_t seconds() const { return seconds_; }
+
+    void sample(const detail::PointList& points,
+                const std::vector<std::pair<std::string, uint64_t>>& timers, int64_t now_sec) {
+        if (!enabled() || now_sec <= last_sec_) return;
+        auto observe = [&](auto& rings, const auto& key, uint64_t total) {
+            auto it = rings.find(key);
+            if (it == rings.end()) {
+                if (total == 0) return;
+                // Counters seen at the first sample are the baseline; later ones started from 0
+                using Key = typename std::decay_t<decltype(rings)>::key_type;
+                it = last_sec_ < 0 ? rings.try_emplace(Key(key), seconds_, total, now_sec).first
+                                   : rings.try_emplace(Key(key), seconds_, 0, last_sec_).first;
+            }
+            it->second.observe(total, now_sec);
+        };
+        for (size_t i = 0; i < points.size(); ++i) {
+            const auto& info = points[i];
+            if (info.control) observe(points_, i, info.control->hits.load(std::memory_order_relaxed));
+            else if (info.sampler) observe(points_, i, info.sampler->calls());
+        }
+        for (const auto& [label, count] : timers) observe(timers_, std::string_view(label), count);
+        last_sec_ = now_sec;
+    }
+
+    // "# history on|off seconds=N", then "point <index> <csv>" and "timer <csv> <label>"
+    // lines with per-second counts, oldest first
+    std::string dump() const {
+        std::ostringstream oss;
+        oss << "# history " << (enabled() ? "on" : "off") << " seconds=" << seconds_ << "\n";
+        auto csv = [&](const HistoryRing& ring) {
+            bool first = true;
+            for (uint32_t n : ring.values()) {
+                oss << (first ? "" : ",") << n;
+                first = false;
+            }
+        };
+        for (const auto& [index, ring] : points_) {
+            oss << "point " << index << " ";
+            csv(ring);
+            oss << "\n";
+        }
+        for (const auto& [label, ring] : timers_) {
+            oss << "timer ";
+            csv(ring);
+            oss << " " << label << "\n";
+        }
+        return oss.str();
+    }
+
+    std::string status() const {
+        std::ostringstream oss;
+        oss << "History: " << (enabled() ? "on" : "off") << "  seconds=" << seconds_
+            << "  series=" << points_.size() + timers_.size() << "\n";
+        return oss.str();
+    }
+
+private:
+    std::atomic<bool> enabled_{false};
+    size_t seconds_ = YTRACE_HISTORY_SECONDS;
+    int64_t last_sec_ = -1;                           // time of the last sample, -1 = none yet
+    std::pmr::map<size_t, HistoryRing> points_{&memory_resource()};                         // by trace point index
+    std::pmr::map<std::pmr::string, HistoryRing, std::less<>> timers_{&memory_resource()};  // by timer label
+};
+
+// Tail-based sampling policy: a finished request's buffered records are emitted if any rule matches
+struct TailPolicy {
+    double latency_threshold_ns = 0.0;  // keep requests slower than this (0 = off)
+    bool keep_on_error = true;          // keep requests that hit a warn/error record
+    uint32_t one_in = 0;                // keep every Nth request regardless (0 = off)
+};
+
+// Global switch and counters for tail-based sampling (see yrequest()). decide() runs at
+// the end of every request: it reads the policy through a seqlock and counts in the
+// calling thread's counters, so finished requests share no lock and no written line.
+class TailSampler {
+public:
+    static TailSampler& instance() {
+        static TailSampler sampler;
+        return sampler;
+    }
+
+    void configure(bool enabled, const TailPolicy& policy) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        latency_threshold_ns_.store(policy.latency_threshold_ns, std::memory_order_relaxed);
+        keep_on_error_.store(policy.keep_on_error, std::memory_order_relaxed);
+        one_in_.store(policy.one_in, std::memory_order_relaxed);
+        seq_.store(seq + 2, std::memory_order_release);
+        enabled_.store(enabled, std::memory_order_release);
+    }
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    TailPolicy policy() const {
+        TailPolicy p;
+        for (;;) {
+            uint64_t seq = seq_.load(std::memory_order_acquire);
+            p.latency_threshold_ns = latency_threshold_ns_.load(std::memory_order_relaxed);
+            p.keep_on_error = keep_on_error_.load(std::memory_order_relaxed);
+            p.one_in = one_in_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (!(seq & 1) && seq == seq_.load(std::memory_order_relaxed)) return p;
+        }
+    }
+
+    // Decide the fate of a finished request; returns the reason to keep it, or nullptr.
+    // "sampled" keeps every one_in-th request of each thread.
+    const char* decide(double latency_ns, bool had_error) {
+        TailPolicy p = policy();
+        Counters& counters = local();
+        uint64_t n = bump(counters.completed);
+        const char* reason = nullptr;
+        if (had_error && p.keep_on_error) reason = "error";
+        else if (p.latency_threshold_ns > 0.0 && latency_ns > p.latency_threshold_ns) reason = "slow";
+        else if (p.one_in > 0 && n % p.one_in == 0) reason = "sampled";
+        bump(reason ? counters.kept : counters.discarded);
+        return reason;
+    }
+
+    uint64_t kept() { return total(&Counters::kept); }
+    uint64_t discarded() { return total(&Counters::discarded); }
+
+    std::string status() {
+        TailPolicy p = policy();
+        std::ostringstream oss;
+        oss << "Tail sampling: " << (enabled() ? "on" : "off")
+            << "  latency_ms=" << p.latency_threshold_ns / 1e6
+            << "  one_in=" << p.one_in
+            << "  errors=" << (p.keep_on_error ? 1 : 0)
+            << "  kept=" << kept()
+            << "  discarded=" << discarded() << "\n";
+        return oss.str();
+    }
+
+private:
+    // Written by one thread only (plain load and store), summed by total()
+    struct Counters {
+        std::atomic<uint64_t> completed{0};
+        std::atomic<uint64_t> kept{0};
+        std::atomic<uint64_t> discarded{0};
+    };
+
+    // A thread's counters, listed while the thread runs and folded into retired_ at its exit
+    struct LocalCounters {
+        Counters counters;
+        LocalCounters() {
+            auto& sampler = instance();
+            std::lock_guard<std::mutex> lock(sampler.mutex_);
+            sampler.threads_.push_back(&counters);
+        }
+        ~LocalCounters() {
+            auto& sampler = instance();
+            std::lock_guard<std::mutex> lock(sampler.mutex_);
+            sampler.retired_.kept.fetch_add(counters.kept.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            sampler.retired_.discarded.fetch_add(counters.discarded.load(std::memory_order_relaxed),
+                                                 std::memory_order_relaxed);
+            auto& threads = sampler.threads_;
+            threads.erase(std::remove(threads.begin(), threads.end(), &counters), threads.end());
+        }
+    };
+
+    TailSampler() = default;
+
+    static Counters& local() {
+        static thread_local LocalCounters local;
+        return local.counters;
+    }
+
+    static uint64_t bump(std::atomic<uint64_t>& counter) {
+        uint64_t n = counter.load(std::memory_order_relaxed) + 1;
+        counter.store(n, std::memory_order_relaxed);
+        return n;
+    }
+
+    uint64_t total(std::atomic<uint64_t> Counters::*field) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t sum = (retired_.*field).load(std::memory_order_relaxed);
+        for (const Counters* counters : threads_) sum += (counters->*field).load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    std::mutex mutex_;                    // configure(), threads_
+    std::atomic<uint64_t> seq_{0};        // odd while configure() writes the policy
+    std::atomic<double> latency_threshold_ns_{0.0};
+    std::atomic<bool> keep_on_error_{true};
+    std::atomic<uint32_t> one_in_{0};
+    std::atomic<bool> enabled_{false};
+    std::pmr::vector<Counters*> threads_{&memory_resource()};
+    Counters retired_;
+};
+
+#ifndef YTRACE_MEMORY_BUDGET
+#define YTRACE_MEMORY_BUDGET (size_t(64) << 20)  // default budget of per-thread buffers (64 MiB)
+#endif
+#ifndef YTRACE_BUFFER_CHUNK
+#define YTRACE_BUFFER_CHUNK (16 * 1024)          // buffers grow and shrink in whole chunks
+#endif
+#ifndef YTRACE_BUFFER_IDLE_SECONDS
+#define YTRACE_BUFFER_IDLE_SECONDS 10            // unused this long, a buffer is freed
+#endif
+
+namespace detail {
+    class ElasticBuffer;
+
+    inline int64_t steady_seconds() {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+// Global budget for elastic per-thread buffers (tail-sampling arenas) and drain queues.
+// Buffers reserve chunks from it as they grow and return them when they shrink, go idle or
+// their thread exits; growth the budget cannot cover is refused and the record is dropped.
+// The limit comes from YTRACE_MEMORY_BUDGET (env, e.g. "64M"), or the "self" socket command.
+class MemoryBudget {
+public:
+    static constexpr size_t kHugePage = size_t(2) << 20;
+
+    static MemoryBudget& instance() {
+        static MemoryBudget budget;
+        return budget;
+    }
+
+    bool reserve(size_t bytes) {
+        size_t used = used_.load(std::memory_order_relaxed);
+        do {
+            if (used + bytes > limit_.load(std::memory_order_relaxed)) {
+                refused_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!used_.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+        return true;
+    }
+
+    void release(size_t bytes) { used_.fetch_sub(bytes, std::memory_order_relaxed); }
+
+    // A lower limit applies to new growth; buffers above it shrink as they go idle
+    void set_limit(size_t bytes) { limit_.store(bytes, std::memory_order_relaxed); }
+    size_t limit() const { return limit_.load(std::memory_order_relaxed); }
+    size_t used() const { return used_.load(std::memory_order_relaxed); }
+    size_t available() const {
+        size_t limit = this->limit(), used = this->used();
+        return used < limit ? limit - used : 0;
+    }
+    uint64_t refused() const { return refused_.load(std::memory_order_relaxed); }
+
+    // Back buffers of at least kHugePage with transparent huge pages (madvise, Linux)
+    void set_huge_pages(bool on) { huge_pages_.store(on, std::memory_order_relaxed); }
+    bool huge_pages() const { return huge_pages_.load(std::memory_order_relaxed); }
+
+    size_t alignment_for(size_t bytes) const {
+        return huge_pages() && bytes >= kHugePage ? kHugePage : alignof(std::max_align_t);
+    }
+
+    void advise(void* p, size_t bytes, size_t align) const {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (align == kHugePage) madvise(p, bytes & ~(kHugePage - 1), MADV_HUGEPAGE);
+#else
+        (void)p; (void)bytes; (void)align;
+#endif
+    }
+
+    // "64M", "512k", "1G" or plain bytes; false if malformed
+    static bool parse_size(std::string_view text, size_t& bytes) {
+        size_t n = 0, i = 0;
+        for (; i < text.size() && std::isdigit(static_cast<unsigned char>(text[i])); ++i) n = n * 10 + (text[i] - '0');
+        if (i == 0) return false;
+        std::string_view unit = text.substr(i);
+        if (unit.empty() || unit == "B" || unit == "b") bytes = n;
+        else if (unit == "K" || unit == "k" || unit == "KiB") bytes = n << 10;
+        else if (unit == "M" || unit == "m" || unit == "MiB") bytes = n << 20;
+        else if (unit == "G" || unit == "g" || unit == "GiB") bytes = n << 30;
+        else return false;
+        return true;
+    }
+
+    // Live buffers, for idle trimming and reporting
+    void attach(detail::ElasticBuffer* buffer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers_.push_back(buffer);
+    }
+
+    void detach(detail::ElasticBuffer* buffer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers_.erase(std::remove(buffers_.begin(), buffers_.end(), buffer), buffers_.end());
+    }
+
+    // Free buffers unused for YTRACE_BUFFER_IDLE_SECONDS (control thread); returns bytes freed
+    size_t trim_idle(int64_t now_sec);
+
+    std::string status();
+
+private:
+    MemoryBudget() {
+        size_t bytes = 0;
+        if (const char* env = std::getenv("YTRACE_MEMORY_BUDGET"); env && parse_size(env, bytes)) set_limit(bytes);
+        if (const char* env = std::getenv("YTRACE_HUGE_PAGES")) set_huge_pages(std::string_view(env) == "1");
+    }
+
+    std::atomic<size_t> limit_{YTRACE_MEMORY_BUDGET};
+    std::atomic<size_t> used_{0};
+    std::atomic<uint64_t> refused_{0};
+    std::atomic<bool> huge_pages_{false};
+    std::mutex mutex_;
+    std::pmr::vector<detail::ElasticBuffer*> buffers_{&memory_resource()};
+};
+
+namespace detail {
+    // Contiguous buffer whose capacity moves in whole YTRACE_BUFFER_CHUNKs reserved from the
+    // MemoryBudget: it grows while its thread is busy and shrinks back toward recent usage.
+    // The owner brackets each use with begin_use()/end_use(); between uses the control
+    // thread may free the memory of a buffer that stayed idle.
+    class ElasticBuffer {
+    public:
+        ElasticBuffer() { MemoryBudget::instance().attach(this); }
+
+        ~ElasticBuffer() {
+            MemoryBudget::instance().detach(this);
+            resize(0, 0);
+        }
+
+        ElasticBuffer(const ElasticBuffer&) = delete;
+        ElasticBuffer& operator=(const ElasticBuffer&) = delete;
+
+        char* data() { return data_; }
+        const char* data() const { return data_; }
+        size_t capacity() const { return capacity_.load(std::memory_order_relaxed); }
+
+        void begin_use() {
+            int expected = kIdle;
+            while (!state_.compare_exchange_weak(expected, kBusy, std::memory_order_acquire)) {
+                expected = kIdle;
+                std::this_thread::yield();  // the control thread is trimming this buffer
+            }
+        }
+
+        // used = bytes the finished use needed; capacity is cut to about a decaying peak
+        void end_use(size_t used) {
+            recent_peak_ = std::max(used, recent_peak_ - recent_peak_ / 4);
+            size_t target = round_up(recent_peak_);
+            if (capacity() > 2 * target) resize(target, 0);
+            last_use_sec_.store(steady_seconds(), std::memory_order_relaxed);
+            state_.store(kIdle, std::memory_order_release);
+        }
+
+        // Room for need bytes, keeping the first keep; false if the budget refuses
+        bool ensure(size_t need, size_t keep) {
+            size_t cap = capacity();
+            if (need <= cap) return true;
+            size_t grown = round_up(std::max(need, cap * 2));
+            if (grown - cap > MemoryBudget::instance().available()) grown = round_up(need);  // near the limit
+            return resize(grown, keep);
+        }
+
+        // Control thread: free the memory if unused since idle_sec ago; returns bytes freed
+        size_t trim_if_idle(int64_t now_sec, int64_t idle_sec) {
+            if (capacity() == 0 || now_sec - last_use_sec_.load(std::memory_order_relaxed) < idle_sec) return 0;
+            int expected = kIdle;
+            if (!state_.compare_exchange_strong(expected, kTrimming, std::memory_order_acquire)) return 0;
+            size_t freed = capacity();
+            resize(0, 0);
+            recent_peak_ = 0;
+            state_.store(kIdle, std::memory_order_release);
+            return freed;
+        }
+
+    private:
+        static constexpr int kIdle = 0, kBusy = 1, kTrimming = 2;
+
+        static size_t round_up(size_t n) {
+            return (n + YTRACE_BUFFER_CHUNK - 1) / YTRACE_BUFFER_CHUNK * YTRACE_BUFFER_CHUNK;
+        }
+
+        bool resize(size_t cap, size_t keep) {
+            auto& budget = MemoryBudget::instance();
+            size_t old = capacity();
+            if (cap > old && !budget.reserve(cap - old)) return false;
+            char* p = nullptr;
+            size_t align = budget.alignment_for(cap);
+            if (cap) {
+                p = static_cast<char*>(memory_resource().allocate(cap, align));
+                budget.advise(p, cap, align);
+                if (keep) std::memcpy(p, data_, keep);
+            }
+            if (data_) memory_resource().deallocate(data_, old, align_);
+            if (cap < old) budget.release(old - cap);
+            data_ = p;
+            align_ = align;
+            capacity_.store(cap, std::memory_order_relaxed);
+            return true;
+        }
+
+        char* data_ = nullptr;
+        size_t align_ = alignof(std::max_align_t);
+        std::atomic<size_t> capacity_{0};           // read by the control thread for reports
+        size_t recent_peak_ = 0;
+        std::atomic<int64_t> last_use_sec_{0};
+        std::atomic<int> state_{kIdle};
+    };
+
+    // Tail arena of fixed-capacity builds: static per-thread storage, nothing to budget
+    template<size_t N>
+    class StaticBuffer {
+    public:
+        char* data() { return buf_.data(); }
+        const char* data() const { return buf_.data(); }
+        size_t capacity() const { return N; }
+        void begin_use() {}
+        void end_use(size_t) {}
+        bool ensure(size_t need, size_t) const { return need <= N; }
+
+    private:
+        alignas(std::max_align_t) std::array<char, N> buf_;
+    };
+}
+
+inline size_t MemoryBudget::trim_idle(int64_t now_sec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t freed = 0;
+    for (auto* buffer : buffers_) freed += buffer->trim_if_idle(now_sec, YTRACE_BUFFER_IDLE_SECONDS);
+    return freed;
+}
+
+inline std::string MemoryBudget::status() {
+    size_t count = 0, total = 0, largest = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto* buffer : buffers_) {
+            size_t cap = buffer->capacity();
+            ++count;
+            total += cap;
+            largest = std::max(largest, cap);
+        }
+    }
+    auto& mr = memory_resource();
+    std::ostringstream oss;
+    oss << "memory:   in use " << format_bytes(mr.bytes_in_use()) << ", peak " << format_bytes(mr.peak_bytes())
+        << ", " << mr.allocations() << " allocation(s)\n"
+        << "budget:   limit " << format_bytes(limit()) << ", used " << format_bytes(used())
+        << ", refused " << refused() << ", huge pages " << (huge_pages() ? "on" : "off") << "\n"
+        << "buffers:  " << count << " thread(s), " << format_bytes(total) << " total, largest "
+        << format_bytes(largest) << "\n";
+    return oss.str();
+}
+
+#ifndef YTRACE_TAIL_BUFFER_BYTES
+#if YTRACE_FIXED_CAPACITY
+#define YTRACE_TAIL_BUFFER_BYTES (64 * 1024)    // per-thread request arena (static TLS)
+#else
+#define YTRACE_TAIL_BUFFER_BYTES (1024 * 1024)  // per-thread request arena cap
+#endif
+#endif
+
+namespace detail {
+    // Per-thread arena holding the records of the request in flight. Records are appended
+    // back to back; discarding a request just rewinds the offset, keeping the memory until
+    // the arena shrinks toward recent usage or is trimmed as idle.
+    struct RequestBuffer {
+        struct Record {
+            const char* level;
+            const char* file;
+            int line;
+            const char* function;
+            uint32_t msg_len;   // message bytes follow the header
+        };
+
+        int depth = 0;          // nested yrequest() scopes; only the root buffers
+        bool had_error = false;
+        uint64_t dropped = 0;   // records that did not fit
+        size_t used = 0;
+#if YTRACE_FIXED_CAPACITY
+        StaticBuffer<YTRACE_TAIL_BUFFER_BYTES> arena;
+#else
+        ElasticBuffer arena;    // grows in chunks from the MemoryBudget, up to YTRACE_TAIL_BUFFER_BYTES
+#endif
+
+        void append(const char* level, const char* file, int line, const char* function, const char* msg) {
+            size_t len = std::strlen(msg);
+            size_t need = (sizeof(Record) + len + 1 + alignof(Record) - 1) & ~(alignof(Record) - 1);
+            if (used + need > YTRACE_TAIL_BUFFER_BYTES || !arena.ensure(used + need, used)) { ++dropped; return; }
+            Record rec{level, file, line, function, static_cast<uint32_t>(len)};
+            std::memcpy(arena.data() + used, &rec, sizeof(rec));
+            std::memcpy(arena.data() + used + sizeof(rec), msg, len + 1);
+            used += need;
+        }
+
+        template<typename Func>
+        void for_each(Func&& func) const {
+            for (size_t off = 0; off < used;) {
+                Record rec;
+                std::memcpy(&rec, arena.data() + off, sizeof(rec));
+                func(rec, arena.data() + off + sizeof(rec));
+                off += (sizeof(Record) + rec.msg_len + 1 + alignof(Record) - 1) & ~(alignof(Record) - 1);
+            }
+        }
+
+        void reset() {
+            used = 0;
+            dropped = 0;
+            had_error = false;
+        }
+    };
+
+    inline thread_local RequestBuffer t_request;
+
+    constexpr bool is_error_level(std::string_view level) { return level == "warn" || level == "error"; }
+
+    // A warn/error point marks the thread's request as erroring whether or not it is
+    // enabled (TailPolicy::keep_on_error); free for the other levels
+    YTRACE_ALWAYS_INLINE void note_level(const char* level) {
+        if (is_error_level(level) && t_request.depth > 0) t_request.had_error = true;
+    }
+
+    // Single exit for all trace output: buffered while a tail-sampled request is in flight
+    inline void emit(const char* level, const char* file, int line, const char* function, const char* msg) {
+        RequestBuffer& req = t_request;
+        if (req.depth > 0) {
+            req.append(level, file, line, function, msg);
+            return;
+        }
+        output(level, file, line, function, msg);
+    }
+}
+
+// RAII root scope of a tail-sampled request (see yrequest()). While tail sampling is on,
+// all records of the thread are buffered until the root scope ends, then emitted or
+// discarded according to the TailPolicy.
+class RequestScope {
+public:
+    RequestScope(const char* name, const char* file, int line, const char* function)
+        : name_(name), file_(file), line_(line), function_(function) {
+        auto& req = detail::t_request;
+        if (req.depth > 0) { ++req.depth; active_ = true; return; }
+        if (!TailSampler::instance().enabled()) return;
+        active_ = true;
+        req.depth = 1;
+        req.arena.begin_use();
+        start_ = std::chrono::steady_clock::now();
+    }
+
+    ~RequestScope() {
+        if (!active_) return;
+        auto& req = detail::t_request;
+        if (--req.depth > 0) return;
+
+        double latency_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_).count());
+        if (const char* reason = TailSampler::instance().decide(latency_ns, req.had_error)) {
+            req.for_each([](const detail::RequestBuffer::Record& rec, const char* msg) {
+                detail::output(rec.level, rec.file, rec.line, rec.function, msg);
+            });
+            char buf[256];
+            std::snprintf(buf, sizeof(buf), "%s kept (%s): latency=%s dropped=%" PRIu64,
+                name_, reason, format_duration(latency_ns).c_str(), req.dropped);
+            detail::output("request", file_, line_, function_, buf);
+        }
+        req.arena.end_use(req.used);
+        req.reset();
+    }
+
+    RequestScope(const RequestScope&) = delete;
+    RequestScope& operator=(const RequestScope&) = delete;
+
+private:
+    const char* name_;
+    const char* file_;
+    int line_;
+    const char* function_;
+    bool active_ = false;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#ifndef YTRACE_DRAIN_QUEUE_RECORDS
+#define YTRACE_DRAIN_QUEUE_RECORDS 1024  // records queued per producer thread (power of two)
+#endif
+#ifndef YTRACE_DRAIN_MESSAGE_BYTES
+#define YTRACE_DRAIN_MESSAGE_BYTES 256   // longer messages are truncated in the queue
+#endif
+#ifndef YTRACE_DRAIN_REORDER_MS
+#define YTRACE_DRAIN_REORDER_MS 20       // ordered mode: how long the sink holds records back
+#endif
+#ifndef YTRACE_DRAIN_IDLE_MS
+#define YTRACE_DRAIN_IDLE_MS 10          // longest an idle worker sleeps between passes
+#endif
+
+struct DrainOptions {
+    unsigned workers = 1;
+    std::vector<int> cpus;   // pin worker i to cpus[i % size] (Linux); empty = no pinning
+    int nice = 0;            // nice level of the workers (Linux); 0 = inherit
+    bool ordered = false;    // sink sees records in timestamp order, within YTRACE_DRAIN_REORDER_MS
+    bool page_batches = false;  // batches in whole pages the sink may vmsplice (Linux, see SpliceSink)
+};
+
+#ifndef YTRACE_DRAIN_BATCH_BYTES
+#define YTRACE_DRAIN_BATCH_BYTES (256 * 1024)  // most text handed to the sink in one call
+#endif
+#ifndef YTRACE_DRAIN_BATCH_BUFFERS
+#define YTRACE_DRAIN_BATCH_BUFFERS 4           // page batches: buffers each worker uses in turn
+#endif
+
+namespace detail {
+#if defined(__linux__)
+    inline size_t page_size() {
+        static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+    }
+#endif
+
+    // Formatted records handed to a DrainSink in one call. Storage is allocated once and
+    // records are formatted straight into its tail. With page batches (Linux) it is
+    // YTRACE_DRAIN_BATCH_BUFFERS page-aligned buffers in one mapping, used in turn; a
+    // buffer's used pages are discarded (MADV_DONTNEED) before it is written again, since
+    // a sink may have passed them to the kernel by reference (vmsplice).
+    class DrainBatch {
+    public:
+        explicit DrainBatch(bool pages) {
+#if defined(__linux__)
+            if (pages) {
+                capacity_ = (size_t(YTRACE_DRAIN_BATCH_BYTES) + page_size() - 1) & ~(page_size() - 1);
+                void* p = mmap(nullptr, capacity_ * YTRACE_DRAIN_BATCH_BUFFERS, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p != MAP_FAILED) {
+                    region_ = static_cast<char*>(p);
+                    data_ = region_;
+                    return;
+                }
+            }
+#else
+            (void)pages;
+#endif
+            heap_.resize(capacity_);  // also without pages to spare: the sink then write()s
+            data_ = heap_.data();
+        }
+
+        ~DrainBatch() {
+#if defined(__linux__)
+            if (region_) munmap(region_, capacity_ * YTRACE_DRAIN_BATCH_BUFFERS);
+#endif
+        }
+
+        DrainBatch(const DrainBatch&) = delete;
+        DrainBatch& operator=(const DrainBatch&) = delete;
+
+        // Format a record at the tail; false if it does not fit (hand the batch over, clear
+        // it and retry). A record longer than a whole batch is truncated.
+        bool format(const char* level, const char* file, int line, const char* function, const char* msg) {
+            size_t room = capacity_ - size_;
+            int n = std::snprintf(data_ + size_, room, "[%s] %s:%d (%s): %s\n", level, file, line, function, msg);
+            return n < 0 || commit(static_cast<size_t>(n), room);
+        }
+
+        // Same for text formatted elsewhere
+        bool append(const char* text, size_t n) {
+            size_t room = capacity_ - size_;
+            std::memcpy(data_ + size_, text, std::min(n, room));
+            return commit(n, room);
+        }
+
+        std::string_view view() const { return {data_, size_}; }
+        bool empty() const { return size_ == 0; }
+
+        void clear() {
+#if defined(__linux__)
+            if (region_) {
+                used_[current_] = size_;
+                current_ = (current_ + 1) % YTRACE_DRAIN_BATCH_BUFFERS;
+                data_ = region_ + current_ * capacity_;
+                if (used_[current_]) {
+                    madvise(data_, (used_[current_] + page_size() - 1) & ~(page_size() - 1), MADV_DONTNEED);
+                }
+            }
+#endif
+            size_ = 0;
+        }
+
+    private:
+        // n bytes were written at the tail, which had room for room - 1 and a NUL
+        bool commit(size_t n, size_t room) {
+            if (n < room) {
+                size_ += n;
+                return true;
+            }
+            if (size_ > 0) return false;
+            size_ = capacity_;  // alone and still too long: keep what fit, newline-terminated
+            data_[size_ - 1] = '\n';
+            return true;
+        }
+
+        size_t capacity_ = YTRACE_DRAIN_BATCH_BYTES;
+        char* data_ = nullptr;
+        size_t size_ = 0;
+        std::pmr::vector<char> heap_{&memory_resource()};
+#if defined(__linux__)
+        char* region_ = nullptr;
+        size_t current_ = 0;
+        size_t used_[YTRACE_DRAIN_BATCH_BUFFERS] = {};
+#endif
+    };
+}
+
+// Receives batches of formatted, newline-terminated records; called by one worker at a time
+using DrainSink = std::function<void(std::string_view)>;
+
+// Moves record formatting and output off the traced threads. While running, trace output
+// goes into a per-thread SPSC queue; a pool of workers shards the queues among themselves
+// (each queue has one worker, so per-thread order is kept), formats records into batches
+// and hands them to the sink. A full queue drops the record rather than block the producer.
+// Queues are charged to the MemoryBudget; a thread whose queue the budget refuses drops its
+// records and asks again a second later. Idle workers sleep until a producer wakes them.
+// In ordered mode the sink stage holds records for YTRACE_DRAIN_REORDER_MS and releases
+// them by timestamp; a record arriving later than that is still written, out of order.
+class DrainPool {
+public:
+    static DrainPool& instance() {
+        memory_resource();  // constructed first, so destroyed after the pool's queues
+        MemoryBudget::instance();
+        static DrainPool pool;
+        return pool;
+    }
+
+    ~DrainPool() { stop(); }
+
+    static void stderr_sink(std::string_view batch) {
+        std::fwrite(batch.data(), 1, batch.size(), stderr);
+    }
+
+    // Start the workers and route trace output through them; false if already running
+    bool start(const DrainOptions& options, DrainSink sink = stderr_sink) {
+        std::lock_guard<std::mutex> control(control_mutex_);
+        if (running_.load(std::memory_order_relaxed)) return false;
+        options_ = options;
+        options_.workers = std::max(1u, options_.workers);
+        sink_ = std::move(sink);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queues_.clear();
+            generation_.fetch_add(1, std::memory_order_release);  // threads re-register their queues
+        }
+        if (options_.ordered) reorder_batch_ = std::make_unique<detail::DrainBatch>(options_.page_batches);
+        ordered_.store(options_.ordered, std::memory_order_relaxed);
+        while (wakers_.size() < options_.workers) wakers_.emplace_back();
+        running_.store(true, std::memory_order_release);
+        for (unsigned i = 0; i < options_.workers; ++i) workers_.emplace_back([this, i] { run_worker(i); });
+        detail::drain_push().store(push_to_instance, std::memory_order_relaxed);
+        detail::route().fetch_or(detail::kRouteDrain, std::memory_order_release);
+        return true;
+    }
+
+    // Route output back to trace_handler(), write out everything queued and join the workers
+    void stop() {
+        std::lock_guard<std::mutex> control(control_mutex_);
+        if (!running_.load(std::memory_order_relaxed)) return;
+        detail::route().fetch_and(~uint32_t(detail::kRouteDrain), std::memory_order_release);
+        running_.store(false, std::memory_order_release);
+        for (auto& waker : wakers_) waker.wake();
+        for (auto& worker : workers_) worker.join();
+        workers_.clear();
+        std::lock_guard<std::mutex> sink_lock(sink_mutex_);
+        flush_reordered(UINT64_MAX);
+        reorder_batch_.reset();
+        sink_ = nullptr;  // a FileSink writes its last block when released
+    }
+
+    bool running() const { return running_.load(std::memory_order_acquire); }
+    uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // Producer side: copy the record into the calling thread's queue
+    void push(const char* level, const char* file, int line, const char* function, const char* msg) {
+        Queue* queue = local_queue();
+        if (!queue) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        uint64_t head = queue->head.load(std::memory_order_relaxed);
+        if (head - queue->tail.load(std::memory_order_acquire) == YTRACE_DRAIN_QUEUE_RECORDS) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Record& rec = queue->ring[head & (YTRACE_DRAIN_QUEUE_RECORDS - 1)];
+        rec.level = level;
+        rec.file = file;
+        rec.line = line;
+        rec.function = function;
+        rec.timestamp_ns = ordered_.load(std::memory_order_relaxed) ? now_ns() : 0;
+        size_t len = std::min(std::strlen(msg), sizeof(rec.msg) - 1);
+        std::memcpy(rec.msg, msg, len);
+        rec.msg[len] = '\0';
+        queue->head.store(head + 1, std::memory_order_release);
+        // A worker that misses this (it went to sleep just now) wakes within YTRACE_DRAIN_IDLE_MS
+        Waker& waker = *queue->waker;
+        if (waker.sleeping.load(std::memory_order_relaxed) && waker.sleeping.exchange(false)) [[unlikely]] {
+            waker.wake();
+        }
+    }
+
+    std::string status() {
+        if (!running()) return "drain:    off\n";
+        size_t queues;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queues = queues_.size();
+        }
+        std::ostringstream oss;
+        oss << "drain:    " << options_.workers << " worker(s), " << queues << " queue(s), "
+            << written() << " written, " << dropped() << " dropped";
+        if (!options_.cpus.empty()) {
+            oss << ", cpus";
+            for (size_t i = 0; i < options_.cpus.size(); ++i) oss << (i ? "," : " ") << options_.cpus[i];
+        }
+        if (options_.nice) oss << ", nice " << options_.nice;
+        if (options_.ordered) oss << ", ordered";
+        if (options_.page_batches) oss << ", page batches";
+        oss << "\n";
+        return oss.str();
+    }
+
+private:
+    static_assert((YTRACE_DRAIN_QUEUE_RECORDS & (YTRACE_DRAIN_QUEUE_RECORDS - 1)) == 0,
+                  "YTRACE_DRAIN_QUEUE_RECORDS must be a power of two");
+
+    struct Record {
+        const char* level;
+        const char* file;
+        int line;
+        const char* function;
+        uint64_t timestamp_ns;
+        char msg[YTRACE_DRAIN_MESSAGE_BYTES];
+    };
+
+    static constexpr size_t kQueueBytes = YTRACE_DRAIN_QUEUE_RECORDS * sizeof(Record);
+
+    // Where worker i sleeps while its shard is idle; producers only touch it to wake it
+    struct Waker {
+        std::mutex mutex;
+        std::condition_variable cv;
+        alignas(64) std::atomic<bool> sleeping{false};
+
+        void wake() {
+            { std::lock_guard<std::mutex> lock(mutex); }
+            cv.notify_one();
+        }
+    };
+
+    // Written by one producer thread, read by the worker owning shard. Holds a MemoryBudget
+    // reservation of kQueueBytes.
+    struct Queue {
+        Queue(unsigned s, Waker* w) : shard(s), waker(w) {}
+        ~Queue() { MemoryBudget::instance().release(kQueueBytes); }
+        std::pmr::vector<Record> ring{YTRACE_DRAIN_QUEUE_RECORDS, &memory_resource()};
+        unsigned shard;
+        Waker* waker;
+        std::atomic<bool> orphaned{false};    // producer thread exited
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+    };
+
+    // Thread-local link to the thread's queue of the current run (generation)
+    struct Producer {
+        std::shared_ptr<Queue> queue;
+        uint64_t generation = 0;
+        int64_t refused_at = -1;  // steady_seconds() of the last refusal in this generation
+        ~Producer() { if (queue) queue->orphaned.store(true, std::memory_order_release); }
+    };
+
+    DrainPool() = default;
+
+    static void push_to_instance(const char* level, const char* file, int line, const char* function, const char* msg) {
+        instance().push(level, file, line, function, msg);
+    }
+
+    static uint64_t now_ns() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // nullptr while the budget refuses the thread a queue
+    Queue* local_queue() {
+        static thread_local Producer producer;
+        uint64_t generation = generation_.load(std::memory_order_acquire);
+        if (!producer.queue || producer.generation != generation) {
+            int64_t now = detail::steady_seconds();
+            if (!producer.queue && producer.generation == generation && producer.refused_at == now) return nullptr;
+            if (producer.queue) producer.queue->orphaned.store(true, std::memory_order_release);
+            if (!MemoryBudget::instance().reserve(kQueueBytes)) {
+                producer.queue.reset();
+                producer.generation = generation;
+                producer.refused_at = now;
+                return nullptr;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            unsigned shard = next_shard_++ % options_.workers;
+            producer.queue = std::allocate_shared<Queue>(std::pmr::polymorphic_allocator<Queue>(&memory_resource()),
+                                                         shard, &wakers_[shard]);
+            producer.generation = generation;
+            queues_.push_back(producer.queue);
+            ++queues_version_;
+        }
+        return producer.queue.get();
+    }
+
+    void configure_worker(unsigned index) {
+#if defined(__linux__)
+        if (!options_.cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(options_.cpus[index % options_.cpus.size()], &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+        if (options_.nice) setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), options_.nice);
+#else
+        (void)index;
+#endif
+    }
+
+    void run_worker(unsigned index) {
+        configure_worker(index);
+        std::vector<std::shared_ptr<Queue>> shard;
+        uint64_t version = UINT64_MAX;
+        detail::DrainBatch batch(options_.page_batches);
+        std::vector<std::pair<uint64_t, std::string>> stamped;
+        char line[YTRACE_DRAIN_MESSAGE_BYTES + 512];
+        for (;;) {
+            bool stopping = !running_.load(std::memory_order_acquire);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (version != queues_version_) {
+                    version = queues_version_;
+                    shard.clear();
+                    for (const auto& queue : queues_) {
+                        if (queue->shard == index) shard.push_back(queue);
+                    }
+                }
+            }
+
+            size_t records = 0;
+            for (const auto& queue : shard) {
+                bool orphaned = queue->orphaned.load(std::memory_order_acquire);
+                uint64_t tail = queue->tail.load(std::memory_order_relaxed);
+                uint64_t head = queue->head.load(std::memory_order_acquire);
+                for (; tail != head; ++tail, ++records) {
+                    const Record& rec = queue->ring[tail & (YTRACE_DRAIN_QUEUE_RECORDS - 1)];
+                    if (options_.ordered) {
+                        int n = std::snprintf(line, sizeof(line), "[%s] %s:%d (%s): %s\n",
+                                              rec.level, rec.file, rec.line, rec.function, rec.msg);
+                        n = std::min(n, static_cast<int>(sizeof(line)) - 1);
+                        stamped.emplace_back(rec.timestamp_ns, std::string(line, static_cast<size_t>(n)));
+                    } else if (!batch.format(rec.level, rec.file, rec.line, rec.function, rec.msg)) {
+                        hand_over(batch);
+                        batch.format(rec.level, rec.file, rec.line, rec.function, rec.msg);
+                    }
+                }
+                queue->tail.store(tail, std::memory_order_release);
+                if (orphaned) retire(queue);  // drained after its thread exited
+            }
+
+            if (records) {
+                written_.fetch_add(records, std::memory_order_relaxed);
+                std::lock_guard<std::mutex> sink_lock(sink_mutex_);
+                if (options_.ordered) {
+                    for (auto& entry : stamped) reorder_.emplace(entry.first, std::move(entry.second));
+                    stamped.clear();
+                } else if (!batch.empty()) {
+                    sink_(batch.view());
+                    batch.clear();
+                }
+            }
+            if (options_.ordered) {
+                std::lock_guard<std::mutex> sink_lock(sink_mutex_);
+                flush_reordered(now_ns() - uint64_t(YTRACE_DRAIN_REORDER_MS) * 1000000);
+            }
+            if (stopping) return;  // the pass after the stop request emptied the queues
+            if (!records) idle(index, shard);
+        }
+    }
+
+    // Sleep until a producer or stop() wakes the pool, or YTRACE_DRAIN_IDLE_MS passes (which
+    // also paces ordered mode's releases while nothing new arrives)
+    void idle(unsigned index, const std::vector<std::shared_ptr<Queue>>& shard) {
+        Waker& waker = wakers_[index];
+        std::unique_lock<std::mutex> lock(waker.mutex);
+        waker.sleeping.store(true);
+        bool pending = std::any_of(shard.begin(), shard.end(), [](const std::shared_ptr<Queue>& queue) {
+            return queue->head.load(std::memory_order_acquire) != queue->tail.load(std::memory_order_relaxed);
+        });
+        if (!pending && running_.load(std::memory_order_acquire)) {
+            waker.cv.wait_for(lock, std::chrono::milliseconds(YTRACE_DRAIN_IDLE_MS));
+        }
+        waker.sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    void retire(const std::shared_ptr<Queue>& queue) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find(queues_.begin(), queues_.end(), queue);
+        if (it == queues_.end()) return;
+        queues_.erase(it);
+        ++queues_version_;
+    }
+
+    // A full batch goes to the sink mid-pass
+    void hand_over(detail::DrainBatch& batch) {
+        std::lock_guard<std::mutex> sink_lock(sink_mutex_);
+        sink_(batch.view());
+        batch.clear();
+    }
+
+    // Caller holds sink_mutex_: write reordered records stamped before cutoff
+    void flush_reordered(uint64_t cutoff) {
+        auto end = reorder_.lower_bound(cutoff);
+        if (reorder_.begin() == end) return;
+        auto& batch = *reorder_batch_;
+        for (auto it = reorder_.begin(); it != end; ++it) {
+            if (batch.append(it->second.data(), it->second.size())) continue;
+            sink_(batch.view());
+            batch.clear();
+            batch.append(it->second.data(), it->second.size());
+        }
+        reorder_.erase(reorder_.begin(), end);
+        sink_(batch.view());
+        batch.clear();
+    }
+
+    std::mutex control_mutex_;            // start/stop
+    DrainOptions options_;
+    DrainSink sink_;
+    std::vector<std::thread> workers_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> ordered_{false};
+
+    std::mutex mutex_;                    // queues_, shard assignment
+    std::vector<std::shared_ptr<Queue>> queues_;
+    uint64_t queues_version_ = 0;
+    std::atomic<uint64_t> generation_{0};
+    unsigned next_shard_ = 0;
+
+    std::mutex sink_mutex_;               // sink_ calls, reorder_
+    std::multimap<uint64_t, std::string> reorder_;
+    std::unique_ptr<detail::DrainBatch> reorder_batch_;  // ordered mode, allocated by start()
+
+    std::deque<Waker> wakers_;            // one per worker; only grows, queues point into it
+
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+#ifndef YTRACE_FILE_BLOCK_BYTES
+#define YTRACE_FILE_BLOCK_BYTES (64 * 1024)   // FileSink: raw bytes per compressed block
+#endif
+
+struct FileSinkOptions {
+    bool compress = false;                      // write lz blocks (decode with ytrace-ctl cat)
+    size_t block_bytes = YTRACE_FILE_BLOCK_BYTES;
+    bool append = false;
+};
+
+// DrainSink writing batches to a file. With compression, text is gathered into blocks of
+// block_bytes and each is compressed on the calling (drain worker) thread into an
+// independent, length-prefixed block (see compress.hpp). Copies share the file; the last
+// one to go writes the final partial block.
+class FileSink {
+public:
+    explicit FileSink(const std::string& path, FileSinkOptions options = {})
+        : state_(std::make_shared<State>(path, options)) {}
+
+    bool is_open() const { return state_->file != nullptr; }
+
+    void operator()(std::string_view batch) const {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->write(batch);
+    }
+
+    // Write the pending partial block and flush the file
+    void flush() const {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->flush();
+    }
+
+    uint64_t raw_bytes() const { return state_->raw_bytes.load(std::memory_order_relaxed); }
+    uint64_t written_bytes() const { return state_->written_bytes.load(std::memory_order_relaxed); }
+
+private:
+    struct State {
+        State(const std::string& path, const FileSinkOptions& opts)
+            : options(opts), file(std::fopen(path.c_str(), opts.append ? "ab" : "wb")) {
+            options.block_bytes = std::clamp<size_t>(options.block_bytes, 1024, lz::kMaxBlockBytes);
+        }
+
+        ~State() {
+            flush();
+            if (file) std::fclose(file);
+        }
+
+        void write(std::string_view batch) {
+            if (!file) return;
+            raw_bytes.fetch_add(batch.size(), std::memory_order_relaxed);
+            if (!options.compress) {
+                put(batch);
+                return;
+            }
+            while (!batch.empty()) {
+                size_t take = std::min(batch.size(), options.block_bytes - pending.size());
+                pending.append(batch.substr(0, take));
+                batch.remove_prefix(take);
+                if (pending.size() == options.block_bytes) write_block();
+            }
+        }
+
+        void flush() {
+            if (!file) return;
+            if (!pending.empty()) write_block();
+            std::fflush(file);
+        }
+
+        void write_block() {
+            block.clear();
+            lz::encode_block(pending, block);
+            pending.clear();
+            put(block);
+        }
+
+        void put(std::string_view bytes) {
+            std::fwrite(bytes.data(), 1, bytes.size(), file);
+            written_bytes.fetch_add(bytes.size(), std::memory_order_relaxed);
+        }
+
+        FileSinkOptions options;
+        std::FILE* file;
+        std::mutex mutex;
+        std::string pending;    // raw text of the block being filled
+        std::string block;      // encoded block, reused
+        std::atomic<uint64_t> raw_bytes{0};
+        std::atomic<uint64_t> written_bytes{0};
+    };
+
+    std::shared_ptr<State> state_;
+};
+
+#if defined(__linux__)
+#ifndef YTRACE_SPLICE_PIPE_BYTES
+#define YTRACE_SPLICE_PIPE_BYTES (1024 * 1024)   // SpliceSink: pipe capacity requested (F_SETPIPE_SZ)
+#endif
+#ifndef YTRACE_SPLICE_STALL_MS
+#define YTRACE_SPLICE_STALL_MS 1000              // SpliceSink: a consumer reading nothing this long closes it
+#endif
+
+// DrainSink streaming batches to a socket, pipe or file descriptor (e.g. ytrace-ctl stream).
+// Batches of a DrainPool started with page_batches are passed by reference: vmsplice maps
+// their pages into a pipe and splice moves them on to fd, so the text is not copied after
+// the worker formatted it. Other batches, and descriptors splice does not support, go through write().
+// fd is switched to O_NONBLOCK. While the consumer is slow, a write waits for it in poll()
+// (the drain workers stall; the traced threads drop records rather than wait), and a
+// consumer that takes nothing for stall_ms closes the sink, dropping the rest, so a
+// DrainPool::stop() never waits on it for longer. The first failed write (consumer gone)
+// closes the sink too, and so does poll_hangup() seeing the consumer hang up while
+// nothing is written; its owner stops the pool once closed() is true.
+// Only pass page-aligned batches whose pages are not written again after the call, as a
+// page_batches DrainPool guarantees: the kernel reads them after the sink returns.
+class SpliceSink {
+public:
+    // With own_fd, fd is closed with the last copy of the sink
+    explicit SpliceSink(int fd, bool own_fd = false, int stall_ms = YTRACE_SPLICE_STALL_MS)
+        : state_(std::make_shared<State>(fd, own_fd, stall_ms)) {}
+
+    void operator()(std::string_view batch) const {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->write(batch);
+    }
+
+    bool closed() const { return state_->closed.load(std::memory_order_acquire); }
+
+    // Close the sink if the consumer hung up: an idle stream never fails a write. Returns
+    // closed(); does not block.
+    bool poll_hangup() const {
+        pollfd pfd{state_->fd, POLLRDHUP, 0};
+        if (poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+            state_->closed.store(true, std::memory_order_release);
+        }
+        return closed();
+    }
+
+    uint64_t spliced_bytes() const { return state_->spliced_bytes.load(std::memory_order_relaxed); }
+    uint64_t written_bytes() const { return state_->written_bytes.load(std::memory_order_relaxed); }
+
+private:
+    struct State {
+        State(int f, bool own, int stall) : fd(f), own_fd(own), stall_ms(stall) {
+            int flags = fcntl(fd, F_GETFL);
+            if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+            if (pipe2(pipe_fds, O_CLOEXEC) == 0) {
+                fcntl(pipe_fds[1], F_SETPIPE_SZ, YTRACE_SPLICE_PIPE_BYTES);  // best effort
+            } else {
+                pipe_fds[0] = pipe_fds[1] = -1;
+                use_splice = false;
+            }
+        }
+
+        ~State() {
+            if (pipe_fds[0] >= 0) close(pipe_fds[0]);
+            if (pipe_fds[1] >= 0) close(pipe_fds[1]);
+            if (own_fd) close(fd);
+        }
+
+        void write(std::string_view batch) {
+            SigpipeBlock guard;
+            bool by_reference = use_splice && reinterpret_cast<uintptr_t>(batch.data()) % detail::page_size() == 0;
+            while (!batch.empty() && !closed.load(std::memory_order_relaxed)) {
+                size_t n = by_reference && use_splice ? splice_some(batch) : write_some(batch);
+                batch.remove_prefix(std::min(n, batch.size()));
+            }
+        }
+
+        // Queue the head of batch in the pipe and splice it to fd; returns the bytes sent.
+        // If fd turns out not to support splice, what is in the pipe is copied out to fd
+        // and later batches use write().
+        size_t splice_some(std::string_view batch) {
+            iovec iov{const_cast<char*>(batch.data()), batch.size()};
+            ssize_t queued = vmsplice(pipe_fds[1], &iov, 1, 0);
+            if (queued <= 0) {
+                if (queued < 0 && errno == EINTR) return 0;
+                use_splice = false;
+                return 0;
+            }
+            size_t left = static_cast<size_t>(queued);
+            while (left) {
+                ssize_t moved = splice(pipe_fds[0], nullptr, fd, nullptr, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (moved > 0) {
+                    left -= static_cast<size_t>(moved);
+                    spliced_bytes.fetch_add(static_cast<uint64_t>(moved), std::memory_order_relaxed);
+                } else if (moved < 0 && errno == EINTR) {
+                    continue;
+                } else if (moved < 0 && errno == EAGAIN) {
+                    if (!wait_writable()) return static_cast<size_t>(queued);
+                } else if (moved < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                    use_splice = false;
+                    copy_out_pipe(left);
+                    return static_cast<size_t>(queued);
+                } else {
+                    fail();
+                    return static_cast<size_t>(queued);
+                }
+            }
+            return static_cast<size_t>(queued);
+        }
+
+        // Fallback: move bytes already queued in the pipe to fd through a buffer
+        void copy_out_pipe(size_t left) {
+            char buffer[16384];
+            while (left) {
+                ssize_t n = read(pipe_fds[0], buffer, std::min(left, sizeof(buffer)));
+                if (n <= 0) {
+                    if (n < 0 && errno == EINTR) continue;
+                    return;
+                }
+                left -= static_cast<size_t>(n);
+                std::string_view chunk(buffer, static_cast<size_t>(n));
+                while (!chunk.empty() && !closed.load(std::memory_order_relaxed)) {
+                    chunk.remove_prefix(write_some(chunk));
+                }
+            }
+        }
+
+        size_t write_some(std::string_view batch) {
+            ssize_t n = ::write(fd, batch.data(), batch.size());
+            if (n < 0) {
+                if (errno == EAGAIN) wait_writable();
+                else if (errno != EINTR) fail();
+                return 0;
+            }
+            written_bytes.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+            return static_cast<size_t>(n);
         }
-        return oss.str();
-    }
 
-    ~TimerManager() {
-        auto s = summary();
-        if (!s.empty()) {
-            std::fprintf(stderr, "\n[ytrace] Timer summary:\n%s", s.c_str());
+        // Wait until fd takes more; false, with the sink closed, if it takes nothing for stall_ms
+        bool wait_writable() {
+            pollfd pfd{fd, POLLOUT, 0};
+            int ready;
+            do {
+                ready = poll(&pfd, 1, stall_ms);
+            } while (ready < 0 && errno == EINTR);
+            if (ready <= 0) fail();  // a hangup shows as POLLHUP/POLLERR and fails the retry
+            return ready > 0;
         }
-    }
 
-private:
-    TimerManager() = default;
-    std::mutex mutex_;
-    std::unordered_map<std::string, TimerStats> stats_;
+        void fail() {
+            closed.store(true, std::memory_order_release);
+            // A write to a disconnected socket or pipe raised SIGPIPE, blocked on this
+            // thread: consume it so it is not delivered later
+            sigset_t set;
+            sigemptyset(&set);
+            sigaddset(&set, SIGPIPE);
+            timespec zero{0, 0};
+            while (sigtimedwait(&set, nullptr, &zero) == SIGPIPE) {}
+        }
+
+        // The consumer going away must not kill the process: SIGPIPE is blocked on the
+        // writing thread for the duration of a batch
+        struct SigpipeBlock {
+            SigpipeBlock() {
+                sigset_t set;
+                sigemptyset(&set);
+                sigaddset(&set, SIGPIPE);
+                pthread_sigmask(SIG_BLOCK, &set, &saved);
+            }
+            ~SigpipeBlock() { pthread_sigmask(SIG_SETMASK, &saved, nullptr); }
+            sigset_t saved;
+        };
+
+        int fd;
+        bool own_fd;
+        int stall_ms;
+        int pipe_fds[2];
+        bool use_splice = true;
+        std::mutex mutex;
+        std::atomic<bool> closed{false};
+        std::atomic<uint64_t> spliced_bytes{0};
+        std::atomic<uint64_t> written_bytes{0};
+    };
+
+    std::shared_ptr<State> state_;
 };
+#endif
 
 #if defined(YTRACE_NO_CONTROL_SOCKET)
 // Simplified TraceManager for Emscripten/WASM (no control socket, no config persistence)
@@ -242,9 +3551,36 @@ public:
     ~TraceManager() = default;
 
     void register_trace_point(bool* enabled, const char* file, int line, const char* function,
-                              const char* level, const char* message) {
+                              const char* level, const char* message,
+                              void (*on_change)(const TracePointInfo&) = nullptr, void* context = nullptr) {
+        register_trace_point(TracePointInfo{enabled, file, line, function, level, message, on_change, context});
+    }
+
+    void register_trace_point(const TracePointInfo& point, const char* category = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        TracePointInfo* info = detail::try_emplace_back(trace_points_, point);
+        if (!info) {
+            *point.enabled = false;
+            ++dropped_points_;
+            return;
+        }
+        if (Category* cat = category ? category_locked(category) : nullptr) {
+            add_to_category(*info, *cat);
+        } else if (*info->enabled && info->on_change) {
+            info->on_change(*info);
+        }
+    }
+
+    // Returns false if the category table is full
+    bool set_category_enabled(const char* name, bool state) {
         std::lock_guard<std::mutex> lock(mutex_);
-        trace_points_.push_back(TracePointInfo{enabled, file, line, function, level, message});
+        Category* cat = category_locked(name);
+        if (!cat) return false;
+        cat->enabled.store(state, std::memory_order_relaxed);
+        for (size_t i = cat->first_point; i != SIZE_MAX; i = trace_points_[i].next_in_category) {
+            refresh_point(trace_points_[i]);
+        }
+        return true;
     }
 
     bool set_enabled(const char* file, int line, const char* function,
@@ -256,7 +3592,7 @@ public:
                 std::string_view(info.function) == std::string_view(function) &&
                 std::string_view(info.level) == std::string_view(level) &&
                 std::string_view(info.message) == std::string_view(message)) {
-                *info.enabled = state;
+                set_point(info, state);
                 return true;
             }
         }
@@ -266,7 +3602,7 @@ public:
     bool set_enabled_by_index(size_t index, bool state) {
         std::lock_guard<std::mutex> lock(mutex_);
         if (index < trace_points_.size()) {
-            *trace_points_[index].enabled = state;
+            set_point(trace_points_[index], state);
             return true;
         }
         return false;
@@ -277,7 +3613,7 @@ public:
         std::string_view level_view(level);
         for (auto& info : trace_points_) {
             if (std::string_view(info.level) == level_view) {
-                *info.enabled = state;
+                set_point(info, state);
             }
         }
     }
@@ -287,7 +3623,7 @@ public:
         std::string_view file_view(file);
         for (auto& info : trace_points_) {
             if (std::string_view(info.file) == file_view) {
-                *info.enabled = state;
+                set_point(info, state);
             }
         }
     }
@@ -297,15 +3633,113 @@ public:
         std::string_view func_view(function);
         for (auto& info : trace_points_) {
             if (std::string_view(info.function) == func_view) {
-                *info.enabled = state;
+                set_point(info, state);
+            }
+        }
+    }
+
+    void set_function_object_filtered(const char* function) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string_view func_view(function);
+        for (auto& info : trace_points_) {
+            if (info.object_filtered && std::string_view(info.function) == func_view) {
+                set_point(info, true, EnableMode{true, nullptr});
+            }
+        }
+    }
+
+    void set_function_stack(const char* function) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string_view func_view(function);
+        for (auto& info : trace_points_) {
+            if (info.control && std::string_view(info.function) == func_view) {
+                set_point(info, true, EnableMode{false, nullptr, true});
+            }
+        }
+    }
+
+    bool set_function_condition(const char* function, const char* expr, std::string* error = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string err;
+        const Predicate* pred = intern_predicate(expr, err);
+        if (!pred) {
+            if (error) *error = err;
+            return false;
+        }
+        std::string_view func_view(function);
+        for (auto& info : trace_points_) {
+            if (info.control && std::string_view(info.function) == func_view) {
+                set_point(info, true, EnableMode{false, pred});
+            }
+        }
+        return true;
+    }
+
+    bool set_function_under(const char* function, const char* scope) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t bit = CallPath::instance().bit(scope, under_in_use_locked());
+        if (!bit) return false;
+        std::string_view func_view(function);
+        for (auto& info : trace_points_) {
+            if (info.control && std::string_view(info.function) == func_view) {
+                set_point(info, true, EnableMode{false, nullptr, false, bit});
+            }
+        }
+        return true;
+    }
+
+    bool set_function_on_thread(const char* function, const char* thread_glob, std::string* error = nullptr) {
+        std::string err;
+        uint64_t bit = ThreadFilter::instance().bit(thread_glob, err);
+        if (!bit) {
+            if (error) *error = err;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string_view func_view(function);
+        for (auto& info : trace_points_) {
+            if (info.control && std::string_view(info.function) == func_view) {
+                set_point(info, true, EnableMode{false, nullptr, false, 0, bit});
             }
         }
+        return true;
+    }
+
+    // Enable profiles (see ProfileSet), kept in memory only. False for an invalid or
+    // unknown name.
+    bool save_profile(const char* name) {
+        if (!ProfileSet::valid_name(name)) return false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        profiles_.capture(name, trace_points_, categories_);
+        return true;
+    }
+
+    bool use_profile(const char* name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ProfileSet::Profile* profile = profiles_.find(name);
+        if (!profile) return false;
+        profiles_.apply(*profile, trace_points_, categories_,
+                        [](TracePointInfo& info, bool on) { set_point(info, on); }, refresh_point);
+        return true;
+    }
+
+    bool delete_profile(const char* name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return profiles_.remove(name);
+    }
+
+    std::string list_profiles() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return profiles_.list();
     }
 
     void set_all_enabled(bool state) {
         std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& cat : categories_) {
+            cat.enabled.store(state, std::memory_order_relaxed);
+        }
         for (auto& info : trace_points_) {
-            *info.enabled = state;
+            set_point(info, state);
         }
     }
 
@@ -329,17 +3763,134 @@ public:
             oss << idx++ << " " << (*info.enabled ? "[ON] " : "[OFF]") 
                 << " [" << info.level << "] "
                 << info.file << ":" << info.line 
-                << " (" << info.function << ") \"" << info.message << "\"\n";
+                << " (" << info.function << ") \"" << info.message << "\"";
+            append_point_state(oss, info);
+            oss << "\n";
+        }
+        if (dropped_points_ || dropped_categories_) {
+            oss << "# dropped (capacity reached): " << dropped_points_ << " trace point(s), "
+                << dropped_categories_ << " categor" << (dropped_categories_ == 1 ? "y" : "ies") << "\n";
         }
         return oss.str();
     }
 
+    // Registrations refused because the registry was full (YTRACE_FIXED_CAPACITY builds)
+    uint64_t dropped_points() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dropped_points_;
+    }
+
     std::string get_socket_path() const { return ""; }
 
+    // Per-second rate history (see RateHistory). Without a control thread, the application
+    // calls sample_history() itself, about once a second.
+    void set_history(bool on, size_t seconds = YTRACE_HISTORY_SECONDS) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        history_.configure(on, seconds);
+    }
+
+    void sample_history(int64_t now_sec) {
+        if (!history_.enabled()) return;
+        auto timers = TimerManager::instance().counts();
+        std::lock_guard<std::mutex> lock(mutex_);
+        history_.sample(trace_points_, timers, now_sec);
+    }
+
+    std::string history_dump() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return history_.dump();
+    }
+
+    // ytrace's own footprint: memory resource, buffer budget, drain pool and registry sizes
+    std::string self_report() {
+        std::string report = MemoryBudget::instance().status() + DrainPool::instance().status();
+        std::lock_guard<std::mutex> lock(mutex_);
+        report += "registry: " + std::to_string(trace_points_.size()) + " trace point(s), "
+                + std::to_string(categories_.size()) + " categor" + (categories_.size() == 1 ? "y" : "ies") + ", "
+                + std::to_string(predicates_.size()) + " predicate(s)\n";
+        return report;
+    }
+
 private:
     TraceManager() = default;
+
+    // Enabling also selects the object mode of object points and the predicate of
+    // conditional points; disabling drops the predicate
+    // CallPath bits some point is enabled under (the rest may be reassigned)
+    uint64_t under_in_use_locked() const {
+        uint64_t in_use = 0;
+        for (const auto& info : trace_points_) {
+            if (info.control) in_use |= info.control->under.load(std::memory_order_relaxed);
+        }
+        return in_use;
+    }
+
+    static void set_point(TracePointInfo& info, bool state, const EnableMode& mode = {}) {
+        if (info.object_filtered && state) *info.object_filtered = mode.object_filtered;
+        if (info.control) {
+            info.control->predicate.store(state ? mode.condition : nullptr, std::memory_order_release);
+            info.control->under.store(state ? mode.under : 0, std::memory_order_relaxed);
+            info.control->threads.store(state ? mode.threads : 0, std::memory_order_relaxed);
+            info.control->with_stack = state && mode.with_stack;
+        }
+        if (info.category) info.self_enabled = state;
+        else *info.enabled = state;
+        refresh_point(info);
+    }
+
+    // Fold the point's own state and its category into the single flag the macro reads
+    static void refresh_point(TracePointInfo& info) {
+        if (info.category) {
+            *info.enabled = info.self_enabled || info.category->enabled.load(std::memory_order_relaxed);
+        }
+        if (info.on_change) info.on_change(info);
+    }
+
+    // Compile expr, reusing an identical predicate (caller holds mutex_). Predicates are
+    // never freed: a hot path may still be evaluating one that was just replaced.
+    const Predicate* intern_predicate(const std::string& expr, std::string& error) {
+        for (const auto& pred : predicates_) {
+            if (pred.source() == expr) return &pred;
+        }
+        Predicate* pred = detail::try_emplace_back(predicates_);
+        if (!pred) {
+            error = "too many predicates";
+            return nullptr;
+        }
+        if (!pred->compile(expr, error)) {
+            predicates_.pop_back();
+            return nullptr;
+        }
+        return pred;
+    }
+
+    // Link a newly registered point into its category (caller holds mutex_)
+    void add_to_category(TracePointInfo& info, Category& cat) {
+        info.category = &cat;
+        info.next_in_category = std::exchange(cat.first_point, trace_points_.size() - 1);
+        ++cat.point_count;
+        info.self_enabled = *info.enabled;
+        refresh_point(info);
+    }
+
+    // Find or create a category (caller holds mutex_); nullptr if the table is full
+    Category* category_locked(const char* name) {
+        for (auto& cat : categories_) {
+            if (cat.name == name) return &cat;
+        }
+        Category* cat = detail::try_emplace_back(categories_, name);
+        if (!cat) ++dropped_categories_;
+        return cat;
+    }
+
     std::mutex mutex_;
-    std::vector<TracePointInfo> trace_points_;
+    detail::PointList trace_points_{&memory_resource()};
+    detail::CategoryList categories_{&memory_resource()};
+    detail::PredicateList predicates_{&memory_resource()};
+    ProfileSet profiles_;
+    uint64_t dropped_points_ = 0;       // registrations beyond the registry capacity
+    uint64_t dropped_categories_ = 0;
+    RateHistory history_;
 };
 
 #else // Full TraceManager with control socket
@@ -362,17 +3913,60 @@ public:
     // Register a trace point - stores pointer to the caller's static bool
     // Note: Control socket is NOT auto-opened. Call open_ctrl_socket() explicitly.
     void register_trace_point(bool* enabled, const char* file, int line, const char* function,
-                              const char* level, const char* message) {
+                              const char* level, const char* message,
+                              void (*on_change)(const TracePointInfo&) = nullptr, void* context = nullptr) {
+        register_trace_point(TracePointInfo{enabled, file, line, function, level, message, on_change, context});
+    }
+
+    // Register a fully described trace point (optional fields: on_change, sampler, ...),
+    // optionally as a member of a category
+    void register_trace_point(const TracePointInfo& point, const char* category = nullptr) {
         std::lock_guard<std::mutex> lock(mutex_);
-        trace_points_.push_back(TracePointInfo{enabled, file, line, function, level, message});
+        TracePointInfo* info = detail::try_emplace_back(trace_points_, point);
+        if (!info) {
+            *point.enabled = false;  // registry full: the point stays off
+            ++dropped_points_;
+            return;
+        }
 
         // Apply saved state to this newly registered trace point
-        ConfigPersistence::apply_saved_state(saved_config_, trace_points_.back());
+        ConfigPersistence::apply_saved_state(saved_config_, *info);
+        if (Category* cat = category ? category_locked(category) : nullptr) {
+            add_to_category(*info, *cat);
+        } else if (*info->enabled && info->on_change) {
+            info->on_change(*info);
+        }
+    }
+
+    // Enable/disable a category: one word flip plus a refresh of its member points only.
+    // Returns false if the category table is full.
+    bool set_category_enabled(const char* name, bool state) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Category* cat = category_locked(name);
+        if (!cat) return false;
+        cat->enabled.store(state, std::memory_order_relaxed);
+        for (size_t i = cat->first_point; i != SIZE_MAX; i = trace_points_[i].next_in_category) {
+            refresh_point(trace_points_[i]);
+        }
+        save_config();
+        return true;
+    }
+
+    // List categories with state and member count
+    std::string list_categories() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream oss;
+        for (const auto& cat : categories_) {
+            oss << (cat.enabled.load(std::memory_order_relaxed) ? "[ON]  " : "[OFF] ")
+                << cat.name << " (" << cat.point_count << " points)\n";
+        }
+        return oss.str();
     }
 
-    // Enable/disable a specific trace point (full key match)
+    // Enable/disable a specific trace point (full key match). With an object-filtered or
+    // conditional mode, only points supporting it match.
     bool set_enabled(const char* file, int line, const char* function,
-                     const char* level, const char* message, bool state) {
+                     const char* level, const char* message, bool state, const EnableMode& mode = {}) {
         std::lock_guard<std::mutex> lock(mutex_);
         for (auto& info : trace_points_) {
             if (info.line == line &&
@@ -380,7 +3974,9 @@ public:
                 std::string_view(info.function) == std::string_view(function) &&
                 std::string_view(info.level) == std::string_view(level) &&
                 std::string_view(info.message) == std::string_view(message)) {
-                *info.enabled = state;
+                if (mode.object_filtered && !info.object_filtered) return false;
+                if ((mode.condition || mode.with_stack || mode.under || mode.threads) && !info.control) return false;
+                set_point(info, state, mode);
                 save_config();
                 return true;
             }
@@ -392,7 +3988,7 @@ public:
     bool set_enabled_by_index(size_t index, bool state) {
         std::lock_guard<std::mutex> lock(mutex_);
         if (index < trace_points_.size()) {
-            *trace_points_[index].enabled = state;
+            set_point(trace_points_[index], state);
             save_config();
             return true;
         }
@@ -406,7 +4002,7 @@ public:
         bool changed = false;
         for (auto& info : trace_points_) {
             if (std::string_view(info.level) == level_view) {
-                *info.enabled = state;
+                set_point(info, state);
                 changed = true;
             }
         }
@@ -420,7 +4016,7 @@ public:
         bool changed = false;
         for (auto& info : trace_points_) {
             if (std::string_view(info.file) == file_view) {
-                *info.enabled = state;
+                set_point(info, state);
                 changed = true;
             }
         }
@@ -434,20 +4030,147 @@ public:
         bool changed = false;
         for (auto& info : trace_points_) {
             if (std::string_view(info.function) == func_view) {
-                *info.enabled = state;
+                set_point(info, state);
+                changed = true;
+            }
+        }
+        if (changed) save_config();
+    }
+
+    // Enable the object points of a function in object-filtered mode
+    void set_function_object_filtered(const char* function) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string_view func_view(function);
+        bool changed = false;
+        for (auto& info : trace_points_) {
+            if (info.object_filtered && std::string_view(info.function) == func_view) {
+                set_point(info, true, EnableMode{true, nullptr});
+                changed = true;
+            }
+        }
+        if (changed) save_config();
+    }
+
+    // Enable the ylog points of a function in "with stack" mode
+    void set_function_stack(const char* function) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string_view func_view(function);
+        bool changed = false;
+        for (auto& info : trace_points_) {
+            if (info.control && std::string_view(info.function) == func_view) {
+                set_point(info, true, EnableMode{false, nullptr, true});
+                changed = true;
+            }
+        }
+        if (changed) save_config();
+    }
+
+    // Enable the conditional points of a function, emitting only calls matching expr.
+    // Returns false (and sets error) if expr does not compile.
+    bool set_function_condition(const char* function, const char* expr, std::string* error = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string err;
+        const Predicate* pred = intern_predicate(expr, err);
+        if (!pred) {
+            if (error) *error = err;
+            return false;
+        }
+        std::string_view func_view(function);
+        bool changed = false;
+        for (auto& info : trace_points_) {
+            if (info.control && std::string_view(info.function) == func_view) {
+                set_point(info, true, EnableMode{false, pred});
+                changed = true;
+            }
+        }
+        if (changed) save_config();
+        return true;
+    }
+
+    // Enable the ylog points of a function, emitting only beneath the yfunc()/ytimeit()
+    // scope of function scope (see CallPath). Returns false if all 63 scope bits are taken.
+    bool set_function_under(const char* function, const char* scope) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t bit = CallPath::instance().bit(scope, under_in_use_locked());
+        if (!bit) return false;
+        std::string_view func_view(function);
+        bool changed = false;
+        for (auto& info : trace_points_) {
+            if (info.control && std::string_view(info.function) == func_view) {
+                set_point(info, true, EnableMode{false, nullptr, false, bit});
+                changed = true;
+            }
+        }
+        if (changed) save_config();
+        return true;
+    }
+
+    // Enable the ylog points of a function, emitting only on threads whose name or id
+    // matches thread_glob (see ThreadFilter). Returns false (and sets error) if the
+    // pattern is invalid or all 64 pattern bits are taken.
+    bool set_function_on_thread(const char* function, const char* thread_glob, std::string* error = nullptr) {
+        std::string err;
+        uint64_t bit = ThreadFilter::instance().bit(thread_glob, err);
+        if (!bit) {
+            if (error) *error = err;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string_view func_view(function);
+        bool changed = false;
+        for (auto& info : trace_points_) {
+            if (info.control && std::string_view(info.function) == func_view) {
+                set_point(info, true, EnableMode{false, nullptr, false, 0, bit});
                 changed = true;
             }
         }
         if (changed) save_config();
+        return true;
+    }
+
+    // Enable profiles (see ProfileSet), persisted next to the config file. False for an
+    // invalid or unknown name.
+    bool save_profile(const char* name) {
+        if (!ProfileSet::valid_name(name)) return false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        profiles_.capture(name, trace_points_, categories_);
+        save_profiles();
+        return true;
+    }
+
+    // Switch every point and category to the profile's state at once (see ProfileSet::apply)
+    bool use_profile(const char* name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ProfileSet::Profile* profile = profiles_.find(name);
+        if (!profile) return false;
+        profiles_.apply(*profile, trace_points_, categories_,
+                        [](TracePointInfo& info, bool on) { set_point(info, on); }, refresh_point);
+        save_config();
+        return true;
+    }
+
+    bool delete_profile(const char* name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!profiles_.remove(name)) return false;
+        save_profiles();
+        return true;
+    }
+
+    std::string list_profiles() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return profiles_.list();
     }
 
     // Enable/disable all trace points
     void set_all_enabled(bool state) {
         std::lock_guard<std::mutex> lock(mutex_);
         bool changed = false;
+        for (auto& cat : categories_) {
+            if (cat.enabled.exchange(state, std::memory_order_relaxed) != state) changed = true;
+        }
         for (auto& info : trace_points_) {
-            if (*info.enabled != state) {
-                *info.enabled = state;
+            if (*info.enabled != state || own_state(info) != state) {
+                set_point(info, state);
                 changed = true;
             }
         }
@@ -472,27 +4195,144 @@ public:
             oss << idx++ << " " << (*info.enabled ? "[ON] " : "[OFF]") 
                 << " [" << info.level << "] "
                 << info.file << ":" << info.line 
-                << " (" << info.function << ") \"" << info.message << "\"\n";
+                << " (" << info.function << ") \"" << info.message << "\"";
+            append_point_state(oss, info);
+            oss << "\n";
+        }
+        if (dropped_points_ || dropped_categories_) {
+            oss << "# dropped (capacity reached): " << dropped_points_ << " trace point(s), "
+                << dropped_categories_ << " categor" << (dropped_categories_ == 1 ? "y" : "ies") << "\n";
+        }
+        return oss.str();
+    }
+
+    // Registrations refused because the registry was full (YTRACE_FIXED_CAPACITY builds)
+    uint64_t dropped_points() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dropped_points_;
+    }
+
+    std::string get_socket_path() const { return socket_path_; }
+
+    // Open control socket at a specific path (disables auto-open)
+    // Open control socket at the specified path
+    // Returns false if socket is already open or path is empty
+    bool open_ctrl_socket(const char* path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (control_thread_started_) return false;  // Already open
+        if (!path || path[0] == '\0') return false;
+        socket_path_ = path;
+        control_thread_started_ = true;
+        start_control_thread();
+        return true;
+    }
+
+    // Per-second rate history (see RateHistory); sampled by the control thread
+    void set_history(bool on, size_t seconds = YTRACE_HISTORY_SECONDS) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        history_.configure(on, seconds);
+    }
+
+    void sample_history(int64_t now_sec) {
+        if (!history_.enabled()) return;
+        auto timers = TimerManager::instance().counts();
+        std::lock_guard<std::mutex> lock(mutex_);
+        history_.sample(trace_points_, timers, now_sec);
+    }
+
+    std::string history_dump() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return history_.dump();
+    }
+
+    // ytrace's own footprint: memory resource, buffer budget, drain pool and registry sizes
+    std::string self_report() {
+        std::string report = MemoryBudget::instance().status() + DrainPool::instance().status();
+        std::lock_guard<std::mutex> lock(mutex_);
+        report += "registry: " + std::to_string(trace_points_.size()) + " trace point(s), "
+                + std::to_string(categories_.size()) + " categor" + (categories_.size() == 1 ? "y" : "ies") + ", "
+                + std::to_string(predicates_.size()) + " predicate(s)\n";
+        return report;
+    }
+
+private:
+    // Write a point's flag and notify its owner (caller holds mutex_)
+    // Enabling also selects the object mode of object points and the predicate of
+    // conditional points; disabling drops the predicate
+    // CallPath bits some point is enabled under (the rest may be reassigned)
+    uint64_t under_in_use_locked() const {
+        uint64_t in_use = 0;
+        for (const auto& info : trace_points_) {
+            if (info.control) in_use |= info.control->under.load(std::memory_order_relaxed);
+        }
+        return in_use;
+    }
+
+    static void set_point(TracePointInfo& info, bool state, const EnableMode& mode = {}) {
+        if (info.object_filtered && state) *info.object_filtered = mode.object_filtered;
+        if (info.control) {
+            info.control->predicate.store(state ? mode.condition : nullptr, std::memory_order_release);
+            info.control->under.store(state ? mode.under : 0, std::memory_order_relaxed);
+            info.control->threads.store(state ? mode.threads : 0, std::memory_order_relaxed);
+            info.control->with_stack = state && mode.with_stack;
+        }
+        if (info.category) info.self_enabled = state;
+        else *info.enabled = state;
+        refresh_point(info);
+    }
+
+    // Fold the point's own state and its category into the single flag the macro reads
+    static void refresh_point(TracePointInfo& info) {
+        if (info.category) {
+            *info.enabled = info.self_enabled || info.category->enabled.load(std::memory_order_relaxed);
+        }
+        if (info.on_change) info.on_change(info);
+    }
+
+    // Compile expr, reusing an identical predicate (caller holds mutex_). Predicates are
+    // never freed: a hot path may still be evaluating one that was just replaced.
+    const Predicate* intern_predicate(const std::string& expr, std::string& error) {
+        for (const auto& pred : predicates_) {
+            if (pred.source() == expr) return &pred;
+        }
+        Predicate* pred = detail::try_emplace_back(predicates_);
+        if (!pred) {
+            error = "too many predicates";
+            return nullptr;
+        }
+        if (!pred->compile(expr, error)) {
+            predicates_.pop_back();
+            return nullptr;
         }
-        return oss.str();
+        return pred;
     }
 
-    std::string get_socket_path() const { return socket_path_; }
+    // Link a newly registered point into its category (caller holds mutex_)
+    void add_to_category(TracePointInfo& info, Category& cat) {
+        info.category = &cat;
+        info.next_in_category = std::exchange(cat.first_point, trace_points_.size() - 1);
+        ++cat.point_count;
+        info.self_enabled = *info.enabled;
+        refresh_point(info);
+    }
 
-    // Open control socket at a specific path (disables auto-open)
-    // Open control socket at the specified path
-    // Returns false if socket is already open or path is empty
-    bool open_ctrl_socket(const char* path) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (control_thread_started_) return false;  // Already open
-        if (!path || path[0] == '\0') return false;
-        socket_path_ = path;
-        control_thread_started_ = true;
-        start_control_thread();
-        return true;
+    // Find or create a category (caller holds mutex_); new ones start from saved state.
+    // nullptr if the table is full.
+    Category* category_locked(const char* name) {
+        for (auto& cat : categories_) {
+            if (cat.name == name) return &cat;
+        }
+        Category* cat = detail::try_emplace_back(categories_, name);
+        if (!cat) {
+            ++dropped_categories_;
+            return nullptr;
+        }
+        for (const auto& entry : saved_categories_) {
+            if (cat->name == entry.name) cat->enabled.store(entry.enabled, std::memory_order_relaxed);
+        }
+        return cat;
     }
 
-private:
     TraceManager() : control_thread_started_(false), running_(false), server_fd_(-1) {
         // Auto-detect executable name and path from /proc/self/exe
         auto [exec_name, exec_path] = ConfigPersistence::get_exec_name_and_path();
@@ -502,6 +4342,8 @@ private:
         // Init config file path and load saved config entries
         config_file_ = ConfigPersistence::get_config_file(exec_name_, exec_path_);
         saved_config_ = ConfigPersistence::load_config_entries(config_file_);
+        saved_categories_ = ConfigPersistence::load_category_entries(config_file_);
+        if (!config_file_.empty()) profiles_.load(profiles_file());
 
         // Generate socket path with actual exec info
         generate_socket_path();
@@ -596,7 +4438,7 @@ private:
 #if defined(YTRACE_USE_SPDLOG)
         spdlog::debug("[ytrace] Control socket: {}", socket_path_);
 #else
-        ytrace::detail::trace_handler()("debug", __FILE__, __LINE__, __func__, 
+        detail::output("debug", __FILE__, __LINE__, __func__, 
             (std::string("[ytrace] Control socket: ") + socket_path_).c_str());
 #endif
 #endif
@@ -611,12 +4453,16 @@ private:
             tv.tv_usec = 0;
 
             int ret = select(server_fd_ + 1, &readfds, nullptr, nullptr, &tv);
+            int64_t now_sec = detail::steady_seconds();
+            sample_history(now_sec);
+            MemoryBudget::instance().trim_idle(now_sec);
+            end_closed_stream();
             if (ret <= 0) continue;
 
             int client_fd = static_cast<int>(accept(server_fd_, nullptr, nullptr));
             if (client_fd < 0) continue;
 
-            handle_client(client_fd);
+            if (handle_client(client_fd)) continue;  // handed over to a stream
 #ifdef _WIN32
             closesocket(client_fd);
 #else
@@ -628,7 +4474,8 @@ private:
 #endif
     }
 
-    void handle_client(int client_fd) {
+    // Returns true if the connection was handed over (stream) and must stay open
+    bool handle_client(int client_fd) {
         // Read full command (may be large for batch operations)
         std::string command;
         char buffer[4096];
@@ -643,10 +4490,11 @@ private:
             // Stop at newline (end of command)
             if (command.find('\n') != std::string::npos) break;
         }
-        if (command.empty()) return;
+        if (command.empty()) return false;
 
         // Trim newline
         if (!command.empty() && command.back() == '\n') command.pop_back();
+        if (command == "stream") return start_stream(client_fd);
 
         std::string response = process_command(command.c_str());
 #ifdef _WIN32
@@ -654,6 +4502,59 @@ private:
 #else
         n = static_cast<int>(write(client_fd, response.c_str(), response.size()));
         (void)n;
+#endif
+        return false;
+    }
+
+    // "stream": the connection becomes the sink of a DrainPool with page batches, spliced
+    // to the socket by reference (SpliceSink), until the consumer disconnects. Returns
+    // true if the pool took over client_fd.
+    bool start_stream(int client_fd) {
+#if defined(__linux__)
+        auto reply = [client_fd](std::string_view text) {
+            ssize_t n = send(client_fd, text.data(), text.size(), MSG_NOSIGNAL);
+            (void)n;
+        };
+        auto& pool = DrainPool::instance();
+        if (pool.running()) {
+            reply("ERROR: Drain pool already running; stop it to stream\n");
+            return false;
+        }
+        reply("OK: Streaming\n");
+        SpliceSink sink(client_fd, true);
+        DrainOptions options;
+        options.page_batches = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stream_ = sink;
+        }
+        if (!pool.start(options, sink)) {  // started by the application meanwhile
+            std::lock_guard<std::mutex> lock(mutex_);
+            stream_.reset();                // the last copy of the sink closes client_fd
+        }
+        return true;
+#else
+        const char* text = "ERROR: Streaming requires Linux\n";
+#ifdef _WIN32
+        send(client_fd, text, static_cast<int>(std::strlen(text)), 0);
+#else
+        ssize_t n = write(client_fd, text, std::strlen(text));
+        (void)n;
+#endif
+        return false;
+#endif
+    }
+
+    // Stop the drain pool of a stream whose consumer went away (control thread, each second)
+    void end_closed_stream() {
+#if defined(__linux__)
+        std::optional<SpliceSink> stream;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!stream_ || !stream_->poll_hangup()) return;
+            stream.swap(stream_);
+        }
+        DrainPool::instance().stop();
 #endif
     }
 
@@ -674,14 +4575,87 @@ private:
         else if (command.rfind("enable ", 0) == 0 || command.rfind("e ", 0) == 0) {
             return process_batch_command(command, true);
         }
+        else if (command.rfind("enable-filtered ", 0) == 0) {
+            return process_batch_command(command, true, EnableMode{true, nullptr});
+        }
+        else if (command.rfind("enable-when ", 0) == 0 || command.rfind("enable-stack ", 0) == 0 ||
+                 command.rfind("enable-stack-when ", 0) == 0) {
+            return process_batch_command(command, true);
+        }
+        else if (command == "stacks" || command.rfind("stacks ", 0) == 0) {
+            return list_stacks(command);
+        }
+        else if (command == "maps") {
+            std::ostringstream oss;
+            for (const auto& m : detail::loaded_modules()) {
+                oss << "map " << std::hex << m.start << " " << m.end << " " << m.base << std::dec << " "
+                    << (m.build_id.empty() ? "-" : m.build_id) << " " << m.path << "\n";
+            }
+            return oss.str();
+        }
+        else if (command == "objects") {
+            std::ostringstream oss;
+            for (uintptr_t key : ObjectFilter::instance().keys()) {
+                oss << "0x" << std::hex << key << "\n";
+            }
+            std::string keys = oss.str();
+            return keys.empty() ? "No object keys set.\n" : keys;
+        }
+        else if (command.rfind("object-add ", 0) == 0 || command.rfind("object-remove ", 0) == 0) {
+            bool add = command.rfind("object-add ", 0) == 0;
+            std::string arg = command.substr(command.find(' ') + 1);
+            uintptr_t key = 0;
+            try {
+                key = static_cast<uintptr_t>(std::stoull(arg, nullptr, 0));
+            } catch (...) {
+                return "ERROR: Invalid object key: " + arg + "\n";
+            }
+            bool ok = add ? ObjectFilter::instance().add(key) : ObjectFilter::instance().remove(key);
+            if (add && !ok) return "ERROR: Object filter full or key is 0\n";
+            return std::string("OK: ") + (add ? "Added" : (ok ? "Removed" : "Not present:")) + " object " + arg + "\n";
+        }
+        else if (command == "object-clear") {
+            ObjectFilter::instance().clear();
+            return "OK: Object filter cleared\n";
+        }
         else if (command.rfind("disable ", 0) == 0 || command.rfind("d ", 0) == 0) {
             return process_batch_command(command, false);
         }
+        else if (command == "categories" || command == "c") {
+            auto s = list_categories();
+            if (s.empty()) return "No categories registered.\n";
+            return s;
+        }
+        else if (command.rfind("enable-category ", 0) == 0 || command.rfind("disable-category ", 0) == 0) {
+            bool enable = command[0] == 'e';
+            std::string name = command.substr(command.find(' ') + 1);
+            if (!set_category_enabled(name.c_str(), enable)) return "ERROR: Category table full\n";
+            return std::string("OK: ") + (enable ? "Enabled" : "Disabled") + " category " + name + "\n";
+        }
         else if (command == "timers" || command == "t") {
             auto s = TimerManager::instance().summary();
             if (s.empty()) return "No timer data recorded.\n";
             return "Timer summary:\n" + s;
         }
+        else if (command == "exceptions" || command == "x") {
+            if (ExceptionTable::instance().size() == 0) return "No exceptions recorded.\n";
+            return ExceptionTable::instance().report();
+        }
+        else if (command == "tail" || command.rfind("tail ", 0) == 0) {
+            return process_tail_command(command);
+        }
+        else if (command == "history-dump") {
+            return history_dump();
+        }
+        else if (command == "history" || command.rfind("history ", 0) == 0) {
+            return process_history_command(command);
+        }
+        else if (command == "self" || command.rfind("self ", 0) == 0) {
+            return process_self_command(command);
+        }
+        else if (command == "profile" || command.rfind("profile ", 0) == 0) {
+            return process_profile_command(command);
+        }
         else if (command == "help" || command == "h" || command == "?") {
             return "Commands:\n"
                    "  list (l)           - List all trace points\n"
@@ -689,13 +4663,177 @@ private:
                    "  disable all (da)   - Disable all trace points\n"
                    "  enable <specs>     - Enable trace points (file:line:func:level:msg ...)\n"
                    "  disable <specs>    - Disable trace points (file:line:func:level:msg ...)\n"
+                   "  enable-filtered <specs> - Enable object points, only for keys in the object filter\n"
+                   "  enable-when <expr> <specs> - Enable points, emitting only calls matching expr (URL-encoded)\n"
+                   "  enable-stack[-when <expr>] <specs> - Enable points, capturing the call stack\n"
+                   "  enable... under=<func> <specs> - Emit only beneath func's yfunc/ytimeit scope\n"
+                   "  enable... thread=<glob> <specs> - Emit only on threads whose name or id matches\n"
+                   "  stacks [id...]     - Dump captured stacks (pc, address in module, module)\n"
+                   "  maps               - Executable segments: start end base build-id path\n"
+                   "  objects            - List object filter keys\n"
+                   "  object-add <key>   - Add an object key (0x... or decimal)\n"
+                   "  object-remove <key> - Remove an object key\n"
+                   "  object-clear       - Remove all object keys\n"
+                   "  categories (c)     - List categories\n"
+                   "  enable-category <name>  - Enable all points of a category\n"
+                   "  disable-category <name> - Disable a category (points keep their own state)\n"
                    "  timers (t)         - Show timer statistics\n"
+                   "  exceptions (x)     - Throw counts per site and type (ytrace::exceptions)\n"
+                   "  tail [on|off] [latency_ms=N] [one_in=N] [errors=0|1]\n"
+                   "                     - Show/configure tail-based request sampling\n"
+                   "  history [on|off] [seconds=N] - Show/configure per-second rate history\n"
+                   "  history-dump       - Per-second counts: point <index> <csv>, timer <csv> <label>\n"
+                   "  self [budget=SIZE] [thp=on|off] - Show/configure ytrace's own memory use\n"
+                   "  profile [save|use|delete <name>] - List enable profiles, or save/switch/delete one\n"
+                   "  stream             - Stream trace records on this connection until it is closed\n"
                    "  help (h, ?)        - Show this help\n";
         }
         
         return "ERROR: Unknown command. Type 'help' for usage.\n";
     }
 
+    // "stacks [id...]": one "#id" line per stack, then "  pc address module" per frame.
+    // address is pc within the module's ELF file; symbolization is left to ytrace-ctl.
+    std::string list_stacks(const std::string& command) {
+        std::vector<LoadedModule> modules = detail::loaded_modules();
+        auto& table = StackTable::instance();
+        std::vector<uint32_t> ids;
+        std::istringstream iss(command.substr(std::min(command.size(), sizeof("stacks") - 1)));
+        std::string word;
+        while (iss >> word) {
+            try {
+                ids.push_back(static_cast<uint32_t>(std::stoul(word.substr(word[0] == '#'))));
+            } catch (...) {
+                return "ERROR: Invalid stack id: " + word + "\n";
+            }
+        }
+        if (ids.empty()) {
+            for (uint32_t id = 1; id <= StackTable::capacity(); ++id) {
+                if (table.get(id)) ids.push_back(id);
+            }
+        }
+
+        std::ostringstream oss;
+        oss << "# " << table.size() << " stack(s), " << table.dropped() << " dropped\n";
+        for (uint32_t id : ids) {
+            const StackTable::Stack* stack = table.get(id);
+            if (!stack) continue;
+            oss << "#" << id << "\n";
+            for (uint32_t i = 0; i < stack->depth; ++i) {
+                auto pc = reinterpret_cast<uintptr_t>(stack->frames[i]);
+                oss << "  0x" << std::hex << pc;
+                for (const auto& m : modules) {
+                    if (pc >= m.start && pc < m.end) {
+                        oss << " 0x" << (pc - m.base) << " " << m.path;
+                        break;
+                    }
+                }
+                oss << std::dec << "\n";
+            }
+        }
+        return oss.str();
+    }
+
+    // "tail" shows status; "tail on|off [latency_ms=N] [one_in=N] [errors=0|1]" reconfigures
+    std::string process_tail_command(const std::string& command) {
+        auto& tail = TailSampler::instance();
+        std::istringstream iss(command);
+        std::string word;
+        iss >> word;  // skip "tail"
+
+        bool enabled = tail.enabled();
+        TailPolicy policy = tail.policy();
+        bool changed = false;
+        while (iss >> word) {
+            size_t eq = word.find('=');
+            std::string key = word.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : word.substr(eq + 1);
+            try {
+                if (key == "on") enabled = true;
+                else if (key == "off") enabled = false;
+                else if (key == "latency_ms") policy.latency_threshold_ns = std::stod(value) * 1e6;
+                else if (key == "one_in") policy.one_in = static_cast<uint32_t>(std::stoul(value));
+                else if (key == "errors") policy.keep_on_error = value != "0";
+                else return "ERROR: Unknown tail option: " + word + "\n";
+            } catch (...) {
+                return "ERROR: Invalid value: " + word + "\n";
+            }
+            changed = true;
+        }
+        if (changed) tail.configure(enabled, policy);
+        return tail.status();
+    }
+
+    // "history" shows status; "history on|off [seconds=N]" reconfigures
+    std::string process_history_command(const std::string& command) {
+        std::istringstream iss(command);
+        std::string word;
+        iss >> word;  // skip "history"
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool enabled = history_.enabled();
+        size_t seconds = history_.seconds();
+        bool changed = false;
+        while (iss >> word) {
+            try {
+                if (word == "on") enabled = true;
+                else if (word == "off") enabled = false;
+                else if (word.rfind("seconds=", 0) == 0) seconds = std::stoul(word.substr(sizeof("seconds=") - 1));
+                else return "ERROR: Unknown history option: " + word + "\n";
+            } catch (...) {
+                return "ERROR: Invalid value: " + word + "\n";
+            }
+            changed = true;
+        }
+        if (changed) history_.configure(enabled, seconds);
+        return history_.status();
+    }
+
+    // "self" reports memory use; "self budget=64M thp=on" reconfigures the buffer budget first
+    std::string process_self_command(const std::string& command) {
+        std::istringstream iss(command);
+        std::string word;
+        iss >> word;  // skip "self"
+
+        auto& budget = MemoryBudget::instance();
+        while (iss >> word) {
+            size_t bytes = 0;
+            if (word.rfind("budget=", 0) == 0) {
+                if (!MemoryBudget::parse_size(std::string_view(word).substr(sizeof("budget=") - 1), bytes))
+                    return "ERROR: Invalid size: " + word + "\n";
+                budget.set_limit(bytes);
+            }
+            else if (word == "thp=on" || word == "thp=off") budget.set_huge_pages(word == "thp=on");
+            else return "ERROR: Unknown self option: " + word + "\n";
+        }
+        return self_report();
+    }
+
+    // "profile" lists profiles; "profile save|use|delete <name>" manages one
+    std::string process_profile_command(const std::string& command) {
+        std::istringstream iss(command);
+        std::string word, action, name;
+        iss >> word >> action >> name;  // skip "profile"
+        if (action.empty()) {
+            std::string list = list_profiles();
+            return list.empty() ? "No profiles saved.\n" : list;
+        }
+        if (name.empty() || !ProfileSet::valid_name(name)) return "ERROR: Usage: profile save|use|delete <name>\n";
+        if (action == "save") {
+            save_profile(name.c_str());
+            return "OK: Saved profile " + name + "\n";
+        }
+        if (action == "use") {
+            if (!use_profile(name.c_str())) return "ERROR: No profile named " + name + "\n";
+            return "OK: Switched to profile " + name + "\n";
+        }
+        if (action == "delete") {
+            if (!delete_profile(name.c_str())) return "ERROR: No profile named " + name + "\n";
+            return "OK: Deleted profile " + name + "\n";
+        }
+        return "ERROR: Unknown profile action: " + action + "\n";
+    }
+
     // URL-decode a string (for message field which may contain encoded chars)
     static std::string url_decode(const std::string& str) {
         std::string result;
@@ -715,14 +4853,39 @@ private:
     }
 
     // Process batch enable/disable: "enable file:line:func:level:msg file:line:func:level:msg ..."
-    std::string process_batch_command(const std::string& command, bool enable) {
+    std::string process_batch_command(const std::string& command, bool enable, EnableMode mode = {}) {
         std::istringstream iss(command);
         std::string verb;
         iss >> verb; // skip "enable" or "disable"
+        if (verb.rfind("enable-stack", 0) == 0) mode.with_stack = true;
+        if (verb == "enable-when" || verb == "enable-stack-when") {
+            // enable[-stack]-when <url-encoded predicate> <specs>
+            std::string expr, error;
+            iss >> expr;
+            std::lock_guard<std::mutex> lock(mutex_);
+            mode.condition = intern_predicate(url_decode(expr), error);
+            if (!mode.condition) return "ERROR: Bad predicate: " + error + "\n";
+        }
         
         int count = 0;
         std::string spec;
         while (iss >> spec) {
+            if (spec.rfind("under=", 0) == 0) {
+                // under=FUNC before the specs: emit only beneath FUNC's yfunc()/ytimeit() scope
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    mode.under = CallPath::instance().bit(spec.substr(6), under_in_use_locked());
+                }
+                if (!mode.under) return "ERROR: Too many call-path scopes (max 64)\n";
+                continue;
+            }
+            if (spec.rfind("thread=", 0) == 0) {
+                // thread=GLOB (URL-encoded) before the specs: emit only on matching threads
+                std::string error;
+                mode.threads = ThreadFilter::instance().bit(url_decode(spec.substr(7)), error);
+                if (!mode.threads) return "ERROR: Bad thread pattern: " + error + "\n";
+                continue;
+            }
             // Parse file:line:function:level:message (message is URL-encoded)
             // Find last 4 colons from right
             size_t pos_msg = spec.rfind(':');
@@ -749,7 +4912,7 @@ private:
                 line = std::stoi(rest.substr(pos_line + 1));
             } catch (...) { continue; }
             
-            if (set_enabled(file.c_str(), line, function.c_str(), level.c_str(), message.c_str(), enable)) {
+            if (set_enabled(file.c_str(), line, function.c_str(), level.c_str(), message.c_str(), enable, mode)) {
                 ++count;
             }
         }
@@ -760,12 +4923,22 @@ private:
     }
 
     std::mutex mutex_;
-    std::vector<TracePointInfo> trace_points_;
-    std::vector<ConfigPersistence::ConfigEntry> saved_config_;  // Loaded at startup
+    detail::PointList trace_points_{&memory_resource()};
+    detail::CategoryList categories_{&memory_resource()};
+    detail::PredicateList predicates_{&memory_resource()};
+    ProfileSet profiles_;
+    uint64_t dropped_points_ = 0;       // registrations beyond the registry capacity
+    uint64_t dropped_categories_ = 0;
+    RateHistory history_;
+    std::pmr::vector<ConfigPersistence::ConfigEntry> saved_config_{&memory_resource()};  // Loaded at startup
+    std::pmr::vector<ConfigPersistence::CategoryEntry> saved_categories_{&memory_resource()};  // Loaded at startup
     bool control_thread_started_;
     std::atomic<bool> running_;
     std::thread control_thread_;
     int server_fd_;
+#if defined(__linux__)
+    std::optional<SpliceSink> stream_;  // sink of a "stream" connection
+#endif
     std::string socket_path_;
     std::string config_file_;
     std::string exec_name_;
@@ -774,11 +4947,20 @@ private:
     void save_config() {
 #ifndef _WIN32
         if (!config_file_.empty()) {
-            ConfigPersistence::save_state(config_file_, trace_points_);
+            ConfigPersistence::save_state(config_file_, trace_points_, categories_);
         }
 #endif
     }
 
+    // Profiles live next to the config: <name>-<hash>.profiles
+    std::string profiles_file() const {
+        return config_file_.substr(0, config_file_.rfind('.')) + ".profiles";
+    }
+
+    void save_profiles() {
+        if (!config_file_.empty()) profiles_.save(profiles_file());
+    }
+
 public:
 };
 #endif // !YTRACE_NO_CONTROL_SOCKET
@@ -796,12 +4978,57 @@ namespace detail {
 
     // Helper to register and return initial value (from saved config or default)
     inline bool register_trace_point(bool* enabled, const char* file, int line, const char* function,
-                                     const char* level, const char* message) {
+                                     const char* level, const char* message,
+                                     void (*on_change)(const TracePointInfo&) = nullptr, void* context = nullptr) {
         *enabled = get_default_enabled();
-        TraceManager::instance().register_trace_point(enabled, file, line, function, level, message);
+        TraceManager::instance().register_trace_point(enabled, file, line, function, level, message, on_change, context);
         return *enabled;  // return the value (possibly modified by saved config)
     }
 
+    // Register a point that belongs to a category and accepts predicates (ylog_cat)
+    inline bool register_category_trace_point(bool* enabled, PointControl* control, const char* category,
+                                              const char* file, int line, const char* function,
+                                              const char* level, const char* message) {
+        *enabled = get_default_enabled();
+        TracePointInfo info{enabled, file, line, function, level, message};
+        info.control = control;
+        TraceManager::instance().register_trace_point(info, category);
+        return *enabled;
+    }
+
+    // Register a point that accepts predicates (ylog)
+    inline bool register_trace_point(bool* enabled, PointControl* control, const char* file, int line,
+                                     const char* function, const char* level, const char* message) {
+        *enabled = get_default_enabled();
+        TracePointInfo info{enabled, file, line, function, level, message};
+        info.control = control;
+        TraceManager::instance().register_trace_point(info);
+        return *enabled;
+    }
+
+    // Register a point that supports per-object filtering (ylog_obj, yfunc_obj), and
+    // predicates if it has a control (ylog_obj)
+    inline bool register_object_trace_point(bool* enabled, bool* object_filtered, const char* file, int line,
+                                            const char* function, const char* level, const char* message,
+                                            PointControl* control = nullptr) {
+        *enabled = get_default_enabled();
+        TracePointInfo info{enabled, file, line, function, level, message};
+        info.object_filtered = object_filtered;
+        info.control = control;
+        TraceManager::instance().register_trace_point(info);
+        return *enabled;
+    }
+
+    // Register a point whose emits are thinned by an AdaptiveSampler
+    inline bool register_sampled_trace_point(bool* enabled, AdaptiveSampler* sampler, const char* file, int line,
+                                             const char* function, const char* level, const char* message) {
+        *enabled = get_default_enabled();
+        TracePointInfo info{enabled, file, line, function, level, message};
+        info.sampler = sampler;
+        TraceManager::instance().register_trace_point(info);
+        return *enabled;
+    }
+
     inline bool register_trace_point_enabled(bool* enabled, const char* file, int line, const char* function,
                                              const char* level, const char* message) {
         *enabled = get_default_enabled();
@@ -810,21 +5037,6 @@ namespace detail {
     }
 }
 
-// Default output handler (now includes level)
-inline void default_trace_handler(const char* level, const char* file, int line, const char* function, const char* msg) {
-    std::fprintf(stderr, "[%s] %s:%d (%s): %s\n", level, file, line, function, msg);
-}
-
-// Configurable trace output
-inline std::function<void(const char*, const char*, int, const char*, const char*)>& trace_handler() {
-    static std::function<void(const char*, const char*, int, const char*, const char*)> handler = default_trace_handler;
-    return handler;
-}
-
-inline void set_trace_handler(std::function<void(const char*, const char*, int, const char*, const char*)> handler) {
-    trace_handler() = std::move(handler);
-}
-
 namespace detail {
 #if defined(YTRACE_USE_SPDLOG)
     inline spdlog::level::level_enum to_spdlog_level(const char* level) {
@@ -833,8 +5045,31 @@ namespace detail {
         else if (lv == "debug" || lv == "func-entry" || lv == "func-exit") return spdlog::level::debug;
         else if (lv == "info") return spdlog::level::info;
         else if (lv == "warn") return spdlog::level::warn;
+        else if (lv == "error") return spdlog::level::err;
         return spdlog::level::debug;
     }
+
+    inline const char* from_spdlog_level(spdlog::level::level_enum level) {
+        switch (level) {
+            case spdlog::level::trace: return "trace";
+            case spdlog::level::info: return "info";
+            case spdlog::level::warn: return "warn";
+            case spdlog::level::err: return "error";
+            case spdlog::level::critical: return "critical";
+            default: return "debug";
+        }
+    }
+
+    // While the DrainPool runs (drain, ytrace-ctl stream), records of the spdlog macros go
+    // through emit() like all other records, so the pool's sink sees them. During a profile
+    // switch they are held like the others.
+    inline bool spdlog_diverted() { return route().load(std::memory_order_relaxed) != 0; }
+
+    // A formatted spdlog-macro record: to the pool while it runs, else to spdlog
+    inline void spdlog_record(const spdlog::source_loc& loc, spdlog::level::level_enum level, const std::string& msg) {
+        if (settled_route() & kRouteDrain) emit(from_spdlog_level(level), loc.filename, loc.line, loc.funcname, msg.c_str());
+        else spdlog::log(loc, level, "{}", msg);
+    }
 #endif
     
     template<typename... Args>
@@ -845,7 +5080,67 @@ namespace detail {
         } else {
             std::snprintf(buffer, sizeof(buffer), fmt, std::forward<Args>(args)...);
         }
-        trace_handler()(level, file, line, function, buffer);
+        emit(level, file, line, function, buffer);
+    }
+
+    // trace_impl() with the StackTable id of the caller's stack appended. Never inlined, so
+    // exactly one frame (this one) is skipped before the traced function's frame.
+    template<typename... Args>
+    YTRACE_NOINLINE void trace_with_stack(const char* level, const char* file, int line, const char* function,
+                                          const char* fmt, Args&&... args) {
+        uint32_t stack_id = StackTable::instance().capture(1);
+        char buffer[1024];
+        int n;
+        if constexpr (sizeof...(args) == 0) {
+            n = std::snprintf(buffer, sizeof(buffer), "%s", fmt);
+        } else {
+            n = std::snprintf(buffer, sizeof(buffer), fmt, std::forward<Args>(args)...);
+        }
+        n = std::clamp(n, 0, static_cast<int>(sizeof(buffer)) - 1);
+        std::snprintf(buffer + n, sizeof(buffer) - n, " [stack #%u]", stack_id);
+        emit(level, file, line, function, buffer);
+    }
+
+    // trace_impl() for ylog points: nothing is formatted unless the predicate matches; in
+    // "with stack" mode the record carries the id of the call stack ([stack #N])
+    template<typename... Args>
+    YTRACE_ALWAYS_INLINE void trace_if(const PointControl& ctl, const char* level, const char* file, int line,
+                                       const char* function, const char* fmt, Args&&... args) {
+        if (!condition_passes(ctl, args...)) return;
+        note_hit(ctl);
+        if (ctl.with_stack) {
+            trace_with_stack(level, file, line, function, fmt, std::forward<Args>(args)...);
+        } else {
+            trace_impl(level, file, line, function, fmt, std::forward<Args>(args)...);
+        }
+    }
+}
+
+namespace detail {
+    // Object-filter check for an enabled object point: free unless the point is filtered
+    inline bool object_passes(bool object_filtered, uintptr_t key) {
+        return !object_filtered || ObjectFilter::instance().contains(key);
+    }
+
+    // trace_if() for object points: the message is prefixed with the object key
+    template<typename... Args>
+    void trace_obj_if(const PointControl& ctl, uintptr_t key, const char* level, const char* file, int line,
+                      const char* function, const char* fmt, Args&&... args) {
+        if (!condition_passes(ctl, args...)) return;
+        note_hit(ctl);
+        char buffer[1024];
+        int n = std::snprintf(buffer, sizeof(buffer), "[obj 0x%" PRIxPTR "] ", key);
+        int m;
+        if constexpr (sizeof...(args) == 0) {
+            m = std::snprintf(buffer + n, sizeof(buffer) - n, "%s", fmt);
+        } else {
+            m = std::snprintf(buffer + n, sizeof(buffer) - n, fmt, std::forward<Args>(args)...);
+        }
+        if (ctl.with_stack) {
+            n = std::min(n + std::max(m, 0), static_cast<int>(sizeof(buffer)) - 1);
+            std::snprintf(buffer + n, sizeof(buffer) - n, " [stack #%u]", StackTable::instance().capture(1));
+        }
+        emit(level, file, line, function, buffer);
     }
 }
 
@@ -854,12 +5149,12 @@ class ScopeTracer {
 public:
     ScopeTracer(bool* exit_enabled, const char* file, int line, const char* function)
         : exit_enabled_(exit_enabled), file_(file), line_(line), function_(function) {
-        trace_handler()("func-entry", file_, line_, function_, "");
+        detail::emit("func-entry", file_, line_, function_, "");
     }
     
     ~ScopeTracer() {
         if (*exit_enabled_) {
-            trace_handler()("func-exit", file_, line_, function_, "");
+            detail::emit("func-exit", file_, line_, function_, "");
         }
     }
     
@@ -873,12 +5168,12 @@ private:
 // RAII scope timer for measuring elapsed time
 class ScopeTimer {
 public:
-    ScopeTimer(const char* label, const char* file, int line, const char* function)
-        : label_(label), file_(file), line_(line), function_(function),
-          start_(std::chrono::steady_clock::now()) {
+    ScopeTimer(const char* label, const char* file, int line, const char* function, uint32_t one_in = 1)
+        : label_(label), file_(file), line_(line), function_(function), one_in_(one_in) {
         char buf[256];
         std::snprintf(buf, sizeof(buf), "%s started", label_);
-        trace_handler()("timer-entry", file_, line_, function_, buf);
+        detail::emit("timer-entry", file_, line_, function_, buf);
+        start_ = std::chrono::steady_clock::now();  // after the entry record: it is not part of the scope
     }
 
     ~ScopeTimer() {
@@ -888,11 +5183,12 @@ public:
         std::string dur = format_duration(elapsed_ns);
         char buf[256];
         std::snprintf(buf, sizeof(buf), "%s elapsed: %s", label_, dur.c_str());
-        trace_handler()("timer-exit", file_, line_, function_, buf);
+        detail::emit("timer-exit", file_, line_, function_, buf);
 
-        // Build key: file:line:function or just label
-        std::string key = std::string(file_) + ":" + std::to_string(line_) + " " + label_;
-        TimerManager::instance().record(key, elapsed_ns);
+        // Build key: file:line label
+        char key[256];
+        std::snprintf(key, sizeof(key), "%s:%d %s", file_, line_, label_);
+        TimerManager::instance().record_measured(key, elapsed_ns, one_in_);
     }
 
 private:
@@ -900,6 +5196,54 @@ private:
     const char* file_;
     int line_;
     const char* function_;
+    uint32_t one_in_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+namespace detail {
+    // Per-thread, per-site countdown of ytimeit_every(): pseudo-random gaps averaging n,
+    // so periodic patterns in the loop are not sampled in lockstep
+    struct SampleCountdown {
+        uint32_t left = 0;
+        uint32_t rng = 0;
+
+        bool next(uint32_t n) {
+            if (left > 1) { --left; return false; }
+            if (rng == 0) rng = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(this) >> 4) | 1;
+            rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;   // xorshift32
+            left = n > 1 ? 1 + rng % (2 * n - 1) : 1;
+            return true;
+        }
+    };
+}
+
+// Per-thread, per-site state of ytimeit_batch(): one clock read every n executions; the
+// time between two reads, divided by n, is recorded as one sample. It measures whole
+// iterations of the enclosing loop, and a batch spanning a pause outside the loop
+// includes the pause.
+class BatchTimer {
+public:
+    void tick(uint32_t n, const char* label, const char* file, int line, const char* function) {
+        if (++seen_ < n) return;
+        seen_ = 0;
+        auto now = std::chrono::steady_clock::now();
+        if (started_) {
+            double avg_ns = static_cast<double>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - start_).count()) / n;
+            char key[256];
+            std::snprintf(key, sizeof(key), "%s:%d %s", file, line, label);
+            TimerManager::instance().record_measured(key, avg_ns, 1, n);
+            char buf[256];
+            std::snprintf(buf, sizeof(buf), "%s batch of %u: avg %s", label, n, format_duration(avg_ns).c_str());
+            detail::emit("timer-exit", file, line, function, buf);
+        }
+        start_ = now;
+        started_ = true;
+    }
+
+private:
+    uint32_t seen_ = 0;
+    bool started_ = false;
     std::chrono::steady_clock::time_point start_;
 };
 
@@ -908,13 +5252,22 @@ private:
 // ConfigPersistence implementation (after TracePointInfo is defined)
 #if !defined(YTRACE_NO_CONTROL_SOCKET)
 namespace ytrace {
-    inline void ConfigPersistence::save_state(const std::string& config_file, const std::vector<TracePointInfo>& points) {
+    inline void ConfigPersistence::save_state(const std::string& config_file, const detail::PointList& points,
+                                              const detail::CategoryList& categories) {
 #ifndef _WIN32
         std::ofstream file(config_file);
         if (!file) return;
-        
+
+        for (const auto& cat : categories) {
+            file << "category " << cat.name << " " << (cat.enabled.load() ? "1" : "0") << "\n";
+        }
         for (const auto& info : points) {
-            bool enabled = *info.enabled;
+            // Object keys, predicates, call paths and thread filters do not survive a
+            // restart, so points enabled with them are saved off
+            bool enabled = own_state(info) && !(info.object_filtered && *info.object_filtered) &&
+                           !(info.control && (info.control->predicate.load(std::memory_order_relaxed) ||
+                                              info.control->under.load(std::memory_order_relaxed) ||
+                                              info.control->threads.load(std::memory_order_relaxed)));
             file << (enabled ? "1" : "0") << " "
                  << info.file << " "
                  << info.line << " "
@@ -925,8 +5278,9 @@ namespace ytrace {
 #endif
     }
     
-    inline std::vector<ConfigPersistence::ConfigEntry> ConfigPersistence::load_config_entries(const std::string& config_file) {
-        std::vector<ConfigEntry> entries;
+    inline std::pmr::vector<ConfigPersistence::ConfigEntry> ConfigPersistence::load_config_entries(const std::string& config_file) {
+        std::pmr::memory_resource* mr = &memory_resource();
+        std::pmr::vector<ConfigEntry> entries(mr);
 #ifndef _WIN32
         std::ifstream file(config_file);
         if (!file) return entries;
@@ -954,11 +5308,11 @@ namespace ytrace {
 
                 entries.push_back(ConfigEntry{
                     enabled_int != 0,
-                    file_path,
+                    std::pmr::string(file_path, mr),
                     line_num,
-                    func,
-                    level,
-                    msg
+                    std::pmr::string(func, mr),
+                    std::pmr::string(level, mr),
+                    std::pmr::string(msg, mr)
                 });
             }
         }
@@ -966,7 +5320,27 @@ namespace ytrace {
         return entries;
     }
 
-    inline bool ConfigPersistence::apply_saved_state(const std::vector<ConfigEntry>& entries, TracePointInfo& point) {
+    inline std::pmr::vector<ConfigPersistence::CategoryEntry> ConfigPersistence::load_category_entries(const std::string& config_file) {
+        std::pmr::vector<CategoryEntry> entries(&memory_resource());
+#ifndef _WIN32
+        std::ifstream file(config_file);
+        if (!file) return entries;
+
+        std::string line;
+        while (std::getline(file, line)) {
+            // Parse: "category name 0/1" (point lines start with 0/1 and are skipped)
+            std::istringstream iss(line);
+            std::string tag, name;
+            int enabled_int = 0;
+            if (iss >> tag >> name >> enabled_int && tag == "category") {
+                entries.push_back(CategoryEntry{std::pmr::string(name, &memory_resource()), enabled_int != 0});
+            }
+        }
+#endif
+        return entries;
+    }
+
+    inline bool ConfigPersistence::apply_saved_state(const std::pmr::vector<ConfigEntry>& entries, TracePointInfo& point) {
         for (const auto& entry : entries) {
             if (entry.file == point.file &&
                 entry.line == point.line &&
@@ -1025,21 +5399,56 @@ namespace ytrace {
 #endif
 
 // Macros with compile-time format strings for spdlog
+//
+// ylog() and the level macros are conditional points: ytrace-ctl enable --when 'arg0 > 1000'
+// installs a Predicate over the arguments, evaluated before anything is formatted.
+#if defined(YTRACE_USE_SPDLOG)
+// spdlog::log() behind the point's predicate and stack mode, or the drain pool while it
+// runs (spdlog_record()); the arguments are evaluated once
+#define YTRACE_DETAIL_SPDLOG_IF(cond, spdlvl, fmt, ...) \
+    [](const char* _ytrace_func_, spdlog::level::level_enum _ytrace_lvl_ __VA_OPT__(, auto&&... _ytrace_args_)) { \
+        if (!ytrace::detail::condition_passes(cond __VA_OPT__(, _ytrace_args_...))) return; \
+        ytrace::detail::note_hit(cond); \
+        spdlog::source_loc _ytrace_loc_{__FILE__, __LINE__, _ytrace_func_}; \
+        if (!cond.with_stack && !ytrace::detail::spdlog_diverted()) { \
+            spdlog::log(_ytrace_loc_, _ytrace_lvl_, fmt __VA_OPT__(, _ytrace_args_...)); \
+            return; \
+        } \
+        std::string _ytrace_msg_ = spdlog::fmt_lib::format(fmt __VA_OPT__(, _ytrace_args_...)); \
+        if (cond.with_stack) _ytrace_msg_ += spdlog::fmt_lib::format(" [stack #{}]", ytrace::StackTable::instance().capture()); \
+        ytrace::detail::spdlog_record(_ytrace_loc_, _ytrace_lvl_, _ytrace_msg_); \
+    }(__func__, spdlvl __VA_OPT__(,) __VA_ARGS__)
+
+// The same for object points: the message is prefixed with the object key
+#define YTRACE_DETAIL_SPDLOG_OBJ_IF(cond, key, spdlvl, fmt, ...) \
+    [](const char* _ytrace_func_, uintptr_t _ytrace_key_, spdlog::level::level_enum _ytrace_lvl_ __VA_OPT__(, auto&&... _ytrace_args_)) { \
+        if (!ytrace::detail::condition_passes(cond __VA_OPT__(, _ytrace_args_...))) return; \
+        ytrace::detail::note_hit(cond); \
+        std::string _ytrace_msg_ = spdlog::fmt_lib::format("[obj {:#x}] ", _ytrace_key_) + \
+                                   spdlog::fmt_lib::format(fmt __VA_OPT__(, _ytrace_args_...)); \
+        if (cond.with_stack) _ytrace_msg_ += spdlog::fmt_lib::format(" [stack #{}]", ytrace::StackTable::instance().capture()); \
+        ytrace::detail::spdlog_record(spdlog::source_loc{__FILE__, __LINE__, _ytrace_func_}, _ytrace_lvl_, _ytrace_msg_); \
+    }(__func__, key, spdlvl __VA_OPT__(,) __VA_ARGS__)
+#endif
 #if YTRACE_ENABLE_YLOG
 #if defined(YTRACE_USE_SPDLOG)
 #define ylog(lvl, fmt, ...) \
     do { \
-        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, __FILE__, __LINE__, __func__, lvl, fmt); \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, &_ytrace_ctl_, __FILE__, __LINE__, __func__, lvl, fmt); \
+        ytrace::detail::note_level(lvl); \
         if (_ytrace_enabled_) { \
-            spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __func__}, ytrace::detail::to_spdlog_level(lvl), fmt __VA_OPT__(,) __VA_ARGS__); \
+            YTRACE_DETAIL_SPDLOG_IF(_ytrace_ctl_, ytrace::detail::to_spdlog_level(lvl), fmt __VA_OPT__(,) __VA_ARGS__); \
         } \
     } while(0)
 #else
 #define ylog(lvl, fmt, ...) \
     do { \
-        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, __FILE__, __LINE__, __func__, lvl, fmt); \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, &_ytrace_ctl_, __FILE__, __LINE__, __func__, lvl, fmt); \
+        ytrace::detail::note_level(lvl); \
         if (_ytrace_enabled_) { \
-            ytrace::detail::trace_impl(lvl, __FILE__, __LINE__, __func__, fmt __VA_OPT__(,) __VA_ARGS__); \
+            ytrace::detail::trace_if(_ytrace_ctl_, lvl, __FILE__, __LINE__, __func__, fmt __VA_OPT__(,) __VA_ARGS__); \
         } \
     } while(0)
 #endif
@@ -1047,14 +5456,88 @@ namespace ytrace {
 #define ylog(lvl, fmt, ...) do {} while(0)
 #endif
 
+// ylog_cat(category, lvl, fmt, ...) - ylog() tagged with a category (a bare identifier,
+// e.g. net). The point is also on while its category is enabled (yenable_category,
+// ytrace-ctl enable --category); the hot path is still a single flag load. Like ylog()
+// it takes --when, --stack, --under and --thread.
+#if YTRACE_ENABLE_YLOG
+#if defined(YTRACE_USE_SPDLOG)
+#define ylog_cat(cat, lvl, fmt, ...) \
+    do { \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_category_trace_point(&_ytrace_enabled_, &_ytrace_ctl_, #cat, __FILE__, __LINE__, __func__, lvl, fmt); \
+        ytrace::detail::note_level(lvl); \
+        if (_ytrace_enabled_) { \
+            YTRACE_DETAIL_SPDLOG_IF(_ytrace_ctl_, ytrace::detail::to_spdlog_level(lvl), fmt __VA_OPT__(,) __VA_ARGS__); \
+        } \
+    } while(0)
+#else
+#define ylog_cat(cat, lvl, fmt, ...) \
+    do { \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_category_trace_point(&_ytrace_enabled_, &_ytrace_ctl_, #cat, __FILE__, __LINE__, __func__, lvl, fmt); \
+        ytrace::detail::note_level(lvl); \
+        if (_ytrace_enabled_) { \
+            ytrace::detail::trace_if(_ytrace_ctl_, lvl, __FILE__, __LINE__, __func__, fmt __VA_OPT__(,) __VA_ARGS__); \
+        } \
+    } while(0)
+#endif
+#else
+#define ylog_cat(cat, lvl, fmt, ...) do {} while(0)
+#endif
+
+// ylog_obj(obj, lvl, fmt, ...) / ytrace_obj(obj, fmt, ...) - points carrying an object key
+// (a pointer such as this, or an integral id). Enabled normally they trace every object;
+// enabled in object-filtered mode (ytrace-ctl enable --object KEY ...) they trace only
+// keys in the ObjectFilter set, which is consulted only in that mode. They also take
+// --when, --stack, --under and --thread like ylog(); the predicate sees fmt's arguments.
+#if YTRACE_ENABLE_YLOG
+#if defined(YTRACE_USE_SPDLOG)
+#define ylog_obj(obj, lvl, fmt, ...) \
+    do { \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_obj_filtered_ = false; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_object_trace_point(&_ytrace_enabled_, &_ytrace_obj_filtered_, __FILE__, __LINE__, __func__, lvl, fmt, &_ytrace_ctl_); \
+        ytrace::detail::note_level(lvl); \
+        if (_ytrace_enabled_) { \
+            uintptr_t _ytrace_key_ = ytrace::detail::object_key(obj); \
+            if (ytrace::detail::object_passes(_ytrace_obj_filtered_, _ytrace_key_)) \
+                YTRACE_DETAIL_SPDLOG_OBJ_IF(_ytrace_ctl_, _ytrace_key_, ytrace::detail::to_spdlog_level(lvl), fmt __VA_OPT__(,) __VA_ARGS__); \
+        } \
+    } while(0)
+#else
+#define ylog_obj(obj, lvl, fmt, ...) \
+    do { \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_obj_filtered_ = false; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_object_trace_point(&_ytrace_enabled_, &_ytrace_obj_filtered_, __FILE__, __LINE__, __func__, lvl, fmt, &_ytrace_ctl_); \
+        ytrace::detail::note_level(lvl); \
+        if (_ytrace_enabled_) { \
+            uintptr_t _ytrace_key_ = ytrace::detail::object_key(obj); \
+            if (ytrace::detail::object_passes(_ytrace_obj_filtered_, _ytrace_key_)) \
+                ytrace::detail::trace_obj_if(_ytrace_ctl_, _ytrace_key_, lvl, __FILE__, __LINE__, __func__, fmt __VA_OPT__(,) __VA_ARGS__); \
+        } \
+    } while(0)
+#endif
+#else
+#define ylog_obj(obj, lvl, fmt, ...) do {} while(0)
+#endif
+
+#if YTRACE_ENABLE_YTRACE
+#define ytrace_obj(obj, fmt, ...) ylog_obj(obj, "trace", fmt __VA_OPT__(,) __VA_ARGS__)
+#else
+#define ytrace_obj(obj, fmt, ...) do {} while(0)
+#endif
+
 // Level-specific macros with compile-time format strings
 #if YTRACE_ENABLE_YTRACE
 #if defined(YTRACE_USE_SPDLOG)
 #define ytrace(fmt, ...) \
     do { \
-        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, __FILE__, __LINE__, __func__, "trace", fmt); \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, &_ytrace_ctl_, __FILE__, __LINE__, __func__, "trace", fmt); \
         if (_ytrace_enabled_) { \
-            spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __func__}, spdlog::level::trace, fmt __VA_OPT__(,) __VA_ARGS__); \
+            YTRACE_DETAIL_SPDLOG_IF(_ytrace_ctl_, spdlog::level::trace, fmt __VA_OPT__(,) __VA_ARGS__); \
         } \
     } while(0)
 #else
@@ -1068,9 +5551,10 @@ namespace ytrace {
 #if defined(YTRACE_USE_SPDLOG)
 #define ydebug(fmt, ...) \
     do { \
-        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, __FILE__, __LINE__, __func__, "debug", fmt); \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, &_ytrace_ctl_, __FILE__, __LINE__, __func__, "debug", fmt); \
         if (_ytrace_enabled_) { \
-            spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __func__}, spdlog::level::debug, fmt __VA_OPT__(,) __VA_ARGS__); \
+            YTRACE_DETAIL_SPDLOG_IF(_ytrace_ctl_, spdlog::level::debug, fmt __VA_OPT__(,) __VA_ARGS__); \
         } \
     } while(0)
 #else
@@ -1084,9 +5568,10 @@ namespace ytrace {
 #if defined(YTRACE_USE_SPDLOG)
 #define yinfo(fmt, ...) \
     do { \
-        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, __FILE__, __LINE__, __func__, "info", fmt); \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, &_ytrace_ctl_, __FILE__, __LINE__, __func__, "info", fmt); \
         if (_ytrace_enabled_) { \
-            spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __func__}, spdlog::level::info, fmt __VA_OPT__(,) __VA_ARGS__); \
+            YTRACE_DETAIL_SPDLOG_IF(_ytrace_ctl_, spdlog::level::info, fmt __VA_OPT__(,) __VA_ARGS__); \
         } \
     } while(0)
 #else
@@ -1100,9 +5585,11 @@ namespace ytrace {
 #if defined(YTRACE_USE_SPDLOG)
 #define ywarn(fmt, ...) \
     do { \
-        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, __FILE__, __LINE__, __func__, "warn", fmt); \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, &_ytrace_ctl_, __FILE__, __LINE__, __func__, "warn", fmt); \
+        ytrace::detail::note_level("warn"); \
         if (_ytrace_enabled_) { \
-            spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __func__}, spdlog::level::warn, fmt __VA_OPT__(,) __VA_ARGS__); \
+            YTRACE_DETAIL_SPDLOG_IF(_ytrace_ctl_, spdlog::level::warn, fmt __VA_OPT__(,) __VA_ARGS__); \
         } \
     } while(0)
 #else
@@ -1117,9 +5604,11 @@ namespace ytrace {
 #if defined(YTRACE_USE_SPDLOG)
 #define yerror(fmt, ...) \
     do { \
-        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, __FILE__, __LINE__, __func__, "error", fmt); \
+        static ytrace::PointControl _ytrace_ctl_; \
+        static bool _ytrace_enabled_ = ytrace::detail::register_trace_point(&_ytrace_enabled_, &_ytrace_ctl_, __FILE__, __LINE__, __func__, "error", fmt); \
+        ytrace::detail::note_level("error"); \
         if (_ytrace_enabled_) { \
-            spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __func__}, spdlog::level::err, fmt __VA_OPT__(,) __VA_ARGS__); \
+            YTRACE_DETAIL_SPDLOG_IF(_ytrace_ctl_, spdlog::level::err, fmt __VA_OPT__(,) __VA_ARGS__); \
         } \
     } while(0)
 #else
@@ -1128,14 +5617,46 @@ namespace ytrace {
 #else
 #define yerror(fmt, ...) do {} while(0)
 #endif
+// Call-path anchor of a yfunc()/ytimeit() scope (see CallPath)
+#define YTRACE_DETAIL_CALL_PATH(guard) \
+    static constinit std::atomic<uint64_t> guard##bit_{0}; \
+    [[maybe_unused]] static bool guard##anchored_ = ytrace::CallPath::instance().register_anchor(&guard##bit_, __func__); \
+    ytrace::CallPathGuard guard{guard##bit_.load(std::memory_order_relaxed), __func__}
+
 #if YTRACE_ENABLE_YFUNC
 #define yfunc() \
     static bool _ytrace_entry_enabled_ = ytrace::detail::register_trace_point(&_ytrace_entry_enabled_, __FILE__, __LINE__, __func__, "func-entry", ""); \
     static bool _ytrace_exit_enabled_ = ytrace::detail::register_trace_point(&_ytrace_exit_enabled_, __FILE__, __LINE__, __func__, "func-exit", ""); \
+    YTRACE_DETAIL_CALL_PATH(_ytrace_path_guard_); \
     std::optional<ytrace::ScopeTracer> _ytrace_scope_guard_; \
     if (_ytrace_entry_enabled_) _ytrace_scope_guard_.emplace(&_ytrace_exit_enabled_, __FILE__, __LINE__, __func__)
+
+// yfunc_adaptive(max_per_sec) - yfunc() for very hot functions: traces at most about
+// max_per_sec calls per second, raising the sampling interval as the call rate grows.
+// "list" shows the effective rate (sample=1/N) and the total call count.
+#define yfunc_adaptive(max_per_sec) \
+    static ytrace::AdaptiveSampler _ytrace_sampler_{max_per_sec}; \
+    static thread_local ytrace::AdaptiveSampler::Local _ytrace_sampler_local_; \
+    static bool _ytrace_entry_enabled_ = ytrace::detail::register_sampled_trace_point(&_ytrace_entry_enabled_, &_ytrace_sampler_, __FILE__, __LINE__, __func__, "func-entry", ""); \
+    static bool _ytrace_exit_enabled_ = ytrace::detail::register_sampled_trace_point(&_ytrace_exit_enabled_, &_ytrace_sampler_, __FILE__, __LINE__, __func__, "func-exit", ""); \
+    YTRACE_DETAIL_CALL_PATH(_ytrace_path_guard_); \
+    std::optional<ytrace::ScopeTracer> _ytrace_scope_guard_; \
+    if (_ytrace_entry_enabled_ && _ytrace_sampler_.sample(_ytrace_sampler_local_)) _ytrace_scope_guard_.emplace(&_ytrace_exit_enabled_, __FILE__, __LINE__, __func__)
+
+// yfunc_obj(obj) - yfunc() for member functions of hot classes; see ylog_obj for the
+// object-filtered mode
+#define yfunc_obj(obj) \
+    static bool _ytrace_obj_filtered_ = false; \
+    static bool _ytrace_entry_enabled_ = ytrace::detail::register_object_trace_point(&_ytrace_entry_enabled_, &_ytrace_obj_filtered_, __FILE__, __LINE__, __func__, "func-entry", ""); \
+    static bool _ytrace_exit_enabled_ = ytrace::detail::register_object_trace_point(&_ytrace_exit_enabled_, &_ytrace_obj_filtered_, __FILE__, __LINE__, __func__, "func-exit", ""); \
+    YTRACE_DETAIL_CALL_PATH(_ytrace_path_guard_); \
+    std::optional<ytrace::ScopeTracer> _ytrace_scope_guard_; \
+    if (_ytrace_entry_enabled_ && ytrace::detail::object_passes(_ytrace_obj_filtered_, ytrace::detail::object_key(obj))) \
+        _ytrace_scope_guard_.emplace(&_ytrace_exit_enabled_, __FILE__, __LINE__, __func__)
 #else
 #define yfunc() do {} while(0)
+#define yfunc_adaptive(max_per_sec) do {} while(0)
+#define yfunc_obj(obj) do {} while(0)
 #endif
 
 // ytime() - scope timer macro (optional label argument)
@@ -1143,6 +5664,7 @@ namespace ytrace {
 #define YTIMEIT_IMPL(label) \
     static bool _ytrace_timer_entry_enabled_ = ytrace::detail::register_trace_point(&_ytrace_timer_entry_enabled_, __FILE__, __LINE__, __func__, "timer-entry", label); \
     static bool _ytrace_timer_exit_enabled_ = ytrace::detail::register_trace_point(&_ytrace_timer_exit_enabled_, __FILE__, __LINE__, __func__, "timer-exit", label); \
+    YTRACE_DETAIL_CALL_PATH(_ytrace_timer_path_guard_); \
     std::optional<ytrace::ScopeTimer> _ytrace_timer_guard_; \
     if (_ytrace_timer_entry_enabled_) _ytrace_timer_guard_.emplace(label, __FILE__, __LINE__, __func__)
 
@@ -1150,8 +5672,53 @@ namespace ytrace {
 #define YTIMEIT_NOLABEL() YTIMEIT_IMPL(__func__)
 #define YTIMEIT_GET_MACRO(_0, _1, NAME, ...) NAME
 #define ytimeit(...) YTIMEIT_GET_MACRO(_0 __VA_OPT__(,) __VA_ARGS__, YTIMEIT_IMPL, YTIMEIT_NOLABEL)(__VA_ARGS__)
+
+// ytimeit_every(n, "label") - ytimeit() for micro-scopes: times about one execution in n
+// (pseudo-randomly picked per thread); the others cost a thread-local decrement.
+// The summary marks the statistics as sampled.
+#define ytimeit_every(n, label) \
+    static bool _ytrace_timer_entry_enabled_ = ytrace::detail::register_trace_point(&_ytrace_timer_entry_enabled_, __FILE__, __LINE__, __func__, "timer-entry", label); \
+    static bool _ytrace_timer_exit_enabled_ = ytrace::detail::register_trace_point(&_ytrace_timer_exit_enabled_, __FILE__, __LINE__, __func__, "timer-exit", label); \
+    static thread_local ytrace::detail::SampleCountdown _ytrace_timer_countdown_; \
+    YTRACE_DETAIL_CALL_PATH(_ytrace_timer_path_guard_); \
+    std::optional<ytrace::ScopeTimer> _ytrace_timer_guard_; \
+    if (_ytrace_timer_entry_enabled_ && _ytrace_timer_countdown_.next(n)) \
+        _ytrace_timer_guard_.emplace(label, __FILE__, __LINE__, __func__, static_cast<uint32_t>(n))
+
+// ytimeit_dyn(label) - ytimeit() with a runtime label (std::string_view: endpoint,
+// tenant...), interned in LabelTable. Past YTRACE_DYN_LABELS distinct labels, scopes are
+// timed under "(other)". The points list with the label "(dynamic)".
+#define ytimeit_dyn(label) \
+    static bool _ytrace_timer_entry_enabled_ = ytrace::detail::register_trace_point(&_ytrace_timer_entry_enabled_, __FILE__, __LINE__, __func__, "timer-entry", "(dynamic)"); \
+    static bool _ytrace_timer_exit_enabled_ = ytrace::detail::register_trace_point(&_ytrace_timer_exit_enabled_, __FILE__, __LINE__, __func__, "timer-exit", "(dynamic)"); \
+    static thread_local ytrace::detail::LabelCache _ytrace_label_cache_; \
+    YTRACE_DETAIL_CALL_PATH(_ytrace_timer_path_guard_); \
+    std::optional<ytrace::ScopeTimer> _ytrace_timer_guard_; \
+    if (_ytrace_timer_entry_enabled_) \
+        _ytrace_timer_guard_.emplace(_ytrace_label_cache_.intern(&_ytrace_timer_entry_enabled_, label), __FILE__, __LINE__, __func__)
+
+// ytimeit_batch(n, "label") - for the body of an inner loop: reads the clock once per n
+// iterations and records the n-averaged iteration time (see BatchTimer)
+#define ytimeit_batch(n, label) \
+    static bool _ytrace_timer_entry_enabled_ = ytrace::detail::register_trace_point(&_ytrace_timer_entry_enabled_, __FILE__, __LINE__, __func__, "timer-entry", label); \
+    static bool _ytrace_timer_exit_enabled_ = ytrace::detail::register_trace_point(&_ytrace_timer_exit_enabled_, __FILE__, __LINE__, __func__, "timer-exit", label); \
+    static thread_local ytrace::BatchTimer _ytrace_batch_timer_; \
+    if (_ytrace_timer_entry_enabled_) _ytrace_batch_timer_.tick(static_cast<uint32_t>(n), label, __FILE__, __LINE__, __func__)
 #else
 #define ytimeit(...) do {} while(0)
+#define ytimeit_every(n, label) do {} while(0)
+#define ytimeit_batch(n, label) do {} while(0)
+#define ytimeit_dyn(label) do {} while(0)
+#endif
+
+// yrequest("name") - root scope of a request for tail-based sampling. While tail
+// sampling is on (ytrace-ctl tail on ...), every record the thread emits inside the scope
+// is buffered and, when the scope ends, emitted only if the request was slow, hit a
+// warn/error, or was picked 1-in-N; otherwise the buffer is dropped.
+#if YTRACE_ENABLED
+#define yrequest(name) ytrace::RequestScope _ytrace_request_guard_(name, __FILE__, __LINE__, __func__)
+#else
+#define yrequest(name) do {} while(0)
 #endif
 
 // Convenience macros for manager access
@@ -1164,6 +5731,15 @@ namespace ytrace {
 #define ydisable_func(func)    ytrace::TraceManager::instance().set_function_enabled(func, false)
 #define yenable_level(lvl)     ytrace::TraceManager::instance().set_level_enabled(lvl, true)
 #define ydisable_level(lvl)    ytrace::TraceManager::instance().set_level_enabled(lvl, false)
+#define yenable_category(cat)  ytrace::TraceManager::instance().set_category_enabled(cat, true)
+#define ydisable_category(cat) ytrace::TraceManager::instance().set_category_enabled(cat, false)
+#define yenable_object(obj)    ytrace::ObjectFilter::instance().add(ytrace::detail::object_key(obj))
+#define ydisable_object(obj)   ytrace::ObjectFilter::instance().remove(ytrace::detail::object_key(obj))
+#define yenable_func_filtered(func) ytrace::TraceManager::instance().set_function_object_filtered(func)
+#define yenable_func_when(func, expr) ytrace::TraceManager::instance().set_function_condition(func, expr)
+#define yenable_func_stack(func)    ytrace::TraceManager::instance().set_function_stack(func)
+#define yenable_func_under(func, scope) ytrace::TraceManager::instance().set_function_under(func, scope)
+#define yenable_func_on_thread(func, glob) ytrace::TraceManager::instance().set_function_on_thread(func, glob)
 #else
 #define yenable_all()          do {} while(0)
 #define ydisable_all()         do {} while(0)
@@ -1173,4 +5749,13 @@ namespace ytrace {
 #define ydisable_func(func)    do {} while(0)
 #define yenable_level(lvl)     do {} while(0)
 #define ydisable_level(lvl)    do {} while(0)
+#define yenable_category(cat)  do {} while(0)
+#define ydisable_category(cat) do {} while(0)
+#define yenable_object(obj)    do {} while(0)
+#define ydisable_object(obj)   do {} while(0)
+#define yenable_func_filtered(func) do {} while(0)
+#define yenable_func_when(func, expr) (false)
+#define yenable_func_stack(func)    do {} while(0)
+#define yenable_func_under(func, scope) (false)
+#define yenable_func_on_thread(func, glob) (false)
 #endif
@@ -0,0 +1,136 @@
+#pragma once
+
+// dladdr-based symbolization shared by the instrumentation runtimes (address-only names
+// with YTRACE_RAW_SYMBOLS).
+// Internal to src/instrument; everything here must stay uninstrumented.
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define YTRACE_NO_INSTRUMENT __attribute__((no_instrument_function))
+
+namespace ytrace::instrument_detail {
+
+struct Symbol {
+    std::string module;      // shared object path, "??" if unknown
+    std::string qualified;   // demangled name, "" if unknown
+    std::string name;        // __func__-style name, or the address in hex
+    uintptr_t base = 0;      // load address of module, 0 if unknown
+};
+
+// Reduce a demangled name to what __func__ would give ("ns::Foo::bar(int) const" -> "bar"),
+// so instrumented functions list and match like yfunc() points. Returns "" if the result
+// still contains characters the control protocol cannot carry.
+YTRACE_NO_INSTRUMENT inline std::string short_name(const std::string& demangled) {
+    int depth = 0;
+    size_t start = 0;
+    size_t end = demangled.size();
+    for (size_t i = 0; i < demangled.size(); ++i) {
+        char c = demangled[i];
+        if (c == '<') ++depth;
+        else if (c == '>') --depth;
+        else if (depth == 0 && c == '(' && i > 0) { end = i; break; }
+        else if (depth == 0 && c == ':' && i + 1 < demangled.size() && demangled[i + 1] == ':') {
+            start = i + 2;
+            ++i;
+        }
+    }
+    std::string name = demangled.substr(start, end - start);
+    if (name.find_first_of(" :()\"\t") != std::string::npos) return "";
+    return name;
+}
+
+// True if a mangled name belongs to std::, __gnu_cxx:: or ytrace::. Nested names, local
+// entities and CV/ref-qualified members are looked through; std:: also has the one-letter
+// abbreviations (Sa, Sb, Ss, ...).
+YTRACE_NO_INSTRUMENT inline bool runtime_mangled(const char* s) {
+    if (std::strncmp(s, "_Z", 2) != 0) return false;
+    s += 2;
+    if (*s == 'Z') ++s;
+    if (*s == 'N') {
+        ++s;
+        while (*s == 'r' || *s == 'V' || *s == 'K' || *s == 'R' || *s == 'O') ++s;
+    }
+    if (s[0] == 'S' && s[1] && std::strchr("tabsiod", s[1])) return true;
+    return std::strncmp(s, "6ytrace", 7) == 0 || std::strncmp(s, "9__gnu_cxx", 10) == 0;
+}
+
+#if defined(YTRACE_RAW_SYMBOLS)
+// Name functions by address only: no dladdr or demangling in the process. ytrace-ctl
+// decode resolves the addresses offline from a capture's module maps.
+YTRACE_NO_INSTRUMENT inline Symbol symbolize(void* fn) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%p", fn);
+    return Symbol{"??", "", buf};
+}
+
+YTRACE_NO_INSTRUMENT inline Symbol symbolize_containing(void* pc) { return symbolize(pc); }
+
+// Inline std/ytrace code instantiated in traced TUs. Only the mangled name is looked at,
+// so raw builds skip the same functions without demangling anything.
+YTRACE_NO_INSTRUMENT inline bool is_runtime_code(const Symbol&, void* fn) {
+    Dl_info info;
+    return dladdr(fn, &info) != 0 && info.dli_sname && info.dli_saddr == fn &&
+           runtime_mangled(info.dli_sname);
+}
+#else
+// Resolve a function address. dladdr only sees exported symbols and otherwise reports the
+// nearest preceding one, so the symbol is only used if it starts exactly at fn.
+YTRACE_NO_INSTRUMENT inline Symbol symbolize(void* fn) {
+    Symbol sym{"??", "", ""};
+    Dl_info info;
+    if (dladdr(fn, &info) != 0) {
+        if (info.dli_fname) sym.module = info.dli_fname;
+        if (info.dli_sname && info.dli_saddr == fn) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            sym.qualified = (status == 0 && demangled) ? demangled : info.dli_sname;
+            std::free(demangled);
+            sym.name = short_name(sym.qualified);
+        }
+    }
+    if (sym.name.empty()) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%p", fn);
+        sym.name = buf;
+    }
+    return sym;
+}
+
+// Resolve an address inside a function (a call site) to the nearest preceding exported
+// symbol; functions that are not exported are named after the one before them.
+YTRACE_NO_INSTRUMENT inline Symbol symbolize_containing(void* pc) {
+    Symbol sym{"??", "", ""};
+    Dl_info info;
+    if (dladdr(pc, &info) != 0) {
+        if (info.dli_fname) sym.module = info.dli_fname;
+        sym.base = reinterpret_cast<uintptr_t>(info.dli_fbase);
+        if (info.dli_sname) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            sym.qualified = (status == 0 && demangled) ? demangled : info.dli_sname;
+            std::free(demangled);
+            sym.name = short_name(sym.qualified);
+        }
+    }
+    if (sym.name.empty()) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%p", pc);
+        sym.name = buf;
+    }
+    return sym;
+}
+
+// Inline std/ytrace code instantiated in traced TUs (see symbolize()).
+YTRACE_NO_INSTRUMENT inline bool is_runtime_code(const Symbol& sym, void*) {
+    return sym.qualified.rfind("std::", 0) == 0 || sym.qualified.rfind("ytrace::", 0) == 0 ||
+           sym.qualified.rfind("__gnu_cxx::", 0) == 0;
+}
+#endif
+
+} // namespace ytrace::instrument_detail
@@ -0,0 +1,156 @@
+// __cxa_throw / __cxa_begin_catch hooks counting throws per site (Itanium C++ ABI).
+// Built as an object library: the hook definitions must take precedence over the C++
+// runtime's, which they reach through dlsym(RTLD_NEXT).
+
+#include <ytrace/exceptions.hpp>
+#include "symbolize.hpp"
+
+#include <chrono>
+#include <deque>
+#include <typeinfo>
+#include <unwind.h>
+
+namespace ytrace {
+namespace {
+
+using ThrowFn = void (*)(void*, std::type_info*, void (*)(void*));
+using BeginCatchFn = void* (*)(void*);
+
+// Set while a hook is running on this thread: registration may allocate, and whatever it
+// throws or catches must go straight to the runtime.
+thread_local bool t_in_hook = false;
+
+struct HookGuard {
+    YTRACE_NO_INSTRUMENT HookGuard() { t_in_hook = true; }
+    YTRACE_NO_INSTRUMENT ~HookGuard() { t_in_hook = false; }
+};
+
+// Exceptions of enabled sites, thrown and not yet caught on this thread
+struct InFlight {
+    void* object;           // as thrown (__cxa_throw's argument)
+    ExceptionTable::Site* site;
+    uint64_t start_ns;
+};
+thread_local InFlight t_inflight[YTRACE_EXCEPTION_INFLIGHT];
+thread_local size_t t_inflight_count = 0;
+
+YTRACE_NO_INSTRUMENT uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+template<typename Fn>
+YTRACE_NO_INSTRUMENT Fn resolve_next(const char* name) {
+    void* fn = dlsym(RTLD_NEXT, name);
+    if (!fn) {
+        std::fprintf(stderr, "[ytrace] %s not found after ytrace::exceptions (static C++ runtime?)\n", name);
+        std::abort();
+    }
+    return reinterpret_cast<Fn>(fn);
+}
+
+// Owns the module/function/type strings referenced by the registered sites
+YTRACE_NO_INSTRUMENT std::mutex& names_mutex() {
+    static std::mutex m;
+    return m;
+}
+
+YTRACE_NO_INSTRUMENT std::deque<std::string>& names() {
+    static std::deque<std::string> n;
+    return n;
+}
+
+// Slow path: first throw at pc. Claims the site and registers its trace point; returns
+// the site (possibly still being registered by another thread), nullptr if the table is full.
+YTRACE_NO_INSTRUMENT ExceptionTable::Site* register_site(uintptr_t pc, const std::type_info* type) {
+    auto [site, inserted] = ExceptionTable::instance().insert(pc);
+    if (!inserted) return site;
+
+    try {
+        auto sym = instrument_detail::symbolize_containing(reinterpret_cast<void*>(pc));
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(type->name(), nullptr, nullptr, &status);
+        std::string type_name = (status == 0 && demangled) ? demangled : type->name();
+        std::free(demangled);
+        {
+            std::lock_guard<std::mutex> lock(names_mutex());
+            site->module = names().emplace_back(std::move(sym.module)).c_str();
+            site->function = names().emplace_back(std::move(sym.name)).c_str();
+            site->type = names().emplace_back(std::move(type_name)).c_str();
+        }
+        site->base = sym.base;
+        detail::register_trace_point(&site->enabled, site->module, 0, site->function, "throw", site->type);
+    } catch (...) {
+        return site;  // out of memory: the site is counted but never listed
+    }
+    site->ready.store(true, std::memory_order_release);
+    return site;
+}
+
+YTRACE_NO_INSTRUMENT void on_throw(void* object, const std::type_info* type, uintptr_t pc) {
+    auto& table = ExceptionTable::instance();
+    ExceptionTable::Site* site = table.find(pc);
+    if (!site) {
+        HookGuard guard;
+        site = register_site(pc, type);
+        if (!site) return;
+    }
+    site->throws.fetch_add(1, std::memory_order_relaxed);
+    if (!site->enabled || !site->ready.load(std::memory_order_acquire)) return;
+
+    {
+        HookGuard guard;
+        detail::emit("throw", site->module, 0, site->function, site->type);
+    }
+    if (t_inflight_count == YTRACE_EXCEPTION_INFLIGHT) {
+        std::copy(t_inflight + 1, t_inflight + t_inflight_count, t_inflight);
+        --t_inflight_count;
+    }
+    t_inflight[t_inflight_count++] = InFlight{object, site, now_ns()};
+}
+
+// object: the thrown object of the exception being caught, not the adjusted pointer the
+// handler receives (which differs for bases at an offset and for pointer types)
+YTRACE_NO_INSTRUMENT void on_catch(void* object) {
+    for (size_t i = t_inflight_count; i-- > 0;) {
+        if (t_inflight[i].object != object) continue;
+        ExceptionTable::instance().record_catch(*t_inflight[i].site, now_ns() - t_inflight[i].start_ns);
+        std::copy(t_inflight + i + 1, t_inflight + t_inflight_count, t_inflight + i);
+        --t_inflight_count;
+        return;
+    }
+}
+
+} // namespace
+} // namespace ytrace
+
+// Defined in the ABI namespace, where <cxxabi.h> declares them (GCC also declares
+// __cxa_throw implicitly at global scope, with a different signature)
+namespace __cxxabiv1 {
+extern "C" {
+
+YTRACE_NO_INSTRUMENT __attribute__((noreturn)) void __cxa_throw(void* object, std::type_info* type,
+                                                                void (*destructor)(void*)) {
+    static const ytrace::ThrowFn real = ytrace::resolve_next<ytrace::ThrowFn>("__cxa_throw");
+    if (!ytrace::t_in_hook) {
+        // The return address follows the call; step back into it, since a call to this
+        // noreturn function may be the last instruction of the throwing function
+        auto pc = reinterpret_cast<uintptr_t>(__builtin_return_address(0)) - 1;
+        ytrace::on_throw(object, type, pc);
+    }
+    real(object, type, destructor);
+    __builtin_unreachable();
+}
+
+YTRACE_NO_INSTRUMENT void* __cxa_begin_catch(void* exception) noexcept {
+    static const ytrace::BeginCatchFn real = ytrace::resolve_next<ytrace::BeginCatchFn>("__cxa_begin_catch");
+    // The C++ exception header ends with the unwind header, and the thrown object follows
+    // it (for exceptions thrown by __cxa_throw; others never match an in-flight entry)
+    if (ytrace::t_inflight_count && !ytrace::t_in_hook) {
+        ytrace::on_catch(static_cast<char*>(exception) + sizeof(_Unwind_Exception));
+    }
+    return real(exception);
+}
+
+} // extern "C"
+} // namespace __cxxabiv1
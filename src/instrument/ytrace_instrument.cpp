@@ -0,0 +1,79 @@
+// __cyg_profile_func_enter/exit hooks for targets compiled with -finstrument-functions.
+// This file itself must NOT be compiled with -finstrument-functions.
+
+#include <ytrace/instrument.hpp>
+#include "symbolize.hpp"
+
+#include <deque>
+
+namespace ytrace {
+namespace {
+
+// Set while a hook is running on this thread. Anything the slow path calls that was
+// compiled into an instrumented TU (e.g. inline std:: code) would otherwise recurse.
+thread_local bool t_in_hook = false;
+
+struct HookGuard {
+    YTRACE_NO_INSTRUMENT HookGuard() { t_in_hook = true; }
+    YTRACE_NO_INSTRUMENT ~HookGuard() { t_in_hook = false; }
+};
+
+// Owns the symbol/module strings referenced by the registered TracePointInfo entries
+YTRACE_NO_INSTRUMENT std::mutex& names_mutex() {
+    static std::mutex m;
+    return m;
+}
+
+YTRACE_NO_INSTRUMENT std::deque<std::string>& names() {
+    static std::deque<std::string> n;
+    return n;
+}
+
+// Slow path: first call of fn. Claims a slot and registers its entry/exit trace points.
+YTRACE_NO_INSTRUMENT FunctionTable::Slot* register_function(void* fn) {
+    auto [slot, inserted] = FunctionTable::instance().insert(fn);
+    if (!inserted) return nullptr;  // table full, or another thread is registering it
+
+    {
+        auto sym = instrument_detail::symbolize(fn);
+        std::lock_guard<std::mutex> lock(names_mutex());
+        slot->module = names().emplace_back(std::move(sym.module)).c_str();
+        slot->function = names().emplace_back(std::move(sym.name)).c_str();
+    }
+
+    detail::register_trace_point(&slot->entry_enabled, slot->module, 0, slot->function, "func-entry", "");
+    detail::register_trace_point(&slot->exit_enabled, slot->module, 0, slot->function, "func-exit", "");
+    slot->ready.store(true, std::memory_order_release);
+    return slot;
+}
+
+} // namespace
+} // namespace ytrace
+
+extern "C" {
+
+
+YTRACE_NO_INSTRUMENT void __cyg_profile_func_enter(void* fn, void* call_site) {
+    (void)call_site;
+    if (ytrace::t_in_hook) return;
+    auto* slot = ytrace::FunctionTable::instance().find(fn);
+    if (slot && !slot->entry_enabled) return;  // disabled: one probe, one load
+
+    ytrace::HookGuard guard;
+    if (!slot) slot = ytrace::register_function(fn);
+    if (slot && slot->entry_enabled) {
+        ytrace::detail::emit("func-entry", slot->module, 0, slot->function, "");
+    }
+}
+
+YTRACE_NO_INSTRUMENT void __cyg_profile_func_exit(void* fn, void* call_site) {
+    (void)call_site;
+    if (ytrace::t_in_hook) return;
+    auto* slot = ytrace::FunctionTable::instance().find(fn);
+    if (!slot || !slot->exit_enabled) return;
+
+    ytrace::HookGuard guard;
+    ytrace::detail::emit("func-exit", slot->module, 0, slot->function, "");
+}
+
+} // extern "C"
@@ -0,0 +1,272 @@
+// Runtime for -fpatchable-function-entry=5 targets (x86-64 Linux).
+// Built as an object library so the startup constructor is always linked in.
+
+#include <ytrace/patchable.hpp>
+#include "symbolize.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "ytrace patchable function tracing requires x86-64 Linux"
+#endif
+
+extern "C" {
+// Linker-provided bounds of the NOP site table (weak: absent if nothing was compiled
+// with -fpatchable-function-entry)
+extern uint8_t* const __start___patchable_function_entries[] __attribute__((weak));
+extern uint8_t* const __stop___patchable_function_entries[] __attribute__((weak));
+
+void ytrace_patchable_entry_trampoline();
+void ytrace_patchable_exit_trampoline();
+void ytrace_patchable_on_entry(uint8_t* site, uintptr_t* parent_ret);
+uintptr_t ytrace_patchable_on_exit();
+}
+
+// Entry trampoline, called from a patched site. Preserves all argument registers
+// (including the static chain and xmm0-7) so the traced function sees them unchanged.
+//   8(%rbp)  = return address into the traced function (site + 5)
+//   16(%rbp) = the traced function's own return address
+asm(R"(
+    .text
+    .p2align 4
+    .globl ytrace_patchable_entry_trampoline
+    .hidden ytrace_patchable_entry_trampoline
+    .type ytrace_patchable_entry_trampoline, @function
+ytrace_patchable_entry_trampoline:
+    pushq %rbp
+    movq %rsp, %rbp
+    pushq %rax
+    pushq %rdi
+    pushq %rsi
+    pushq %rdx
+    pushq %rcx
+    pushq %r8
+    pushq %r9
+    pushq %r10
+    subq $136, %rsp
+    movdqu %xmm0, 0(%rsp)
+    movdqu %xmm1, 16(%rsp)
+    movdqu %xmm2, 32(%rsp)
+    movdqu %xmm3, 48(%rsp)
+    movdqu %xmm4, 64(%rsp)
+    movdqu %xmm5, 80(%rsp)
+    movdqu %xmm6, 96(%rsp)
+    movdqu %xmm7, 112(%rsp)
+    movq 8(%rbp), %rdi
+    subq $5, %rdi
+    leaq 16(%rbp), %rsi
+    call ytrace_patchable_on_entry@PLT
+    movdqu 0(%rsp), %xmm0
+    movdqu 16(%rsp), %xmm1
+    movdqu 32(%rsp), %xmm2
+    movdqu 48(%rsp), %xmm3
+    movdqu 64(%rsp), %xmm4
+    movdqu 80(%rsp), %xmm5
+    movdqu 96(%rsp), %xmm6
+    movdqu 112(%rsp), %xmm7
+    addq $136, %rsp
+    popq %r10
+    popq %r9
+    popq %r8
+    popq %rcx
+    popq %rdx
+    popq %rsi
+    popq %rdi
+    popq %rax
+    popq %rbp
+    ret
+    .size ytrace_patchable_entry_trampoline, .-ytrace_patchable_entry_trampoline
+
+    .p2align 4
+    .globl ytrace_patchable_exit_trampoline
+    .hidden ytrace_patchable_exit_trampoline
+    .type ytrace_patchable_exit_trampoline, @function
+ytrace_patchable_exit_trampoline:
+    subq $8, %rsp
+    pushq %rax
+    pushq %rdx
+    subq $40, %rsp
+    movdqu %xmm0, 0(%rsp)
+    movdqu %xmm1, 16(%rsp)
+    call ytrace_patchable_on_exit@PLT
+    movq %rax, 56(%rsp)
+    movdqu 0(%rsp), %xmm0
+    movdqu 16(%rsp), %xmm1
+    addq $40, %rsp
+    popq %rdx
+    popq %rax
+    ret
+    .size ytrace_patchable_exit_trampoline, .-ytrace_patchable_exit_trampoline
+)");
+
+namespace ytrace {
+namespace {
+
+struct ShadowFrame {
+    PatchableSite* site;
+    uintptr_t return_address;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Per-thread stack of functions whose return address was redirected to the exit trampoline
+thread_local ShadowFrame t_shadow[YTRACE_PATCHABLE_SHADOW_DEPTH];
+thread_local size_t t_shadow_depth = 0;
+
+// Set while a handler runs: inline code it calls may itself be patched
+thread_local bool t_in_handler = false;
+
+// Sorted by address; built once at startup, never resized afterwards
+std::vector<PatchableSite>& sites() {
+    static std::vector<PatchableSite> s;
+    return s;
+}
+
+PatchableSite* find_site(uint8_t* addr) {
+    auto& s = sites();
+    auto it = std::lower_bound(s.begin(), s.end(), addr,
+        [](const PatchableSite& site, uint8_t* a) { return site.addr < a; });
+    return (it != s.end() && it->addr == addr) ? &*it : nullptr;
+}
+
+// Replace the 5 bytes at addr with one atomic store (see detail::is_patchable_alignment)
+bool write_site(uint8_t* addr, const uint8_t bytes[5]) {
+    static const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    auto a = reinterpret_cast<uintptr_t>(addr);
+    if (!detail::is_patchable_alignment(addr)) return false;
+
+    auto* first = reinterpret_cast<void*>(a & ~(page - 1));
+    size_t len = ((a + 5 + page - 1) & ~(page - 1)) - (a & ~(page - 1));
+    if (mprotect(first, len, PROT_READ | PROT_WRITE | PROT_EXEC) != 0) return false;
+
+    if ((a & 7) <= 3) {
+        auto* word = reinterpret_cast<uint64_t*>(a & ~uintptr_t(7));
+        uint64_t value = __atomic_load_n(word, __ATOMIC_RELAXED);
+        std::memcpy(reinterpret_cast<uint8_t*>(&value) + (a & 7), bytes, 5);
+        __atomic_store_n(word, value, __ATOMIC_RELEASE);
+    } else {
+        auto* block = reinterpret_cast<uint64_t*>(a & ~uintptr_t(15));
+        uint64_t lo = block[0], hi = block[1];
+        uint64_t new_words[2] = {lo, hi};
+        std::memcpy(reinterpret_cast<uint8_t*>(new_words) + (a & 15), bytes, 5);
+        bool ok = false;
+        while (!ok) {
+            asm volatile("lock cmpxchg16b %1"
+                         : "=@ccz"(ok), "+m"(*block), "+a"(lo), "+d"(hi)
+                         : "b"(new_words[0]), "c"(new_words[1])
+                         : "memory");
+            if (!ok) {
+                new_words[0] = lo;
+                new_words[1] = hi;
+                std::memcpy(reinterpret_cast<uint8_t*>(new_words) + (a & 15), bytes, 5);
+            }
+        }
+    }
+
+    mprotect(first, len, PROT_READ | PROT_EXEC);
+    return true;
+}
+
+// on_change callback: patch while either point of the site is enabled
+void on_site_change(const TracePointInfo& info) {
+    auto* site = static_cast<PatchableSite*>(info.context);
+    bool want = site->entry_enabled || site->exit_enabled;
+    if (want == site->patched) return;
+
+    uint8_t call[5];
+    if (want) {
+        if (!detail::encode_call(site->addr, reinterpret_cast<void*>(&ytrace_patchable_entry_trampoline), call)) return;
+        site->patched = write_site(site->addr, call);
+    } else {
+        site->patched = !write_site(site->addr, site->original);
+    }
+}
+
+std::deque<std::string>& names() {
+    static std::deque<std::string> n;
+    return n;
+}
+
+// Collect and register every NOP site at startup. The compiler emits five one-byte NOPs;
+// a thread stopped between two of them would resume inside the call's rel32 once the site
+// is patched. Each site is therefore rewritten here, while the process has no other
+// thread yet, to one five-byte NOP, and afterwards only toggled between that and the call.
+__attribute__((constructor)) void init_patchable_sites() {
+    if (!__start___patchable_function_entries) return;
+
+    static const uint8_t kNops[5] = {0x90, 0x90, 0x90, 0x90, 0x90};
+    static const uint8_t kNop5[5] = {0x0F, 0x1F, 0x44, 0x00, 0x00};  // nopl 0x0(%rax,%rax,1)
+    static const uint8_t kEndbr64[4] = {0xF3, 0x0F, 0x1E, 0xFA};
+
+    auto& s = sites();
+    for (auto* p = __start___patchable_function_entries; p != __stop___patchable_function_entries; ++p) {
+        uint8_t* addr = *p;
+        if (!addr || std::memcmp(addr, kNops, 5) != 0) continue;
+
+        // With -fcf-protection the NOPs follow the endbr64 landing pad
+        void* fn = std::memcmp(addr - 4, kEndbr64, 4) == 0 ? addr - 4 : addr;
+        auto sym = instrument_detail::symbolize(fn);
+
+        // Inline ytrace/std code instantiated in the traced TUs is not interesting and
+        // would recurse into the handlers
+        if (instrument_detail::is_runtime_code(sym, fn)) continue;
+
+        // A site that cannot be written atomically could never be patched either
+        if (!write_site(addr, kNop5)) continue;
+
+        PatchableSite site;
+        site.addr = addr;
+        std::memcpy(site.original, kNop5, 5);
+        site.module = names().emplace_back(std::move(sym.module)).c_str();
+        site.function = names().emplace_back(std::move(sym.name)).c_str();
+        site.timer_key = std::string(site.module) + ":0 " + site.function;
+        s.push_back(std::move(site));
+    }
+    std::sort(s.begin(), s.end(),
+        [](const PatchableSite& a, const PatchableSite& b) { return a.addr < b.addr; });
+
+    for (auto& site : s) {
+        detail::register_trace_point(&site.entry_enabled, site.module, 0, site.function, "func-entry", "",
+                                     &on_site_change, &site);
+        detail::register_trace_point(&site.exit_enabled, site.module, 0, site.function, "func-exit", "",
+                                     &on_site_change, &site);
+    }
+}
+
+} // namespace
+} // namespace ytrace
+
+extern "C" void ytrace_patchable_on_entry(uint8_t* addr, uintptr_t* parent_ret) {
+    using namespace ytrace;
+    if (t_in_handler) return;
+    PatchableSite* site = find_site(addr);
+    if (!site) return;
+
+    t_in_handler = true;
+    if (site->entry_enabled) {
+        detail::emit("func-entry", site->module, 0, site->function, "");
+    }
+    if (site->exit_enabled && t_shadow_depth < YTRACE_PATCHABLE_SHADOW_DEPTH) {
+        t_shadow[t_shadow_depth++] = ShadowFrame{site, *parent_ret, std::chrono::steady_clock::now()};
+        *parent_ret = reinterpret_cast<uintptr_t>(&ytrace_patchable_exit_trampoline);
+    }
+    t_in_handler = false;
+}
+
+extern "C" uintptr_t ytrace_patchable_on_exit() {
+    using namespace ytrace;
+    ShadowFrame frame = t_shadow[--t_shadow_depth];
+    if (t_in_handler) return frame.return_address;
+
+    t_in_handler = true;
+    double elapsed_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - frame.start).count());
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "elapsed: %s", format_duration(elapsed_ns).c_str());
+    detail::emit("func-exit", frame.site->module, 0, frame.site->function, buf);
+    TimerManager::instance().record_measured(frame.site->timer_key, elapsed_ns);
+    t_in_handler = false;
+    return frame.return_address;
+}
@@ -0,0 +1,165 @@
+// LD_PRELOAD shim timing I/O calls into TimerManager (Linux). Built as a shared library,
+// libytrace_preload.so; the hooks reach libc's definitions through dlsym(RTLD_NEXT).
+
+// The fortified inline wrappers of read/recv/poll would clash with the definitions here
+#undef _FORTIFY_SOURCE
+
+#include <ytrace/preload.hpp>
+
+#include <cerrno>
+#include <chrono>
+#include <dlfcn.h>
+#include <poll.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if !defined(__linux__)
+#error "libytrace_preload requires Linux"
+#endif
+
+namespace ytrace {
+namespace {
+
+enum Call { kRead, kWrite, kSend, kRecv, kFsync, kFdatasync, kPoll, kEpollWait, kCalls };
+
+const char* const kCallNames[kCalls] = {"read", "write", "send", "recv", "fsync", "fdatasync", "poll", "epoll_wait"};
+
+// Trace point flags, one per call
+bool g_enabled[kCalls] = {};
+
+// Set while the shim records on this thread: TimerManager may itself read, write or wait
+thread_local bool t_in_hook = false;
+
+enum FdKind : uint8_t { kUnknown, kFile, kSocket, kPipe, kDevice, kOther };
+
+const char* const kKindNames[] = {"other", "file", "socket", "pipe", "device", "other"};
+
+std::atomic<uint8_t> g_fd_kinds[YTRACE_PRELOAD_FDS];
+
+template<typename Fn>
+Fn resolve_next(const char* name) {
+    void* fn = dlsym(RTLD_NEXT, name);
+    if (!fn) {
+        std::fprintf(stderr, "[ytrace] %s not found after libytrace_preload\n", name);
+        std::abort();
+    }
+    return reinterpret_cast<Fn>(fn);
+}
+
+// Kind of fd, from one fstat on first use of the number
+FdKind fd_kind(int fd) {
+    if (fd < 0 || fd >= YTRACE_PRELOAD_FDS) return kOther;
+    uint8_t kind = g_fd_kinds[fd].load(std::memory_order_relaxed);
+    if (kind != kUnknown) return static_cast<FdKind>(kind);
+    struct stat st;
+    if (fstat(fd, &st) != 0) return kOther;
+    if (S_ISREG(st.st_mode)) kind = kFile;
+    else if (S_ISSOCK(st.st_mode)) kind = kSocket;
+    else if (S_ISFIFO(st.st_mode)) kind = kPipe;
+    else if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) kind = kDevice;
+    else kind = kOther;
+    g_fd_kinds[fd].store(kind, std::memory_order_relaxed);
+    return static_cast<FdKind>(kind);
+}
+
+// Time fn() and record it as "<call>(<kind>) in <scope>"; fd < 0 for calls without one.
+// errno is that of the call.
+template<typename Fn>
+auto timed(Call call, int fd, Fn&& fn) {
+    if (!g_enabled[call] || t_in_hook) return fn();
+    auto start = std::chrono::steady_clock::now();
+    auto result = fn();
+    auto end = std::chrono::steady_clock::now();
+    int saved_errno = errno;
+    t_in_hook = true;
+    char key[256];
+    int n = fd >= 0 ? std::snprintf(key, sizeof(key), "%s(%s)", kCallNames[call], kKindNames[fd_kind(fd)])
+                    : std::snprintf(key, sizeof(key), "%s()", kCallNames[call]);
+    if (const char* scope = detail::t_scope; scope && n > 0 && static_cast<size_t>(n) < sizeof(key)) {
+        std::snprintf(key + n, sizeof(key) - n, " in %s", scope);
+    }
+    TimerManager::instance().record_measured(
+        key, static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+    t_in_hook = false;
+    errno = saved_errno;
+    return result;
+}
+
+// True if the application exports its ytrace symbols: TraceManager::instance() then
+// resolves to its copy rather than to this library's
+bool shares_application_manager() {
+    Dl_info manager, self;
+    return dladdr(reinterpret_cast<void*>(&TraceManager::instance), &manager) &&
+           dladdr(reinterpret_cast<void*>(&shares_application_manager), &self) &&
+           manager.dli_fbase != self.dli_fbase;
+}
+
+__attribute__((constructor)) void init_preload() {
+    CallPath::instance().track_scopes(true);
+    for (int call = 0; call < kCalls; ++call) {
+        detail::register_trace_point(&g_enabled[call], "libytrace_preload.so", 0, kCallNames[call], "syscall", "");
+    }
+    auto& mgr = TraceManager::instance();
+    std::string path = mgr.get_socket_path();
+    // A separate copy would contend for the application's path (each unlinks the other's
+    // socket), so it listens on <path>.preload.sock instead
+    if (!shares_application_manager() && path.ends_with(".sock")) path.insert(path.size() - 5, ".preload");
+    mgr.open_ctrl_socket(path.c_str());  // false if the application opened it
+}
+
+} // namespace
+} // namespace ytrace
+
+extern "C" {
+
+ssize_t read(int fd, void* buf, size_t count) {
+    static const auto real = ytrace::resolve_next<ssize_t (*)(int, void*, size_t)>("read");
+    return ytrace::timed(ytrace::kRead, fd, [&] { return real(fd, buf, count); });
+}
+
+ssize_t write(int fd, const void* buf, size_t count) {
+    static const auto real = ytrace::resolve_next<ssize_t (*)(int, const void*, size_t)>("write");
+    return ytrace::timed(ytrace::kWrite, fd, [&] { return real(fd, buf, count); });
+}
+
+ssize_t send(int fd, const void* buf, size_t len, int flags) {
+    static const auto real = ytrace::resolve_next<ssize_t (*)(int, const void*, size_t, int)>("send");
+    return ytrace::timed(ytrace::kSend, fd, [&] { return real(fd, buf, len, flags); });
+}
+
+ssize_t recv(int fd, void* buf, size_t len, int flags) {
+    static const auto real = ytrace::resolve_next<ssize_t (*)(int, void*, size_t, int)>("recv");
+    return ytrace::timed(ytrace::kRecv, fd, [&] { return real(fd, buf, len, flags); });
+}
+
+int fsync(int fd) {
+    static const auto real = ytrace::resolve_next<int (*)(int)>("fsync");
+    return ytrace::timed(ytrace::kFsync, fd, [&] { return real(fd); });
+}
+
+int fdatasync(int fd) {
+    static const auto real = ytrace::resolve_next<int (*)(int)>("fdatasync");
+    return ytrace::timed(ytrace::kFdatasync, fd, [&] { return real(fd); });
+}
+
+int poll(struct pollfd* fds, nfds_t nfds, int timeout) {
+    static const auto real = ytrace::resolve_next<int (*)(struct pollfd*, nfds_t, int)>("poll");
+    return ytrace::timed(ytrace::kPoll, -1, [&] { return real(fds, nfds, timeout); });
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+    static const auto real = ytrace::resolve_next<int (*)(int, struct epoll_event*, int, int)>("epoll_wait");
+    return ytrace::timed(ytrace::kEpollWait, -1, [&] { return real(epfd, events, maxevents, timeout); });
+}
+
+// Not timed: forgets the kind of fd, whose number the next open may reuse
+int close(int fd) {
+    static const auto real = ytrace::resolve_next<int (*)(int)>("close");
+    if (fd >= 0 && fd < YTRACE_PRELOAD_FDS) ytrace::g_fd_kinds[fd].store(ytrace::kUnknown, std::memory_order_relaxed);
+    return real(fd);
+}
+
+} // extern "C"
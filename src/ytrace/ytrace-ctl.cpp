@@ -1,4 +1,6 @@
 #include <args/args.hxx>
+#include <ytrace/compress.hpp>
+#include <ytrace/match.hpp>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -7,6 +9,14 @@
 #include <vector>
 #include <sstream>
 #include <filesystem>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <iomanip>
+#include <cstdio>
+#include <functional>
+#include <string_view>
+#include <charconv>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -22,26 +32,32 @@
 #endif
 
 struct TracePoint {
+    size_t index = 0;       // position in the process's list (stable for its lifetime)
     std::string file;
     int line;
     std::string function;
     std::string level;
     std::string message;
     bool enabled;
+    std::string state;      // per-point extras after the message (e.g. "sample=1/64 calls=...")
+    std::string category;   // from "cat=<name>" in state, empty if untagged
 };
 
 // Forward declarations
 std::vector<std::string> find_all_sockets();
 int extract_pid_from_socket(const std::string& socket_path);
 
+// Prefers the application's socket to that of a separate libytrace_preload copy
 std::string find_socket_by_pid(int pid) {
     std::vector<std::string> sockets = find_all_sockets();
+    std::string preload;
     for (const auto& socket : sockets) {
         if (extract_pid_from_socket(socket) == pid) {
-            return socket;
+            if (socket.find(".preload.sock") == std::string::npos) return socket;
+            preload = socket;
         }
     }
-    return "";  // Not found
+    return preload;  // "" if not found
 }
 
 std::vector<std::string> find_all_sockets() {
@@ -157,7 +173,10 @@ std::vector<YtraceProcess> find_live_processes() {
     return result;
 }
 
-std::string send_command(const std::string& socket_path, const std::string& command) {
+// Send a command and pass the response to on_data as it arrives; returns an "ERROR: ..."
+// message if the process cannot be reached, empty otherwise
+std::string send_command(const std::string& socket_path, const std::string& command,
+                         const std::function<void(std::string_view)>& on_data) {
 #ifdef _WIN32
     WSADATA wsa;
     if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
@@ -198,16 +217,14 @@ std::string send_command(const std::string& socket_path, const std::string& comm
 #endif
 
     // Read response
-    std::string response;
-    char buffer[4096];
+    char buffer[65536];
     int bytes;
 #ifdef _WIN32
-    while ((bytes = recv(fd, buffer, sizeof(buffer) - 1, 0)) > 0) {
+    while ((bytes = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
 #else
-    while ((bytes = static_cast<int>(read(fd, buffer, sizeof(buffer) - 1))) > 0) {
+    while ((bytes = static_cast<int>(read(fd, buffer, sizeof(buffer)))) > 0) {
 #endif
-        buffer[bytes] = '\0';
-        response += buffer;
+        on_data(std::string_view(buffer, static_cast<size_t>(bytes)));
     }
 
 #ifdef _WIN32
@@ -216,36 +233,416 @@ std::string send_command(const std::string& socket_path, const std::string& comm
 #else
     close(fd);
 #endif
-    return response;
+    return "";
+}
+
+std::string send_command(const std::string& socket_path, const std::string& command) {
+    std::string response;
+    std::string error = send_command(socket_path, command, [&](std::string_view data) { response += data; });
+    return error.empty() ? response : error;
+}
+
+// Parse "<file>:<line> (<function>) "<message>"<state>" (the tail of a list line) with
+// the file ending at colon p; false if the text after p does not have that shape
+static bool parse_point_location(std::string_view rest, size_t p, TracePoint& tp) {
+    auto skip_space = [&](size_t i) { while (i < rest.size() && std::isspace(static_cast<unsigned char>(rest[i]))) ++i; return i; };
+    size_t i = p + 1, digits = i;
+    while (i < rest.size() && std::isdigit(static_cast<unsigned char>(rest[i]))) ++i;
+    if (i == digits || i == skip_space(i)) return false;
+    size_t line_end = i;
+    i = skip_space(i);
+    if (i >= rest.size() || rest[i] != '(') return false;
+    size_t close = rest.find(')', i + 1);
+    if (close == std::string_view::npos || close == i + 1) return false;
+    size_t quote = skip_space(close + 1);
+    if (quote == close + 1 || quote >= rest.size() || rest[quote] != '"') return false;
+    size_t end_quote = rest.find('"', quote + 1);
+    if (end_quote == std::string_view::npos) return false;
+    tp.file = std::string(rest.substr(0, p));
+    tp.line = std::stoi(std::string(rest.substr(p + 1, line_end - p - 1)));
+    tp.function = std::string(rest.substr(i + 1, close - i - 1));
+    tp.message = std::string(rest.substr(quote + 1, end_quote - quote - 1));
+    tp.state = std::string(rest.substr(end_quote + 1));
+    return true;
 }
 
 // Parse list response into TracePoint structs
-// Format: "0 [ON]  [level] /path/file.cpp:123 (function_name) "message""
+// Format: "0 [ON]  [level] /path/file.cpp:123 (function_name) "message" [state...]"
+// Hand-parsed (no std::regex): listing 100k points stays in the milliseconds.
 std::vector<TracePoint> parse_trace_points(const std::string& response) {
     std::vector<TracePoint> points;
     std::istringstream iss(response);
-    std::string line;
-    
-    // Regex to parse: "0 [ON]  [level] /path/file.cpp:123 (function_name) "message""
-    std::regex line_re(R"regex(^\d+\s+\[(ON|OFF)\]\s+\[([^\]]+)\]\s+(.+):(\d+)\s+\(([^)]+)\)\s+"([^"]*)")regex");
+    std::string text;
     
-    while (std::getline(iss, line)) {
-        std::smatch match;
-        if (std::regex_search(line, match, line_re)) {
-            TracePoint tp;
-            tp.enabled = (match[1] == "ON");
-            tp.level = match[2];
-            tp.file = match[3];
-            tp.line = std::stoi(match[4]);
-            tp.function = match[5];
-            tp.message = match[6];
-            points.push_back(tp);
+    while (std::getline(iss, text)) {
+        std::string_view line(text);
+        TracePoint tp;
+        size_t i = 0;
+        while (i < line.size() && std::isdigit(static_cast<unsigned char>(line[i]))) ++i;
+        if (i == 0 || i >= line.size() || !std::isspace(static_cast<unsigned char>(line[i]))) continue;
+        tp.index = std::stoul(std::string(line.substr(0, i)));
+        while (i < line.size() && std::isspace(static_cast<unsigned char>(line[i]))) ++i;
+        if (line.substr(i, 4) == "[ON]") { tp.enabled = true; i += 4; }
+        else if (line.substr(i, 5) == "[OFF]") { tp.enabled = false; i += 5; }
+        else continue;
+        while (i < line.size() && std::isspace(static_cast<unsigned char>(line[i]))) ++i;
+        size_t level_end = line.find(']', i);
+        if (i >= line.size() || line[i] != '[' || level_end == std::string_view::npos || level_end == i + 1) continue;
+        tp.level = std::string(line.substr(i + 1, level_end - i - 1));
+        i = level_end + 1;
+        size_t file_start = i;
+        while (file_start < line.size() && std::isspace(static_cast<unsigned char>(line[file_start]))) ++file_start;
+        if (file_start == i) continue;
+        std::string_view rest = line.substr(file_start);
+
+        // The file name may contain colons; like a greedy regex, take the last colon that works
+        bool parsed = false;
+        for (size_t p = rest.rfind(':'); p != std::string_view::npos && p > 0 && !parsed; p = rest.rfind(':', p - 1)) {
+            parsed = parse_point_location(rest, p, tp);
         }
+        if (!parsed) continue;
+        for (size_t at = tp.state.find("cat="); at != std::string::npos; at = tp.state.find("cat=", at + 1)) {
+            if (at > 0 && (std::isalnum(static_cast<unsigned char>(tp.state[at - 1])) || tp.state[at - 1] == '_')) continue;
+            size_t end = at + 4;
+            while (end < tp.state.size() && !std::isspace(static_cast<unsigned char>(tp.state[end]))) ++end;
+            if (end > at + 4) tp.category = tp.state.substr(at + 4, end - at - 4);
+            break;
+        }
+        points.push_back(std::move(tp));
     }
     return points;
 }
 
-// Filter trace points based on --all, --file, --function, --line, --level, --message flags
+// Executable segment of a traced process ("map <start> <end> <base> <build-id|-> <path>"
+// lines of the maps command and of captures)
+struct ModuleMap {
+    uint64_t start = 0, end = 0, base = 0;
+    std::string build_id;   // hex, empty if unknown
+    std::string path;
+};
+
+std::vector<ModuleMap> parse_maps(const std::string& text) {
+    std::vector<ModuleMap> maps;
+    std::istringstream iss(text);
+    std::string line;
+    while (std::getline(iss, line)) {
+        if (line.rfind("map ", 0) != 0) continue;
+        std::istringstream ls(line.substr(4));
+        std::string start, end, base;
+        ModuleMap m;
+        ls >> start >> end >> base >> m.build_id;
+        std::getline(ls >> std::ws, m.path);
+        try {
+            m.start = std::stoull(start, nullptr, 16);
+            m.end = std::stoull(end, nullptr, 16);
+            m.base = std::stoull(base, nullptr, 16);
+        } catch (...) { continue; }
+        if (m.build_id == "-") m.build_id.clear();
+        maps.push_back(m);
+    }
+    return maps;
+}
+
+// GNU build-id of an ELF file (little-endian ELF32/ELF64), "" if none
+std::string read_build_id(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    unsigned char ident[64] = {};
+    if (!file.read(reinterpret_cast<char*>(ident), sizeof(ident))) return "";
+    if (std::memcmp(ident, "\x7f" "ELF", 4) != 0 || ident[5] != 1) return "";
+    auto le = [](const unsigned char* p, int n) {
+        uint64_t v = 0;
+        for (int i = n - 1; i >= 0; --i) v = (v << 8) | p[i];
+        return v;
+    };
+    bool is64 = ident[4] == 2;
+    uint64_t phoff = is64 ? le(ident + 32, 8) : le(ident + 28, 4);
+    uint64_t phentsize = is64 ? le(ident + 54, 2) : le(ident + 42, 2);
+    uint64_t phnum = is64 ? le(ident + 56, 2) : le(ident + 44, 2);
+    for (uint64_t i = 0; i < phnum; ++i) {
+        unsigned char ph[56] = {};
+        file.seekg(static_cast<std::streamoff>(phoff + i * phentsize));
+        if (!file.read(reinterpret_cast<char*>(ph), is64 ? 56 : 32)) return "";
+        if (le(ph, 4) != 4) continue;  // PT_NOTE
+        uint64_t offset = is64 ? le(ph + 8, 8) : le(ph + 4, 4);
+        uint64_t size = is64 ? le(ph + 32, 8) : le(ph + 16, 4);
+        std::vector<unsigned char> notes(static_cast<size_t>(std::min<uint64_t>(size, 1 << 16)));
+        file.seekg(static_cast<std::streamoff>(offset));
+        if (!file.read(reinterpret_cast<char*>(notes.data()), static_cast<std::streamsize>(notes.size()))) continue;
+        size_t pos = 0;
+        while (pos + 12 <= notes.size()) {
+            uint64_t namesz = le(&notes[pos], 4), descsz = le(&notes[pos + 4], 4), type = le(&notes[pos + 8], 4);
+            size_t name = pos + 12;
+            size_t desc = name + ((namesz + 3) & ~uint64_t(3));
+            if (desc + descsz > notes.size()) break;
+            if (type == 3 && namesz == 4 && std::memcmp(&notes[name], "GNU", 4) == 0) {
+                std::ostringstream hex;
+                for (size_t j = 0; j < descsz; ++j) {
+                    hex << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(notes[desc + j]);
+                }
+                return hex.str();
+            }
+            pos = desc + ((descsz + 3) & ~uint64_t(3));
+        }
+    }
+    return "";
+}
+
+// Offline symbolizer for addresses within modules (pc - load base, as addr2line expects).
+// A module's file is the one in the debuginfo directory keyed by build-id
+// (DIR/.build-id/ab/cdef....debug) or the mapped path if its build-id matches. Results are
+// memoized in memory and, per build-id, in ~/.cache/ytrace/symbols/<build-id>.
+class Symbolizer {
+public:
+    struct Symbol {
+        std::string function;   // demangled, "" if unknown
+        std::string location;   // file:line, "" if unknown
+    };
+
+    Symbolizer(std::string debuginfo_dir, bool use_cache)
+        : debuginfo_dir_(std::move(debuginfo_dir)), use_cache_(use_cache) {}
+
+    // Queue an address for resolve()
+    void request(const std::string& path, const std::string& build_id, uint64_t address) {
+        Module& m = module(path, build_id);
+        if (!m.symbols.count(address)) m.pending.insert(address);
+    }
+
+    // Resolve all queued addresses: one addr2line run per module
+    void resolve() {
+        for (auto& [key, m] : modules_) {
+            if (m.pending.empty()) continue;
+            std::vector<uint64_t> addrs(m.pending.begin(), m.pending.end());
+            m.pending.clear();
+            std::string file = locate(m);
+            std::vector<Symbol> symbols = file.empty() ? std::vector<Symbol>(addrs.size()) : addr2line(file, addrs);
+            std::ofstream cache;
+            if (use_cache_ && !m.build_id.empty()) {
+                std::filesystem::create_directories(cache_dir());
+                cache.open(cache_dir() + "/" + m.build_id, std::ios::app);
+            }
+            for (size_t i = 0; i < addrs.size(); ++i) {
+                m.symbols[addrs[i]] = symbols[i];
+                if (cache && !symbols[i].function.empty()) {
+                    cache << std::hex << addrs[i] << std::dec << "\t" << symbols[i].function << "\t"
+                          << symbols[i].location << "\n";
+                }
+            }
+        }
+    }
+
+    Symbol lookup(const std::string& path, const std::string& build_id, uint64_t address) {
+        Module& m = module(path, build_id);
+        auto it = m.symbols.find(address);
+        return it != m.symbols.end() ? it->second : Symbol{};
+    }
+
+private:
+    struct Module {
+        std::string path, build_id;
+        std::map<uint64_t, Symbol> symbols;
+        std::set<uint64_t> pending;
+    };
+
+    static std::string cache_dir() {
+        const char* home = std::getenv("HOME");
+        return std::string(home ? home : "/tmp") + "/.cache/ytrace/symbols";
+    }
+
+    Module& module(const std::string& path, const std::string& build_id) {
+        std::string key = build_id.empty() ? path : build_id;
+        auto it = modules_.find(key);
+        if (it != modules_.end()) return it->second;
+        Module& m = modules_[key];
+        m.path = path;
+        m.build_id = build_id;
+        if (use_cache_ && !build_id.empty()) {
+            std::ifstream cache(cache_dir() + "/" + build_id);
+            std::string line;
+            while (std::getline(cache, line)) {
+                size_t t1 = line.find('\t'), t2 = line.find('\t', t1 + 1);
+                if (t1 == std::string::npos || t2 == std::string::npos) continue;
+                // A damaged cache line is skipped; the address is symbolized again
+                uint64_t address = 0;
+                auto [end, ec] = std::from_chars(line.data(), line.data() + t1, address, 16);
+                if (ec != std::errc{} || end != line.data() + t1) continue;
+                m.symbols[address] = Symbol{line.substr(t1 + 1, t2 - t1 - 1), line.substr(t2 + 1)};
+            }
+        }
+        return m;
+    }
+
+    std::string locate(const Module& m) const {
+        namespace fs = std::filesystem;
+        if (!m.build_id.empty() && m.build_id.size() > 2) {
+            std::string rel = m.build_id.substr(0, 2) + "/" + m.build_id.substr(2) + ".debug";
+            std::vector<std::string> dirs;
+            if (!debuginfo_dir_.empty()) {
+                dirs.push_back(debuginfo_dir_ + "/.build-id/");
+                dirs.push_back(debuginfo_dir_ + "/");
+            }
+            dirs.push_back("/usr/lib/debug/.build-id/");
+            for (const auto& dir : dirs) {
+                std::error_code ec;
+                if (fs::exists(dir + rel, ec)) return dir + rel;
+            }
+        }
+        std::error_code ec;
+        if (!m.path.empty() && fs::exists(m.path, ec) &&
+            (m.build_id.empty() || read_build_id(m.path) == m.build_id)) {
+            return m.path;
+        }
+        return "";
+    }
+
+    static std::vector<Symbol> addr2line(const std::string& file, const std::vector<uint64_t>& addrs) {
+        std::vector<Symbol> result(addrs.size());
+#ifndef _WIN32
+        std::string quoted = "'";
+        for (char c : file) quoted += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+        quoted += "'";
+        // -a prints each address before its block; -i adds the inline chain, whose last
+        // entry is the function the address physically belongs to
+        std::ostringstream cmd;
+        cmd << "addr2line -a -i -f -C -e " << quoted << std::hex;
+        for (uint64_t a : addrs) cmd << " 0x" << a;
+        cmd << " 2>/dev/null";
+        FILE* pipe = popen(cmd.str().c_str(), "r");
+        if (!pipe) return result;
+        char buf[4096];
+        std::vector<std::string> block;
+        size_t index = 0;
+        bool started = false;
+        auto finish_block = [&]() {
+            if (index < result.size() && block.size() >= 2) {
+                const std::string& function = block[block.size() - 2];
+                const std::string& location = block.back();
+                if (function != "??") result[index].function = function;
+                if (location.rfind("??", 0) != 0) result[index].location = location;
+            }
+            block.clear();
+        };
+        while (fgets(buf, sizeof(buf), pipe)) {
+            std::string line(buf);
+            line.erase(line.find_last_not_of("\r\n") + 1);
+            if (line.rfind("0x", 0) == 0) {
+                if (started) {
+                    finish_block();
+                    ++index;
+                }
+                started = true;
+            } else {
+                block.push_back(line);
+            }
+        }
+        if (started) finish_block();
+        pclose(pipe);
+#else
+        (void)file;
+        (void)addrs;
+#endif
+        return result;
+    }
+
+    std::string debuginfo_dir_;
+    bool use_cache_;
+    std::map<std::string, Module> modules_;  // by build-id, or path if it has none
+};
+
+// Symbolize a stacks response and/or trace output against the given maps:
+//   "  0xPC 0xADDR module" stack frames become "  N  function at file:line" (frames are
+//   return addresses, so the call site ADDR-1 is looked up);
+//   other 0x... tokens inside a mapped module (raw function names of instrumented
+//   builds) become the function name.
+// "map" lines are dropped from the output.
+std::string symbolize_text(const std::string& text, const std::vector<ModuleMap>& maps, Symbolizer& symbolizer) {
+    static const std::regex frame_re(R"regex(^  (0x[0-9a-fA-F]+)(?: (0x[0-9a-fA-F]+) (.+))?$)regex");
+    static const std::regex addr_re(R"regex(0x[0-9a-fA-F]{6,16})regex");
+    auto build_id_of = [&](const std::string& path) {
+        for (const auto& m : maps) {
+            if (m.path == path) return m.build_id;
+        }
+        return std::string();
+    };
+    auto find_map = [&](uint64_t pc) -> const ModuleMap* {
+        for (const auto& m : maps) {
+            if (pc >= m.start && pc < m.end) return &m;
+        }
+        return nullptr;
+    };
+
+    std::vector<std::string> lines;
+    std::istringstream iss(text);
+    std::string line;
+    while (std::getline(iss, line)) {
+        if (line.rfind("map ", 0) != 0) lines.push_back(line);
+    }
+
+    // Pass 1: queue every address, so each module is symbolized in one batch
+    for (const auto& l : lines) {
+        std::smatch m;
+        if (std::regex_match(l, m, frame_re)) {
+            if (m[3].matched) {
+                symbolizer.request(m[3], build_id_of(m[3]), std::stoull(m[2], nullptr, 16) - 1);
+            }
+            continue;
+        }
+        for (auto it = std::sregex_iterator(l.begin(), l.end(), addr_re); it != std::sregex_iterator(); ++it) {
+            uint64_t pc = std::stoull(it->str(), nullptr, 16);
+            if (const ModuleMap* map = find_map(pc)) symbolizer.request(map->path, map->build_id, pc - map->base);
+        }
+    }
+    symbolizer.resolve();
+
+    // Pass 2: render
+    std::ostringstream out;
+    int frame = 0;
+    for (const auto& l : lines) {
+        std::smatch m;
+        if (std::regex_match(l, m, frame_re)) {
+            out << "  " << frame++ << "  ";
+            if (!m[3].matched) {
+                out << m[1] << "\n";
+                continue;
+            }
+            auto sym = symbolizer.lookup(m[3], build_id_of(m[3]), std::stoull(m[2], nullptr, 16) - 1);
+            if (sym.function.empty()) out << m[3] << "+" << m[2] << "\n";
+            else out << sym.function << (sym.location.empty() ? "" : " at " + sym.location) << "\n";
+            continue;
+        }
+        frame = 0;
+        std::string rendered;
+        size_t last = 0;
+        for (auto it = std::sregex_iterator(l.begin(), l.end(), addr_re); it != std::sregex_iterator(); ++it) {
+            uint64_t pc = std::stoull(it->str(), nullptr, 16);
+            std::string replacement = it->str();
+            if (const ModuleMap* map = find_map(pc)) {
+                auto sym = symbolizer.lookup(map->path, map->build_id, pc - map->base);
+                if (!sym.function.empty()) replacement = sym.function;
+            }
+            rendered += l.substr(last, it->position() - last) + replacement;
+            last = it->position() + it->length();
+        }
+        out << rendered << l.substr(last) << "\n";
+    }
+    return out.str();
+}
+
+// Compile regex filter patterns; invalid or unsupported ones are reported and skipped
+std::vector<ytrace::Pattern> compile_patterns(const std::vector<std::string>& patterns, const char* flag) {
+    std::vector<ytrace::Pattern> compiled;
+    for (const auto& pat : patterns) {
+        std::string error;
+        ytrace::Pattern pattern;
+        if (pattern.compile(pat, ytrace::Pattern::Syntax::regex, error)) {
+            compiled.push_back(std::move(pattern));
+        } else {
+            std::cerr << "Warning: Invalid regex for " << flag << ": " << pat << " (" << error << ")\n";
+        }
+    }
+    return compiled;
+}
+
+// Filter trace points based on --all, --file, --function, --line, --level, --message, --category flags
 std::vector<TracePoint> filter_trace_points(
     const std::vector<TracePoint>& points,
     bool all_flag,
@@ -253,11 +650,12 @@ std::vector<TracePoint> filter_trace_points(
     const std::vector<std::string>& function_patterns,
     const std::vector<int>& lines,
     const std::vector<std::string>& level_patterns,
-    const std::vector<std::string>& message_patterns)
+    const std::vector<std::string>& message_patterns,
+    const std::vector<std::string>& categories = {})
 {
     // No filter specified = no matches (safe default)
     if (!all_flag && file_patterns.empty() && function_patterns.empty() && 
-        lines.empty() && level_patterns.empty() && message_patterns.empty()) {
+        lines.empty() && level_patterns.empty() && message_patterns.empty() && categories.empty()) {
         return {};
     }
     
@@ -268,49 +666,18 @@ std::vector<TracePoint> filter_trace_points(
     
     std::vector<TracePoint> result;
     
-    // Compile regexes for file and function patterns
-    std::vector<std::regex> file_regexes;
-    for (const auto& pat : file_patterns) {
-        try {
-            file_regexes.emplace_back(pat);
-        } catch (const std::regex_error&) {
-            std::cerr << "Warning: Invalid regex for --file: " << pat << "\n";
-        }
-    }
-    
-    std::vector<std::regex> func_regexes;
-    for (const auto& pat : function_patterns) {
-        try {
-            func_regexes.emplace_back(pat);
-        } catch (const std::regex_error&) {
-            std::cerr << "Warning: Invalid regex for --function: " << pat << "\n";
-        }
-    }
-    
-    std::vector<std::regex> level_regexes;
-    for (const auto& pat : level_patterns) {
-        try {
-            level_regexes.emplace_back(pat);
-        } catch (const std::regex_error&) {
-            std::cerr << "Warning: Invalid regex for --level: " << pat << "\n";
-        }
-    }
-    
-    std::vector<std::regex> msg_regexes;
-    for (const auto& pat : message_patterns) {
-        try {
-            msg_regexes.emplace_back(pat);
-        } catch (const std::regex_error&) {
-            std::cerr << "Warning: Invalid regex for --message: " << pat << "\n";
-        }
-    }
+    // Compile the patterns (linear-time matcher; invalid ones are reported and skipped)
+    auto file_regexes = compile_patterns(file_patterns, "--file");
+    auto func_regexes = compile_patterns(function_patterns, "--function");
+    auto level_regexes = compile_patterns(level_patterns, "--level");
+    auto msg_regexes = compile_patterns(message_patterns, "--message");
     
     for (const auto& tp : points) {
         bool match = false;
         
         // Check file patterns (OR)
         for (const auto& re : file_regexes) {
-            if (std::regex_search(tp.file, re)) {
+            if (re.search(tp.file)) {
                 match = true;
                 break;
             }
@@ -319,7 +686,7 @@ std::vector<TracePoint> filter_trace_points(
         // Check function patterns (OR)
         if (!match) {
             for (const auto& re : func_regexes) {
-                if (std::regex_search(tp.function, re)) {
+                if (re.search(tp.function)) {
                     match = true;
                     break;
                 }
@@ -339,7 +706,7 @@ std::vector<TracePoint> filter_trace_points(
         // Check level patterns (OR)
         if (!match) {
             for (const auto& re : level_regexes) {
-                if (std::regex_search(tp.level, re)) {
+                if (re.search(tp.level)) {
                     match = true;
                     break;
                 }
@@ -349,7 +716,17 @@ std::vector<TracePoint> filter_trace_points(
         // Check message patterns (OR)
         if (!match) {
             for (const auto& re : msg_regexes) {
-                if (std::regex_search(tp.message, re)) {
+                if (re.search(tp.message)) {
+                    match = true;
+                    break;
+                }
+            }
+        }
+        
+        // Check categories (exact name, OR)
+        if (!match && !tp.category.empty()) {
+            for (const auto& cat : categories) {
+                if (tp.category == cat) {
                     match = true;
                     break;
                 }
@@ -364,6 +741,125 @@ std::vector<TracePoint> filter_trace_points(
     return result;
 }
 
+// Stream a trace file to out: FileSink blocks are decompressed one at a time, plain text
+// passes through. Returns false (with a message in error) on a corrupt block.
+bool stream_trace_file(std::istream& in, std::ostream& out, std::string& error) {
+    char magic[sizeof(ytrace::lz::kBlockMagic)];
+    in.read(magic, sizeof(magic));
+    std::string_view head(magic, static_cast<size_t>(in.gcount()));
+    if (!ytrace::lz::is_block_stream(head)) {
+        out << head << in.rdbuf();
+        return true;
+    }
+    std::string raw;
+    for (size_t block = 0;; ++block) {
+        switch (ytrace::lz::read_block(in, raw, block == 0)) {
+        case ytrace::lz::BlockStatus::ok:
+            out.write(raw.data(), static_cast<std::streamsize>(raw.size()));
+            break;
+        case ytrace::lz::BlockStatus::end:
+            return true;
+        case ytrace::lz::BlockStatus::corrupt:
+            error = "corrupt or truncated block " + std::to_string(block);
+            return false;
+        }
+    }
+}
+
+// One per-second count series of a history-dump response
+struct HistorySeries {
+    std::string name;
+    std::vector<uint64_t> counts;  // oldest first
+};
+
+// Parse "point <index> <csv>" and "timer <csv> <label>" lines; points are named from the list
+std::vector<HistorySeries> parse_history(const std::string& dump, const std::vector<TracePoint>& points,
+                                         const std::set<size_t>& point_indices,
+                                         const std::vector<ytrace::Pattern>& timer_res, bool all) {
+    auto parse_csv = [](const std::string& csv) {
+        std::vector<uint64_t> out;
+        std::istringstream iss(csv);
+        std::string n;
+        while (std::getline(iss, n, ',')) out.push_back(std::strtoull(n.c_str(), nullptr, 10));
+        return out;
+    };
+    std::vector<HistorySeries> series;
+    std::istringstream iss(dump);
+    std::string line;
+    while (std::getline(iss, line)) {
+        std::istringstream ls(line);
+        std::string kind, csv;
+        ls >> kind;
+        if (kind == "point") {
+            size_t index = 0;
+            ls >> index >> csv;
+            if (!all && !point_indices.count(index)) continue;
+            auto tp = std::find_if(points.begin(), points.end(), [&](const TracePoint& p) { return p.index == index; });
+            if (tp == points.end()) continue;
+            series.push_back({tp->file + ":" + std::to_string(tp->line) + " (" + tp->function + ") \"" +
+                              tp->message + "\"", parse_csv(csv)});
+        } else if (kind == "timer") {
+            std::string label;
+            ls >> csv;
+            std::getline(ls >> std::ws, label);
+            bool match = all;
+            for (const auto& re : timer_res) match = match || re.search(label);
+            if (match) series.push_back({"timer " + label, parse_csv(csv)});
+        }
+    }
+    // Series that started later are shorter; left-pad them so all end at the same second
+    size_t seconds = 0;
+    for (const auto& s : series) seconds = std::max(seconds, s.counts.size());
+    for (auto& s : series) s.counts.insert(s.counts.begin(), seconds - s.counts.size(), 0);
+    return series;
+}
+
+// One row per second ("second" is relative to now, 0 = last full second)
+void print_history_csv(const std::vector<HistorySeries>& series) {
+    std::cout << "second";
+    for (const auto& s : series) {
+        std::string name;
+        for (char c : s.name) name += (c == '"') ? std::string("\"\"") : std::string(1, c);
+        std::cout << ",\"" << name << "\"";
+    }
+    std::cout << "\n";
+    size_t seconds = series.empty() ? 0 : series[0].counts.size();
+    for (size_t i = 0; i < seconds; ++i) {
+        std::cout << -static_cast<long long>(seconds - 1 - i);
+        for (const auto& s : series) std::cout << "," << s.counts[i];
+        std::cout << "\n";
+    }
+}
+
+// Sparkline per series, width characters at most (each character sums as many seconds as needed)
+void print_history_sparklines(const std::vector<HistorySeries>& series, size_t width) {
+    static const char* const kBars[] = {" ", "\u2581", "\u2582", "\u2583", "\u2584",
+                                        "\u2585", "\u2586", "\u2587", "\u2588"};
+    size_t seconds = series.empty() ? 0 : series[0].counts.size();
+    size_t per_char = std::max<size_t>(1, (seconds + width - 1) / std::max<size_t>(width, 1));
+    std::cout << "# last " << seconds << "s, 1 char = " << per_char << "s\n";
+    for (const auto& s : series) {
+        std::vector<uint64_t> buckets;
+        // Align buckets to the newest second, so the last character is always complete
+        size_t offset = seconds % per_char;
+        if (offset) buckets.push_back(0);
+        for (size_t i = 0; i < seconds; ++i) {
+            if (i >= offset && (i - offset) % per_char == 0) buckets.push_back(0);
+            buckets.back() += s.counts[i];
+        }
+        uint64_t peak_bucket = 0, peak = 0, total = 0;
+        for (uint64_t b : buckets) peak_bucket = std::max(peak_bucket, b);
+        for (uint64_t n : s.counts) {
+            peak = std::max(peak, n);
+            total += n;
+        }
+        for (uint64_t b : buckets) {
+            std::cout << kBars[b == 0 ? 0 : 1 + (b * 8 - 1) / peak_bucket];
+        }
+        std::cout << "  total=" << total << " peak=" << peak << "/s  " << s.name << "\n";
+    }
+}
+
 int main(int argc, char* argv[]) {
     args::ArgumentParser parser("ytrace-ctl - Control ytrace trace points at runtime");
     parser.Prog("ytrace-ctl");
@@ -379,14 +875,51 @@ int main(int argc, char* argv[]) {
     args::ValueFlagList<int> line_flag(parser, "LINE", "Filter by line number", {'l', "line"}, {}, args::Options::Global);
     args::ValueFlagList<std::string> level_flag(parser, "LEVEL", "Filter by level (regex)", {'L', "level"}, {}, args::Options::Global);
     args::ValueFlagList<std::string> msg_flag(parser, "PATTERN", "Filter by message (regex)", {'m', "message"}, {}, args::Options::Global);
+    args::ValueFlagList<std::string> cat_flag(parser, "NAME", "Filter by category; enable/disable flips the category itself", {'C', "category"}, {}, args::Options::Global);
+    args::ValueFlagList<std::string> obj_flag(parser, "KEY", "Object key (0x...); enable/disable adds/removes it and enables object points filtered to it", {'o', "object"}, {}, args::Options::Global);
     
     args::Group commands(parser, "Commands:");
     args::Command list_cmd(commands, "list", "List trace points (with optional filters)");
     args::Command enable_cmd(commands, "enable", "Enable trace points matching filters");
+    args::ValueFlag<std::string> when_flag(enable_cmd, "EXPR", "Emit only calls whose arguments match EXPR, e.g. 'arg0 > 1000'", {'w', "when"});
+    args::Flag stack_flag(enable_cmd, "stack", "Capture the call stack; records carry a [stack #N] id", {"stack"});
+    args::ValueFlag<std::string> under_flag(enable_cmd, "FUNC", "Emit only beneath the yfunc/ytimeit scope of FUNC on the same thread", {"under"});
+    args::ValueFlag<std::string> thread_flag(enable_cmd, "GLOB", "Emit only on threads whose name or id matches GLOB, e.g. 'io-*'", {"thread"});
     args::Command disable_cmd(commands, "disable", "Disable trace points matching filters");
     args::Command ps_cmd(commands, "ps", "List live ytrace processes");
     args::Command discover_cmd(commands, "discover", "Discover ytrace sockets (including stale)");
+    args::Command categories_cmd(commands, "categories", "List categories");
+    args::Command objects_cmd(commands, "objects", "List object filter keys");
+    args::Command stacks_cmd(commands, "stacks", "Show captured call stacks, symbolized");
+    args::ValueFlagList<unsigned> stack_ids(stacks_cmd, "ID", "Only this stack id", {"id"});
+    args::Command capture_cmd(commands, "capture", "Print module maps (with build-ids) and raw stacks for offline decode");
+    args::Command decode_cmd(commands, "decode", "Symbolize a capture and/or trace output offline");
+    args::ValueFlagList<std::string> decode_input(decode_cmd, "FILE", "Input file (repeatable, default stdin); needs the map lines of a capture", {'i', "input"});
+    args::Command cat_cmd(commands, "cat", "Print trace files, decompressing FileSink blocks");
+    args::PositionalList<std::string> cat_files(cat_cmd, "FILE", "Trace files (default stdin)");
+    args::ValueFlag<std::string> debuginfo_flag(parser, "DIR", "Debuginfo directory searched by build-id (DIR/.build-id/ab/cdef...debug)", {"debuginfo"}, args::Options::Global);
+    args::Flag no_cache_flag(parser, "no-cache", "Do not use the symbol cache in ~/.cache/ytrace/symbols", {"no-cache"}, args::Options::Global);
     args::Command timers_cmd(commands, "timers", "Show timer statistics");
+    args::Command exceptions_cmd(commands, "exceptions", "Show throw counts per throw site and exception type");
+    args::Command profile_cmd(commands, "profile", "List enable profiles; 'profile save|use|delete NAME' manages one");
+    args::PositionalList<std::string> profile_args(profile_cmd, "ACTION NAME", "save, use or delete, and the profile name");
+    args::Command stream_cmd(commands, "stream", "Stream trace records of enabled points until interrupted");
+    args::Command tail_cmd(commands, "tail", "Show or configure tail-based request sampling");
+    args::Flag tail_on(tail_cmd, "on", "Turn tail sampling on", {"on"});
+    args::Flag tail_off(tail_cmd, "off", "Turn tail sampling off", {"off"});
+    args::ValueFlag<double> tail_latency(tail_cmd, "MS", "Keep requests slower than MS milliseconds", {"latency-ms"});
+    args::ValueFlag<unsigned> tail_one_in(tail_cmd, "N", "Keep every Nth request (0 = off)", {"one-in"});
+    args::ValueFlag<int> tail_errors(tail_cmd, "0|1", "Keep requests that hit warn/error", {"errors"});
+    args::Command history_cmd(commands, "history", "Per-second rate history of points and timers (sparkline or CSV)");
+    args::Flag history_on(history_cmd, "on", "Start recording history in the process", {"on"});
+    args::Flag history_off(history_cmd, "off", "Stop recording and drop the history", {"off"});
+    args::ValueFlag<unsigned> history_seconds(history_cmd, "N", "Seconds kept per point/timer (default 600)", {"seconds"});
+    args::ValueFlagList<std::string> history_timer(history_cmd, "PATTERN", "Show timers whose label matches (regex)", {"timer"});
+    args::Flag history_csv(history_cmd, "csv", "Print CSV, one row per second", {"csv"});
+    args::ValueFlag<unsigned> history_width(history_cmd, "N", "Sparkline width in characters (default 60)", {"width"});
+    args::Command self_cmd(commands, "self", "Show ytrace's own memory use in the process");
+    args::ValueFlag<std::string> self_budget(self_cmd, "SIZE", "Set the buffer memory budget (e.g. 64M, 512K)", {"budget"});
+    args::ValueFlag<std::string> self_thp(self_cmd, "on|off", "Back large buffers with transparent huge pages", {"thp"});
     
     parser.RequireCommand(false);
 
@@ -429,8 +962,58 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    // Cat command - offline, decompress and stream trace files
+    if (cat_cmd) {
+        std::string error;
+        if (args::get(cat_files).empty() && !stream_trace_file(std::cin, std::cout, error)) {
+            std::cerr << "Error: stdin: " << error << "\n";
+            return 1;
+        }
+        for (const auto& path : args::get(cat_files)) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) {
+                std::cerr << "Error: Cannot open " << path << "\n";
+                return 1;
+            }
+            if (!stream_trace_file(file, std::cout, error)) {
+                std::cerr << "Error: " << path << ": " << error << "\n";
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    // Decode command - offline, no process needed; compressed trace files are expanded first
+    if (decode_cmd) {
+        std::string text, error;
+        if (args::get(decode_input).empty()) {
+            std::ostringstream oss;
+            if (!stream_trace_file(std::cin, oss, error)) {
+                std::cerr << "Error: stdin: " << error << "\n";
+                return 1;
+            }
+            text = oss.str();
+        }
+        for (const auto& path : args::get(decode_input)) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) {
+                std::cerr << "Error: Cannot open " << path << "\n";
+                return 1;
+            }
+            std::ostringstream oss;
+            if (!stream_trace_file(file, oss, error)) {
+                std::cerr << "Error: " << path << ": " << error << "\n";
+                return 1;
+            }
+            text += oss.str();
+        }
+        Symbolizer symbolizer(args::get(debuginfo_flag), !no_cache_flag);
+        std::cout << symbolize_text(text, parse_maps(text), symbolizer);
+        return 0;
+    }
+
     // No command specified - show help
-    if (!list_cmd && !enable_cmd && !disable_cmd && !timers_cmd) {
+    if (!list_cmd && !enable_cmd && !disable_cmd && !timers_cmd && !exceptions_cmd && !profile_cmd && !stream_cmd && !tail_cmd && !history_cmd && !self_cmd && !categories_cmd && !objects_cmd && !stacks_cmd && !capture_cmd) {
         std::cout << parser;
         return 0;
     }
@@ -463,6 +1046,50 @@ int main(int argc, char* argv[]) {
     std::vector<int> line_nums = args::get(line_flag);
     std::vector<std::string> level_patterns = args::get(level_flag);
     std::vector<std::string> msg_patterns = args::get(msg_flag);
+    std::vector<std::string> categories = args::get(cat_flag);
+    std::vector<std::string> objects = args::get(obj_flag);
+
+    // Categories command - list categories and their state
+    if (categories_cmd) {
+        std::string response = send_command(socket_path, "categories");
+        if (response.rfind("ERROR", 0) == 0) {
+            std::cerr << response;
+            return 1;
+        }
+        std::cout << response;
+        return 0;
+    }
+
+    // Objects command - list the keys of the object filter
+    if (objects_cmd) {
+        std::string response = send_command(socket_path, "objects");
+        if (response.rfind("ERROR", 0) == 0) {
+            std::cerr << response;
+            return 1;
+        }
+        std::cout << response;
+        return 0;
+    }
+
+    // Stacks/capture commands - fetch maps and raw stacks; stacks symbolizes them here,
+    // so the traced process never resolves symbols itself
+    if (stacks_cmd || capture_cmd) {
+        std::string cmd = "stacks";
+        for (unsigned id : args::get(stack_ids)) cmd += " " + std::to_string(id);
+        std::string maps = send_command(socket_path, "maps");
+        std::string response = send_command(socket_path, cmd);
+        if (response.rfind("ERROR", 0) == 0) {
+            std::cerr << response;
+            return 1;
+        }
+        if (capture_cmd) {
+            std::cout << maps << response;
+            return 0;
+        }
+        Symbolizer symbolizer(args::get(debuginfo_flag), !no_cache_flag);
+        std::cout << symbolize_text(response, parse_maps(maps), symbolizer);
+        return 0;
+    }
 
     // Timers command - fetch timer statistics
     if (timers_cmd) {
@@ -475,6 +1102,129 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    // Exceptions command - throw sites counted by the ytrace::exceptions hook
+    if (exceptions_cmd) {
+        std::string response = send_command(socket_path, "exceptions");
+        if (response.rfind("ERROR", 0) == 0) {
+            std::cerr << response;
+            return 1;
+        }
+        std::cout << response;
+        return 0;
+    }
+
+    // Profile command - save the current enable state under a name, or switch to one
+    if (profile_cmd) {
+        std::string cmd = "profile";
+        for (const auto& arg : args::get(profile_args)) cmd += " " + arg;
+        std::string response = send_command(socket_path, cmd);
+        if (response.rfind("ERROR", 0) == 0) {
+            std::cerr << response;
+            return 1;
+        }
+        std::cout << response;
+        return 0;
+    }
+
+    // Stream command - the process drains records to this connection (spliced on Linux)
+    // until we disconnect; the first line is the process's OK/ERROR reply
+    if (stream_cmd) {
+        bool first = true;
+        bool failed = false;
+        std::string error = send_command(socket_path, "stream", [&](std::string_view data) {
+            if (first) {
+                first = false;
+                size_t eol = data.find('\n');
+                std::string_view reply = data.substr(0, eol == std::string_view::npos ? data.size() : eol + 1);
+                failed = reply.rfind("ERROR", 0) == 0;
+                std::cerr << reply;
+                data.remove_prefix(reply.size());
+            }
+            std::cout.write(data.data(), static_cast<std::streamsize>(data.size()));
+            std::cout.flush();
+        });
+        if (!error.empty() || failed) {
+            std::cerr << error;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Tail command - forward options to the process, print the resulting status
+    if (tail_cmd) {
+        std::string cmd = "tail";
+        if (tail_on) cmd += " on";
+        if (tail_off) cmd += " off";
+        if (tail_latency) cmd += " latency_ms=" + std::to_string(args::get(tail_latency));
+        if (tail_one_in) cmd += " one_in=" + std::to_string(args::get(tail_one_in));
+        if (tail_errors) cmd += " errors=" + std::to_string(args::get(tail_errors));
+        std::string response = send_command(socket_path, cmd);
+        if (response.rfind("ERROR", 0) == 0) {
+            std::cerr << response;
+            return 1;
+        }
+        std::cout << response;
+        return 0;
+    }
+
+    // Self command - optionally reconfigure the budget, print the process's report
+    if (self_cmd) {
+        std::string cmd = "self";
+        if (self_budget) cmd += " budget=" + args::get(self_budget);
+        if (self_thp) cmd += " thp=" + args::get(self_thp);
+        std::string response = send_command(socket_path, cmd);
+        if (response.rfind("ERROR", 0) == 0) {
+            std::cerr << response;
+            return 1;
+        }
+        std::cout << response;
+        return 0;
+    }
+
+    // History command - configure recording, or render the recorded per-second counts of
+    // the points matching the filters (and of --timer timers); everything if no filter
+    if (history_cmd) {
+        if (history_on || history_off || history_seconds) {
+            std::string cmd = "history";
+            if (history_on) cmd += " on";
+            if (history_off) cmd += " off";
+            if (history_seconds) cmd += " seconds=" + std::to_string(args::get(history_seconds));
+            std::string response = send_command(socket_path, cmd);
+            if (response.rfind("ERROR", 0) == 0) {
+                std::cerr << response;
+                return 1;
+            }
+            std::cout << response;
+            return 0;
+        }
+
+        std::string dump = send_command(socket_path, "history-dump");
+        if (dump.rfind("# history on", 0) != 0) {
+            std::cerr << (dump.rfind("# history", 0) == 0 ? "History is off; start it with: ytrace-ctl history --on\n" : dump);
+            return 1;
+        }
+        auto points = parse_trace_points(send_command(socket_path, "list"));
+        bool point_filter = use_all || !file_patterns.empty() || !func_patterns.empty() || !line_nums.empty() ||
+                            !level_patterns.empty() || !msg_patterns.empty() || !categories.empty();
+        std::set<size_t> indices;
+        if (point_filter) {
+            for (const auto& tp : filter_trace_points(points, use_all, file_patterns, func_patterns,
+                                                      line_nums, level_patterns, msg_patterns, categories)) {
+                indices.insert(tp.index);
+            }
+        }
+        auto timer_res = compile_patterns(args::get(history_timer), "--timer");
+
+        auto series = parse_history(dump, points, indices, timer_res, !point_filter && timer_res.empty());
+        if (series.empty()) {
+            std::cout << "No history recorded for the matching points/timers.\n";
+            return 0;
+        }
+        if (history_csv) print_history_csv(series);
+        else print_history_sparklines(series, history_width ? args::get(history_width) : 60);
+        return 0;
+    }
+
     // List command - fetch and optionally filter
     if (list_cmd) {
         std::string response = send_command(socket_path, "list");
@@ -485,7 +1235,7 @@ int main(int argc, char* argv[]) {
         
         // If no filters, show all
         if (!use_all && file_patterns.empty() && func_patterns.empty() && 
-            line_nums.empty() && level_patterns.empty() && msg_patterns.empty()) {
+            line_nums.empty() && level_patterns.empty() && msg_patterns.empty() && categories.empty()) {
             std::cout << response;
             return 0;
         }
@@ -493,11 +1243,12 @@ int main(int argc, char* argv[]) {
         // Apply filters
         auto points = parse_trace_points(response);
         auto filtered = filter_trace_points(points, use_all, file_patterns, func_patterns, 
-                                            line_nums, level_patterns, msg_patterns);
+                                            line_nums, level_patterns, msg_patterns, categories);
         
         for (const auto& tp : filtered) {
             std::cout << (tp.enabled ? "[ON] " : "[OFF]") << " [" << tp.level << "] "
-                      << tp.file << ":" << tp.line << " (" << tp.function << ") \"" << tp.message << "\"\n";
+                      << tp.file << ":" << tp.line << " (" << tp.function << ") \"" << tp.message << "\""
+                      << tp.state << "\n";
         }
         return 0;
     }
@@ -506,10 +1257,32 @@ int main(int argc, char* argv[]) {
     if (enable_cmd || disable_cmd) {
         // Must have at least one filter
         if (!use_all && file_patterns.empty() && func_patterns.empty() && 
-            line_nums.empty() && level_patterns.empty() && msg_patterns.empty()) {
-            std::cerr << "Error: No filter specified. Use --all, --file, --function, --line, --level, or --message.\n";
+            line_nums.empty() && level_patterns.empty() && msg_patterns.empty() && categories.empty() &&
+            objects.empty()) {
+            std::cerr << "Error: No filter specified. Use --all, --file, --function, --line, --level, --message, --category, or --object.\n";
             return 1;
         }
+
+        // Object keys go into the process-wide filter set; matching points below are then
+        // enabled in object-filtered mode (only object points, see ylog_obj)
+        for (const auto& key : objects) {
+            std::string response = send_command(socket_path,
+                (enable_cmd ? "object-add " : "object-remove ") + key);
+            std::cout << response;
+            if (response.rfind("ERROR", 0) == 0) return 1;
+        }
+
+        // Categories are switched as a whole in the process, no point list needed
+        for (const auto& cat : categories) {
+            std::string response = send_command(socket_path,
+                (enable_cmd ? "enable-category " : "disable-category ") + cat);
+            std::cout << response;
+            if (response.rfind("ERROR", 0) == 0) return 1;
+        }
+        if (!use_all && file_patterns.empty() && func_patterns.empty() &&
+            line_nums.empty() && level_patterns.empty() && msg_patterns.empty()) {
+            return 0;
+        }
         
         // Fetch current trace points
         std::string response = send_command(socket_path, "list");
@@ -521,6 +1294,12 @@ int main(int argc, char* argv[]) {
         auto points = parse_trace_points(response);
         auto filtered = filter_trace_points(points, use_all, file_patterns, func_patterns, 
                                             line_nums, level_patterns, msg_patterns);
+        bool object_filtered = enable_cmd && !objects.empty();
+        if (object_filtered) {
+            filtered.erase(std::remove_if(filtered.begin(), filtered.end(), [](const TracePoint& tp) {
+                return tp.state.find(" obj=") == std::string::npos;
+            }), filtered.end());
+        }
         
         if (filtered.empty()) {
             std::cout << "No trace points matched the filter.\n";
@@ -541,7 +1320,15 @@ int main(int argc, char* argv[]) {
             return oss.str();
         };
         
-        std::string cmd = enable_cmd ? "enable" : "disable";
+        std::string cmd = object_filtered ? "enable-filtered" : (enable_cmd ? "enable" : "disable");
+        if (enable_cmd && when_flag) {
+            // The process compiles the predicate; points that cannot take one are skipped
+            cmd = std::string(stack_flag ? "enable-stack-when " : "enable-when ") + url_encode(args::get(when_flag));
+        } else if (enable_cmd && stack_flag) {
+            cmd = "enable-stack";
+        }
+        if (enable_cmd && under_flag) cmd += " under=" + args::get(under_flag);
+        if (enable_cmd && thread_flag) cmd += " thread=" + url_encode(args::get(thread_flag));
         for (const auto& tp : filtered) {
             cmd += " " + tp.file + ":" + std::to_string(tp.line) + ":" + tp.function 
                  + ":" + tp.level + ":" + url_encode(tp.message);
@@ -0,0 +1,72 @@
+#include <boost/ut.hpp>
+#include <ytrace/exceptions.hpp>
+#include <string>
+
+using namespace boost::ut;
+
+struct Base1 {
+    virtual ~Base1() = default;
+    long a = 1;
+};
+
+struct Base2 {
+    virtual ~Base2() = default;
+    long b = 2;
+};
+
+struct Derived : Base1, Base2 {};
+
+int thrown_value = 0;
+
+// Exported and not inlined, so the throw sites are named after these functions
+__attribute__((noinline)) void throw_derived() { throw Derived(); }
+__attribute__((noinline)) void throw_pointer() { throw &thrown_value; }
+
+// Report line of the throw site in function, "" if unseen
+static std::string site_line(const std::string& function) {
+    std::string report = ytrace::ExceptionTable::instance().report();
+    size_t at = report.find(" " + function + " ");
+    if (at == std::string::npos) return "";
+    size_t bol = report.rfind('\n', at) + 1;
+    return report.substr(bol, report.find('\n', at) - bol);
+}
+
+suite exception_tests = [] {
+    ytrace::set_trace_handler([](const char*, const char*, int, const char*, const char*) {});
+
+    // Register both sites, then time their throws
+    try { throw_derived(); } catch (const Derived&) {}
+    try { throw_pointer(); } catch (int*) {}
+    yenable_level("throw");
+
+    "catch_of_a_base_at_an_offset_is_timed"_test = [] {
+        for (int i = 0; i < 3; ++i) {
+            try {
+                throw_derived();
+            } catch (const Base2& base) {
+                expect(base.b == 2);
+            }
+        }
+        std::string line = site_line("throw_derived");
+        expect(line.find("[caught=3 ") != std::string::npos) << line;
+    };
+
+    "catch_of_a_pointer_is_timed"_test = [] {
+        for (int i = 0; i < 3; ++i) {
+            try {
+                throw_pointer();
+            } catch (int* p) {
+                expect(p == &thrown_value);
+            }
+        }
+        std::string line = site_line("throw_pointer");
+        expect(line.find("[caught=3 ") != std::string::npos) << line;
+    };
+
+    ydisable_level("throw");
+    ytrace::set_trace_handler(ytrace::default_trace_handler);
+};
+
+int main() {
+    return 0;
+}
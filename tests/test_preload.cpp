@@ -0,0 +1,51 @@
+#include <boost/ut.hpp>
+#include <ytrace/preload.hpp>
+#include <string>
+#include <unistd.h>
+
+using namespace boost::ut;
+
+// One byte into a pipe from a yfunc() scope: "write(pipe) in write_pipe" in the timers
+__attribute__((noinline)) void write_pipe(int fd) {
+    yfunc();
+    char byte = 'x';
+    expect(write(fd, &byte, 1) == 1);
+}
+
+// Count of the timer whose key is label, 0 if none
+static uint64_t timer_count(const std::string& label) {
+    for (const auto& [key, count] : ytrace::TimerManager::instance().counts()) {
+        if (key.ends_with(label)) return count;
+    }
+    return 0;
+}
+
+suite preload_tests = [] {
+    ytrace::set_trace_handler([](const char*, const char*, int, const char*, const char*) {});
+
+    "shim_shares_the_application_manager"_test = [] {
+        // Exported symbols: the shim opened the application's own control socket
+        std::string path = ytrace::TraceManager::instance().get_socket_path();
+        expect(!path.empty() && path.find(".preload.") == std::string::npos) << path;
+        expect(!ytrace::TraceManager::instance().open_ctrl_socket(path.c_str()));
+    };
+
+    "write_is_timed_under_its_scope"_test = [] {
+        int fds[2];
+        expect(pipe(fds) == 0);
+        write_pipe(fds[1]);  // off: not timed
+        yenable_level("syscall");
+        for (int i = 0; i < 3; ++i) write_pipe(fds[1]);
+        ydisable_level("syscall");
+        write_pipe(fds[1]);
+        close(fds[0]);
+        close(fds[1]);
+        expect(timer_count("write(pipe) in write_pipe") == 3u) << ytrace::TimerManager::instance().summary();
+    };
+
+    ytrace::set_trace_handler(ytrace::default_trace_handler);
+};
+
+int main() {
+    return 0;
+}
@@ -1,10 +1,138 @@
 #include <boost/ut.hpp>
 #include <ytrace/ytrace.hpp>
+#include <ytrace/instrument.hpp>
+#include <ytrace/patchable.hpp>
+#include <algorithm>
+#include <array>
 #include <string>
 #include <vector>
+#if defined(__linux__)
+#include <sys/socket.h>
+#endif
+#if defined(YTRACE_USE_SPDLOG)
+#include <spdlog/sinks/base_sink.h>
+#endif
 
 using namespace boost::ut;
 
+// Formats of the helpers' arguments for the configured backend
+#if defined(YTRACE_USE_SPDLOG)
+#define TEST_D "{}"
+#define TEST_S "{}"
+#else
+#define TEST_D "%d"
+#define TEST_S "%s"
+#endif
+
+#if defined(YTRACE_USE_SPDLOG)
+// With the spdlog backend, ylog records go to spdlog rather than trace_handler(). This
+// sink passes them on to trace_handler(), so the tests capture both backends alike.
+class HandlerSink : public spdlog::sinks::base_sink<std::mutex> {
+protected:
+    void sink_it_(const spdlog::details::log_msg& msg) override {
+        static const char* const kLevels[] = {"trace", "debug", "info", "warn", "error", "critical", "off"};
+        std::string text(msg.payload.data(), msg.payload.size());
+        ytrace::trace_handler()(kLevels[msg.level], msg.source.filename, msg.source.line, msg.source.funcname,
+                                text.c_str());
+    }
+    void flush_() override {}
+};
+
+static const bool spdlog_to_handler = [] {
+    auto logger = std::make_shared<spdlog::logger>("ytrace_tests", std::make_shared<HandlerSink>());
+    logger->set_level(spdlog::level::trace);
+    spdlog::set_default_logger(logger);
+    return true;
+}();
+#endif
+
+static void adaptive_hot_function() {
+    yfunc_adaptive(1000);
+}
+
+static void category_point() {
+    ylog_cat(testcat, "info", "categorized");
+}
+
+struct Session {
+    void handle() { ytrace_obj(this, "handle"); }
+    void handle_size(int n) { ylog_obj(this, "info", "size " TEST_D, n); }
+};
+
+static void process_data(int size, const char* name) {
+    ylog("info", "size=" TEST_D " name=" TEST_S, size, name);
+}
+
+static void low_disk_warning() {
+    ywarn("low disk");
+}
+
+static void rate_point() {
+    ylog("info", "tick");
+}
+
+static void drained_point(int n) {
+    ylog("info", "drained " TEST_D, n);
+}
+
+static int micro_sampled(int x) {
+    ytimeit_every(8, "micro_sampled");
+    return x * 3;
+}
+
+static int micro_batched(int x) {
+    ytimeit_batch(8, "micro_batched");
+    return x + 1;
+}
+
+static void tail_request(bool warn) {
+    yrequest("tail_request");
+    ylog("info", "step");
+    if (warn) ylog("warn", "something odd");
+}
+
+static void tail_quiet_failure() {
+    yrequest("tail_quiet_failure");
+    ylog("error", "never enabled");
+}
+
+static void resolve_host(int caller) {
+    ytrace("resolving " TEST_D, caller);
+}
+
+static void connect_upstream() {
+    yfunc();
+    resolve_host(1);
+}
+
+static void refresh_cache() {
+    ytimeit();
+    resolve_host(2);
+}
+
+static void compact_step(int n) {
+    ytrace("compacting " TEST_D, n);
+}
+
+static void heartbeat(int n) {
+    ytrace("beat " TEST_D, n);
+}
+
+static void handle_tenant(std::string_view tenant) {
+    ytimeit_dyn(tenant);
+}
+
+static const char* innermost_scope() {
+    yfunc();
+    return ytrace::detail::t_scope;
+}
+
+static std::pair<const char*, const char*> nested_scopes() {
+    ytimeit("nested");
+    const char* inner = innermost_scope();
+    return {ytrace::detail::t_scope, inner};
+}
+
 suite ytrace_tests = [] {
     "format_duration_ns"_test = [] {
         auto s = ytrace::format_duration(500.0);
@@ -66,6 +194,841 @@ suite ytrace_tests = [] {
 
         ytrace::set_trace_handler(ytrace::default_trace_handler);
     };
+
+    "function_table_insert_find"_test = [] {
+        auto& table = ytrace::FunctionTable::instance();
+        int dummy = 0;
+        void* fn = &dummy;
+        expect(table.find(fn) == nullptr);
+
+        auto [slot, inserted] = table.insert(fn);
+        expect(slot != nullptr && inserted);
+        expect(table.find(fn) == nullptr);  // not ready until registered
+
+        slot->ready.store(true);
+        expect(table.find(fn) == slot);
+        expect(table.insert(fn).first == slot && !table.insert(fn).second);
+    };
+
+    "trace_point_on_change"_test = [] {
+        static bool enabled = false;
+        static int changes = 0;
+        static int context = 42;
+        ytrace::TraceManager::instance().register_trace_point(&enabled, "test.cpp", 1, "on_change_func",
+            "trace", "", [](const ytrace::TracePointInfo& info) {
+                ++changes;
+                expect(*static_cast<int*>(info.context) == 42);
+            }, &context);
+        ytrace::TraceManager::instance().set_function_enabled("on_change_func", true);
+        expect(enabled && changes == 1);
+        ytrace::TraceManager::instance().set_function_enabled("on_change_func", false);
+        expect(!enabled && changes == 2);
+    };
+
+    "adaptive_sampler_raises_interval"_test = [] {
+        ytrace::AdaptiveSampler sampler(1000);
+        ytrace::AdaptiveSampler::Local local;
+        expect(sampler.sample(local) && sampler.interval() == 1_u);
+
+        uint64_t passed = 0, total = 1;
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(250);
+        while (std::chrono::steady_clock::now() < until) {
+            for (int i = 0; i < 1000; ++i) passed += sampler.sample(local);
+            total += 1000;
+        }
+        expect(sampler.interval() > 1_u) << sampler.interval();
+        expect(passed < sampler.calls());
+        expect(sampler.calls() + sampler.interval() > total && sampler.calls() <= total);  // lags < one interval
+    };
+
+    "yfunc_adaptive_list"_test = [] {
+        ytrace::set_trace_handler([](const char*, const char*, int, const char*, const char*) {});
+        adaptive_hot_function();
+        yenable_func("adaptive_hot_function");
+        for (int i = 0; i < 10; ++i) adaptive_hot_function();
+        ydisable_func("adaptive_hot_function");
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+
+        auto list = ytrace::TraceManager::instance().list_trace_points();
+        expect(list.find("(adaptive_hot_function) \"\" sample=1/1 calls=10") != std::string::npos) << list;
+    };
+
+    "tail_sampling_keeps_erroring_requests"_test = [] {
+        std::vector<std::string> captured;
+        ytrace::set_trace_handler([&](const char* level, const char*, int, const char*, const char* msg) {
+            captured.push_back(std::string(level) + ":" + msg);
+        });
+        tail_request(true);  // register the points
+        ytrace::TailPolicy policy;
+        policy.latency_threshold_ns = 60e9;
+        ytrace::TailSampler::instance().configure(true, policy);
+        yenable_func("tail_request");
+
+        tail_request(false);
+#if defined(YTRACE_USE_SPDLOG)
+        // ylog records go straight to spdlog, unbuffered: only the verdicts are checked
+        std::erase_if(captured, [](const std::string& rec) { return !rec.starts_with("request:"); });
+#endif
+        expect(captured.empty()) << captured.size();
+
+        tail_request(true);
+#if defined(YTRACE_USE_SPDLOG)
+        std::erase_if(captured, [](const std::string& rec) { return !rec.starts_with("request:"); });
+        expect(captured.size() == 1_u && captured[0].find("tail_request kept (error)") != std::string::npos);
+#else
+        expect(captured.size() == 3_u) << captured.size();
+        if (captured.size() == 3) {
+            expect(captured[0] == "info:step" && captured[1] == "warn:something odd");
+            expect(captured[2].find("tail_request kept (error)") != std::string::npos) << captured[2];
+        }
+#endif
+
+        captured.clear();
+        uint64_t kept = ytrace::TailSampler::instance().kept();
+        tail_quiet_failure();  // the error point is off, the request still counts as erroring
+        expect(captured.size() == 1_u && captured[0].find("tail_quiet_failure kept (error)") != std::string::npos);
+        expect(ytrace::TailSampler::instance().kept() == kept + 1);
+
+        ydisable_func("tail_request");
+        ytrace::TailSampler::instance().configure(false, policy);
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+    };
+
+    "category_enable_flips_member_points"_test = [] {
+        int hits = 0;
+        ytrace::set_trace_handler([&](const char*, const char*, int, const char*, const char*) { ++hits; });
+        category_point();
+        expect(hits == 0);
+
+        yenable_category("testcat");
+        category_point();
+        expect(hits == 1);
+        auto list = ytrace::TraceManager::instance().list_trace_points();
+        expect(list.find("\"categorized\" cat=testcat") != std::string::npos) << list;
+
+        // Own state survives the category being switched off
+        yenable_func("category_point");
+        ydisable_category("testcat");
+        category_point();
+        expect(hits == 2);
+        ydisable_func("category_point");
+        category_point();
+        expect(hits == 2);
+
+        // Conditional modes apply to categorized points like to ylog()
+        expect(yenable_func_when("category_point", "1 > 2"));
+        category_point();
+        expect(hits == 2);
+        expect(yenable_func_when("category_point", "2 > 1"));
+        category_point();
+        expect(hits == 3);
+        ydisable_func("category_point");
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+    };
+
+    "object_filtered_point_traces_only_listed_objects"_test = [] {
+        int hits = 0;
+        ytrace::set_trace_handler([&](const char*, const char*, int, const char*, const char*) { ++hits; });
+        Session a, b;
+        a.handle();
+        expect(hits == 0);
+
+        yenable_object(&b);
+        yenable_func_filtered("handle");
+        a.handle();
+        b.handle();
+        expect(hits == 1);
+        auto list = ytrace::TraceManager::instance().list_trace_points();
+        expect(list.find("\"handle\" obj=filtered") != std::string::npos) << list;
+
+        // A plain enable traces every object again
+        yenable_func("handle");
+        a.handle();
+        expect(hits == 2);
+        ydisable_func("handle");
+        ydisable_object(&b);
+        expect(!ytrace::ObjectFilter::instance().contains(ytrace::detail::object_key(&b)));
+
+        // Object points take predicates over their arguments, in either backend
+        std::vector<std::string> messages;
+        ytrace::set_trace_handler([&](const char*, const char*, int, const char*, const char* msg) {
+            messages.emplace_back(msg);
+        });
+        a.handle_size(0);
+        expect(yenable_func_when("handle_size", "arg0 > 5"));
+        a.handle_size(3);
+        a.handle_size(7);
+        char expected[64];
+        std::snprintf(expected, sizeof(expected), "[obj %#" PRIxPTR "] size 7", ytrace::detail::object_key(&a));
+        expect(messages == std::vector<std::string>{expected}) << (messages.empty() ? "" : messages[0]);
+        ydisable_func("handle_size");
+
+        // Removed keys do not pile up as tombstones
+        auto& filter = ytrace::ObjectFilter::instance();
+        for (uintptr_t key = 1; key <= 10 * YTRACE_OBJECT_FILTER_SIZE; ++key) {
+            expect(filter.add(key));
+            expect(filter.remove(key));
+        }
+        expect(filter.tombstones() <= YTRACE_OBJECT_FILTER_SIZE / 4) << filter.tombstones();
+        expect(filter.add(42) && filter.contains(42) && !filter.contains(43));
+        expect(filter.remove(42));
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+    };
+
+    "predicate_compile_and_eval"_test = [] {
+        ytrace::Predicate pred;
+        std::string error;
+        expect(pred.compile("arg0 > 1000 && (arg1 == \"GET\" || !(arg2 < 0.5))", error)) << error;
+        auto values = [](int64_t a, const char* b, double c) {
+            return std::array<ytrace::Predicate::Value, 3>{ytrace::detail::predicate_value(a),
+                ytrace::detail::predicate_value(b), ytrace::detail::predicate_value(c)};
+        };
+        expect(pred.eval(values(2000, "GET", 0.0).data(), 3));
+        expect(pred.eval(values(2000, "PUT", 1.0).data(), 3));
+        expect(!pred.eval(values(2000, "PUT", 0.1).data(), 3));
+        expect(!pred.eval(values(10, "GET", 1.0).data(), 3));
+        expect(!pred.eval(nullptr, 0));  // missing arguments compare false
+
+        expect(!pred.compile("arg0 >", error));
+        expect(!pred.compile("size > 3", error));
+        expect(!error.empty());
+    };
+
+    "conditional_point_emits_matching_calls"_test = [] {
+        int hits = 0;
+        ytrace::set_trace_handler([&](const char*, const char*, int, const char*, const char*) { ++hits; });
+        process_data(1, "a");
+        expect(yenable_func_when("process_data", "arg0 > 1000"));
+        process_data(5, "small");
+        process_data(5000, "big");
+        expect(hits == 1);
+        auto list = ytrace::TraceManager::instance().list_trace_points();
+        expect(list.find("when=arg0 > 1000") != std::string::npos) << list;
+
+        // A plain enable drops the predicate
+        yenable_func("process_data");
+        process_data(5, "small");
+        expect(hits == 2);
+        ydisable_func("process_data");
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+    };
+
+    "stack_table_dedups_stacks"_test = [] {
+        auto& table = ytrace::StackTable::instance();
+        void* a[] = {reinterpret_cast<void*>(0x1000), reinterpret_cast<void*>(0x2000)};
+        void* b[] = {reinterpret_cast<void*>(0x1000), reinterpret_cast<void*>(0x3000)};
+        size_t before = table.size();
+        uint32_t id_a = table.intern(a, 2);
+        expect(id_a != 0u);
+        expect(table.intern(a, 2) == id_a);
+        expect(table.intern(b, 2) != id_a);
+        expect(table.size() == before + 2);
+        expect(table.get(id_a)->depth == 2u && table.get(id_a)->frames[1] == a[1]);
+    };
+
+    "stack_mode_point_carries_stack_id"_test = [] {
+        std::vector<std::string> messages;
+        ytrace::set_trace_handler([&](const char*, const char*, int, const char*, const char* msg) { messages.push_back(msg); });
+        low_disk_warning();
+        yenable_func_stack("low_disk_warning");
+        for (int i = 0; i < 2; ++i) low_disk_warning();  // same call path twice
+        expect(messages.size() == 2u);
+        expect(messages[0].find("low disk [stack #") == 0) << messages[0];
+        expect(messages[0] == messages[1]);
+        ydisable_func("low_disk_warning");
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+    };
+
+    "loaded_modules_cover_own_code"_test = [] {
+        auto modules = ytrace::detail::loaded_modules();
+        auto pc = reinterpret_cast<uintptr_t>(&low_disk_warning);
+        auto it = std::find_if(modules.begin(), modules.end(),
+                               [&](const ytrace::LoadedModule& m) { return pc >= m.start && pc < m.end; });
+        expect(it != modules.end());
+        if (it != modules.end()) {
+            expect(!it->path.empty());
+            expect(it->build_id.empty() || it->build_id.size() % 2 == 0) << it->build_id;
+        }
+    };
+
+    "fixed_storage_refuses_overflow"_test = [] {
+        ytrace::detail::FixedVector<std::string, 2> v;
+        expect(ytrace::detail::try_emplace_back(v, "a") != nullptr);
+        expect(ytrace::detail::try_emplace_back(v, "b") != nullptr);
+        expect(ytrace::detail::try_emplace_back(v, "c") == nullptr);
+        expect(v.size() == 2_u && v[1] == "b");
+
+        ytrace::detail::FixedString<8> name("networking");
+        expect(name == "network") << name.c_str();
+    };
+
+    "internal_storage_is_counted_by_memory_resource"_test = [] {
+        auto& mr = ytrace::memory_resource();
+        expect(!ytrace::set_memory_resource(std::pmr::new_delete_resource()));  // bound by now
+        size_t before = mr.bytes_in_use();
+        {
+            ytrace::HistoryRing ring(100, 0, 0);
+            expect(mr.bytes_in_use() >= before + 100 * sizeof(uint32_t));
+            expect(mr.peak_bytes() >= mr.bytes_in_use());
+        }
+        expect(mr.bytes_in_use() == before);
+#if !YTRACE_FIXED_CAPACITY
+        std::string function(200, 'f');  // past the small-string buffer
+        expect(ytrace::CallPath::instance().bit(function) != 0u);
+        expect(mr.bytes_in_use() >= before + function.size()) << "call path names";
+#endif
+    };
+
+    "history_ring_spreads_counter_deltas"_test = [] {
+        ytrace::HistoryRing ring(4, 10, 100);
+        ring.observe(13, 101);
+        ring.observe(13, 102);
+        ring.observe(20, 104);  // sampled late: 7 hits over two seconds
+        expect(ring.values() == std::vector<uint32_t>{3, 0, 4, 3});
+        ring.observe(25, 105);  // the oldest second drops out
+        expect(ring.values() == std::vector<uint32_t>{0, 4, 3, 5});
+    };
+
+    "history_samples_point_hits"_test = [] {
+        ytrace::set_trace_handler([](const char*, const char*, int, const char*, const char*) {});
+        rate_point();
+        auto& mgr = ytrace::TraceManager::instance();
+        mgr.set_history(true, 60);
+        mgr.sample_history(1000);
+        yenable_func("rate_point");
+        for (int i = 0; i < 5; ++i) rate_point();
+        ydisable_func("rate_point");
+        mgr.sample_history(1001);
+        mgr.sample_history(1003);
+
+        auto list = mgr.list_trace_points();
+        size_t at = list.find("(rate_point)");
+        expect(at != std::string::npos) << list;
+        size_t bol = list.rfind('\n', at) + 1;
+        std::string index = list.substr(bol, list.find(' ', bol) - bol);
+        auto dump = mgr.history_dump();
+        expect(dump.find("\npoint " + index + " 5,0,0\n") != std::string::npos) << dump;
+        mgr.set_history(false);
+
+        // With history off, records are not counted
+        yenable_func("rate_point");
+        for (int i = 0; i < 5; ++i) rate_point();
+        ydisable_func("rate_point");
+        list = mgr.list_trace_points();
+        at = list.find("(rate_point)");
+        bol = list.rfind('\n', at) + 1;
+        expect(list.substr(bol, list.find('\n', at) - bol).find("hits=5") != std::string::npos) << list;
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+    };
+
+    "drain_pool_keeps_per_thread_order"_test = [] {
+        std::mutex mutex;
+        std::string out;
+        auto& pool = ytrace::DrainPool::instance();
+        ytrace::DrainOptions options;
+        options.workers = 3;
+        expect(pool.start(options, [&](std::string_view batch) {
+            std::lock_guard<std::mutex> lock(mutex);
+            out.append(batch);
+        }));
+        expect(!pool.start(options));
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([t] {
+                char msg[32];
+                for (int i = 0; i < 200; ++i) {
+                    std::snprintf(msg, sizeof(msg), "t%d #%d", t, i);
+                    ytrace::detail::output("info", "f.cpp", 1, "fn", msg);
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        int handled = 0;
+        ytrace::set_trace_handler([&](const char*, const char*, int, const char*, const char*) { ++handled; });
+        pool.stop();
+        expect(pool.written() + pool.dropped() == 800u);
+        ytrace::detail::output("info", "f.cpp", 1, "fn", "after stop");
+        expect(handled == 1) << "handler set while the pool ran is kept";
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+
+        int next[4] = {0, 0, 0, 0};
+        bool ordered = true;
+        std::istringstream lines(out);
+        for (std::string line; std::getline(lines, line);) {
+            int t = 0, i = 0;
+            if (std::sscanf(line.c_str(), "[info] f.cpp:1 (fn): t%d #%d", &t, &i) != 2) { ordered = false; break; }
+            ordered = ordered && i >= next[t];
+            next[t] = i + 1;
+        }
+        expect(ordered) << out.substr(0, 200);
+        expect(static_cast<uint64_t>(std::count(out.begin(), out.end(), '\n')) == pool.written());
+    };
+
+    "drain_queues_are_charged_to_the_budget"_test = [] {
+        auto& budget = ytrace::MemoryBudget::instance();
+        auto& pool = ytrace::DrainPool::instance();
+        std::string out;  // written by the worker, read after stop() joined it
+        expect(pool.start({}, [&](std::string_view batch) { out.append(batch); }));
+        size_t limit = budget.limit(), used = budget.used();
+        uint64_t dropped = pool.dropped();
+
+        budget.set_limit(used);
+        std::thread([] { ytrace::detail::output("info", "f.cpp", 1, "fn", "refused"); }).join();
+        expect(pool.dropped() == dropped + 1);
+        budget.set_limit(limit);
+
+        drained_point(0);
+        yenable_func("drained_point");
+        std::thread([&] {
+            drained_point(7);  // through spdlog_record() in spdlog builds
+            expect(budget.used() > used);
+        }).join();
+        ydisable_func("drained_point");
+        pool.stop();
+        expect(budget.used() == used) << "queue of the exited thread released";
+        expect(out.find("refused") == std::string::npos) << out;
+        expect(out.find("(drained_point): drained 7\n") != std::string::npos) << out;
+    };
+
+    "lz_blocks_round_trip"_test = [] {
+        std::string text;
+        for (int i = 0; i < 2000; ++i) text += "[info] server.cpp:42 (handle): request " + std::to_string(i % 37) + " done\n";
+        std::string noise(5000, '\0');
+        uint32_t x = 12345;
+        for (auto& c : noise) c = static_cast<char>((x = x * 1103515245u + 12345u) >> 24);
+
+        std::string stream;
+        ytrace::lz::encode_block(text, stream);
+        size_t first = stream.size();
+        ytrace::lz::encode_block(noise, stream);   // incompressible: stored as is
+        ytrace::lz::encode_block("", stream);
+        expect(first < text.size() / 5) << first;
+        expect(stream.size() - first == 2 * ytrace::lz::kBlockHeaderBytes + noise.size());
+
+        std::istringstream in(stream);
+        std::string raw;
+        expect(ytrace::lz::read_block(in, raw) == ytrace::lz::BlockStatus::ok && raw == text);
+        expect(ytrace::lz::read_block(in, raw) == ytrace::lz::BlockStatus::ok && raw == noise);
+        expect(ytrace::lz::read_block(in, raw) == ytrace::lz::BlockStatus::ok && raw.empty());
+        expect(ytrace::lz::read_block(in, raw) == ytrace::lz::BlockStatus::end);
+
+        std::istringstream truncated(stream.substr(0, first - 1));
+        expect(ytrace::lz::read_block(truncated, raw) == ytrace::lz::BlockStatus::corrupt);
+        std::string damaged = stream.substr(0, first);
+        damaged[ytrace::lz::kBlockHeaderBytes + 1] ^= 0x7f;
+        std::istringstream bad(damaged);
+        expect(ytrace::lz::read_block(bad, raw) != ytrace::lz::BlockStatus::ok || raw != text);
+
+        std::string huge = stream.substr(0, first);
+        ytrace::lz::detail::put32le(huge.data() + 4, 0xfffffff0u);  // raw length past any writer's block
+        std::istringstream oversized(huge);
+        expect(ytrace::lz::read_block(oversized, raw) == ytrace::lz::BlockStatus::corrupt);
+    };
+
+    "pattern_matches_in_linear_time"_test = [] {
+        using ytrace::Pattern;
+        Pattern re;
+        std::string error;
+        expect(re.compile("^(get|put)_[a-z]+\\d*$", Pattern::Syntax::regex, error)) << error;
+        expect(re.search("get_user42") && re.search("put_x") && !re.search("xget_user") && !re.search("get_"));
+        expect(re.compile("handle", Pattern::Syntax::regex, error) && re.required_literal() == "handle");
+        expect(re.search("src/handle.cpp") && !re.search("src/hand.cpp"));
+
+        Pattern glob;
+        expect(glob.compile("io-*", Pattern::Syntax::glob, error));
+        expect(glob.search("io-worker-3") && !glob.search("aio-1") && !glob.search("io"));
+
+        Pattern nested;   // exponential for a backtracking engine
+        expect(nested.compile("(a*)*b", Pattern::Syntax::regex, error));
+        expect(!nested.search(std::string(100000, 'a')));
+        expect(!nested.compile("a{2}", Pattern::Syntax::regex, error) && !error.empty());
+        expect(!nested.compile("(ab", Pattern::Syntax::regex, error));
+
+        ytrace::Predicate pred;
+        expect(pred.compile("arg0 ~ \"^GET /api/\" && arg1 >= 500", error)) << error;
+        auto values = [](const char* a, int64_t b) {
+            return std::array<ytrace::Predicate::Value, 2>{ytrace::detail::predicate_value(a), ytrace::detail::predicate_value(b)};
+        };
+        expect(pred.eval(values("GET /api/users", 503).data(), 2));
+        expect(!pred.eval(values("GET /static/x", 503).data(), 2));
+        expect(!pred.compile("arg0 ~ 5", error));
+
+        std::string blowup = "a" + std::string(12, '.');  // 2^12 DFA states in search mode
+        expect(nested.compile(blowup, Pattern::Syntax::regex, error) && !nested.uses_dfa());
+        expect(!pred.compile("arg0 ~ \"" + blowup + "\"", error) && error.find("too complex") != std::string::npos) << error;
+    };
+
+    "sampled_timers_are_marked"_test = [] {
+        ytrace::set_trace_handler([](const char*, const char*, int, const char*, const char*) {});
+        micro_sampled(0);
+        micro_batched(0);
+        yenable_func("micro_sampled");
+        yenable_func("micro_batched");
+        volatile int sink = 0;
+        for (int i = 0; i < 800; ++i) sink = micro_sampled(i) + micro_batched(i);
+        (void)sink;
+        ydisable_func("micro_sampled");
+        ydisable_func("micro_batched");
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+
+        std::optional<ytrace::TimerStats> sampled, batched;
+        for (const auto& [label, count] : ytrace::TimerManager::instance().counts()) {
+            if (label.ends_with(" micro_sampled")) sampled = ytrace::TimerManager::instance().stats(label);
+            if (label.ends_with(" micro_batched")) batched = ytrace::TimerManager::instance().stats(label);
+        }
+        expect(sampled.has_value() && batched.has_value());
+        expect(sampled->one_in == 8u && sampled->count >= 40u && sampled->count <= 200u) << sampled->count;
+        expect(batched->batch == 8u && batched->count == 99u) << batched->count;  // the first batch starts the clock
+        auto summary = ytrace::TimerManager::instance().summary();
+        expect(summary.find("[sampled 1/8, ~") != std::string::npos) << summary;
+        expect(summary.find("[batch avg of 8, 792 calls]") != std::string::npos) << summary;
+    };
+
+    "timers_with_long_paths_stay_apart"_test = [] {
+        ytrace::set_trace_handler([](const char*, const char*, int, const char*, const char*) {});
+        std::string path = "/build/" + std::string(200, 'd') + "/parser.cpp";
+        { ytrace::ScopeTimer timer("parse", path.c_str(), 42, "run"); }
+        { ytrace::ScopeTimer timer("serialize", path.c_str(), 42, "run"); }
+        { ytrace::ScopeTimer timer("serialize", path.c_str(), 42, "run"); }
+        auto& timers = ytrace::TimerManager::instance();
+        expect(timers.stats(path + ":42 parse")->count == 1u);
+        expect(timers.stats(path + ":42 serialize")->count == 2u);
+        auto summary = timers.summary();
+        expect(summary.find("parser.cpp:42 parse ") != std::string::npos) << summary;
+        expect(summary.find("parser.cpp:42 serialize ") != std::string::npos) << summary;
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+    };
+
+    "timer_overhead_subtracted_and_flagged"_test = [] {
+        auto& timers = ytrace::TimerManager::instance();
+        double overhead = timers.overhead_ns();
+        expect(overhead > 0.0 && overhead < 10000.0) << overhead;
+
+        timers.set_subtract_overhead(true);
+        timers.record_measured("overhead_empty", overhead / 2);
+        timers.record_measured("overhead_slow", overhead + 1e6);
+        timers.set_subtract_overhead(false);
+        timers.record_measured("overhead_raw", overhead);
+        expect(timers.stats("overhead_empty")->avg == 0.0);
+        expect(timers.stats("overhead_slow")->avg == 1e6);
+        expect(timers.stats("overhead_raw")->avg == overhead);
+
+        auto summary = timers.summary();
+        auto line_of = [&](std::string_view label) {
+            auto at = summary.find(label);
+            return at == std::string::npos ? std::string() : summary.substr(at, summary.find('\n', at) - at);
+        };
+        expect(line_of("overhead_empty").find("[unreliable") != std::string::npos) << summary;
+        expect(line_of("overhead_raw").find("[unreliable") != std::string::npos) << summary;
+        expect(line_of("overhead_slow").find("[unreliable") == std::string::npos) << summary;
+        expect(summary.find("(timer overhead ") != std::string::npos) << summary;
+    };
+
+    "exception_table_counts_per_site"_test = [] {
+        auto& table = ytrace::ExceptionTable::instance();
+        size_t base = table.size();
+        auto [site, inserted] = table.insert(0x1000);
+        expect(inserted && site != nullptr);
+        expect(table.find(0x1000) == nullptr);  // not ready until named
+        site->module = "mod.so";
+        site->function = "parse";
+        site->type = "std::out_of_range";
+        site->base = 0x800;
+        site->ready.store(true);
+        expect(table.insert(0x1000).first == site && !table.insert(0x1000).second);
+        expect(table.find(0x1000) == site);
+
+        for (int i = 0; i < 5; ++i) site->throws.fetch_add(1);
+        table.record_catch(*site, 1000);
+        table.record_catch(*site, 3000);
+        expect(table.size() == base + 1);
+        auto report = table.report();
+        expect(report.find("5 std::out_of_range parse mod.so+0x800 [caught=2 avg=2.0 us max=3.0 us]") !=
+               std::string::npos) << report;
+    };
+
+    "call_path_enables_only_beneath_scope"_test = [] {
+        std::vector<std::string> messages;
+        ytrace::set_trace_handler([&](const char* level, const char*, int, const char*, const char* msg) {
+            if (std::string_view(level) == "trace") messages.emplace_back(msg);
+        });
+        connect_upstream();
+        refresh_cache();
+        resolve_host(0);
+        expect(messages.empty());
+
+        expect(yenable_func_under("resolve_host", "connect_upstream"));
+        connect_upstream();
+        refresh_cache();
+        resolve_host(0);
+        expect(messages == std::vector<std::string>{"resolving 1"}) << messages.size();
+        expect(ytrace::detail::t_call_path == 0u);  // restored on scope exit
+
+        messages.clear();
+        expect(yenable_func_under("resolve_host", "refresh_cache"));
+        connect_upstream();
+        refresh_cache();
+        expect(messages == std::vector<std::string>{"resolving 2"}) << messages.size();
+        expect(ytrace::TraceManager::instance().list_trace_points().find("under=refresh_cache") != std::string::npos);
+
+        // Scopes no point is enabled under any more (here misspelt) do not use up the bits
+        for (int i = 0; i < 70; ++i) {
+            expect(yenable_func_under("resolve_host", ("refresh_cahce_" + std::to_string(i)).c_str()));
+        }
+        expect(yenable_func_under("resolve_host", "refresh_cache"));
+        messages.clear();
+        connect_upstream();
+        refresh_cache();
+        expect(messages == std::vector<std::string>{"resolving 2"}) << messages.size();
+        ydisable_func("resolve_host");
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+    };
+
+    "thread_filter_enables_matching_threads"_test = [] {
+        std::mutex mutex;
+        std::vector<std::string> messages;
+        ytrace::set_trace_handler([&](const char* level, const char*, int, const char*, const char* msg) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (std::string_view(level) == "trace") messages.emplace_back(msg);
+        });
+        compact_step(0);
+        expect(yenable_func_on_thread("compact_step", "compactor-*"));
+
+        auto run = [](const char* name, int n) {
+            std::thread([=] {
+                ytrace::ThreadFilter::set_thread_name(name);
+                compact_step(n);
+            }).join();
+        };
+        run("compactor-1", 1);
+        run("request-7", 2);
+        compact_step(3);
+        run("compactor-2", 4);
+        expect(messages == std::vector<std::string>{"compacting 1", "compacting 4"}) << messages.size();
+
+        messages.clear();
+        ytrace::ThreadFilter::set_thread_name("compactor-main");  // renaming takes effect at once
+        compact_step(5);
+        ytrace::ThreadFilter::set_thread_name("");
+        compact_step(6);
+        expect(messages == std::vector<std::string>{"compacting 5"}) << messages.size();
+        expect(ytrace::TraceManager::instance().list_trace_points().find("thread=compactor-*") != std::string::npos);
+        ydisable_func("compact_step");
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+    };
+
+    "enable_profiles_switch_whole_table"_test = [] {
+        auto& mgr = ytrace::TraceManager::instance();
+        std::vector<std::string> messages;
+        std::atomic<int> beats{0};
+        ytrace::set_trace_handler([&](const char* level, const char*, int, const char*, const char* msg) {
+            if (std::string_view(msg).starts_with("beat")) ++beats;
+            else if (std::string_view(level) == "trace") messages.emplace_back(msg);
+        });
+        resolve_host(0);
+        compact_step(0);
+        heartbeat(0);
+
+        yenable_func("heartbeat");  // on in both profiles
+        yenable_func("resolve_host");
+        expect(mgr.save_profile("net"));
+        ydisable_func("resolve_host");
+        yenable_func("compact_step");
+        expect(mgr.save_profile("storage"));
+        expect(!mgr.save_profile("two words"));
+
+        expect(mgr.use_profile("net"));
+        resolve_host(1);
+        compact_step(1);
+        expect(messages == std::vector<std::string>{"resolving 1"}) << messages.size();
+
+        messages.clear();
+        expect(mgr.use_profile("storage"));
+        resolve_host(2);
+        compact_step(2);
+        expect(messages == std::vector<std::string>{"compacting 2"}) << messages.size();
+        expect(mgr.list_profiles().find("* storage") != std::string::npos) << mgr.list_profiles();
+        expect(!mgr.use_profile("missing"));
+
+        // A point on in both profiles loses no records while they are switched
+        beats = 0;
+        std::atomic<bool> beating{true};
+        int sent = 0;
+        std::thread beater([&] {
+            while (beating.load(std::memory_order_relaxed)) heartbeat(sent++);
+        });
+        for (int i = 0; i < 1000; ++i) expect(mgr.use_profile(i % 2 ? "storage" : "net"));
+        beating = false;
+        beater.join();
+        expect(beats.load() == sent) << beats.load() << sent;
+
+        ydisable_func("heartbeat");
+        ydisable_func("compact_step");
+        expect(mgr.delete_profile("net") && mgr.delete_profile("storage"));
+        expect(!mgr.delete_profile("net"));
+        ytrace::set_trace_handler(ytrace::default_trace_handler);
+    };
+
+    "dynamic_timer_labels_are_interned_and_capped"_test = [] {
+        auto& table = ytrace::LabelTable::instance();
+        int site_a = 0, site_b = 0;
+        std::string label = "tenant-7";
+        const char* interned = table.intern(&site_a, label);
+        expect(std::string_view(interned) == "tenant-7");
+        expect(table.intern(&site_a, std::string("tenant-7")) == interned);
+        expect(table.intern(&site_b, label) != interned);
+
+        ytrace::detail::LabelCache cache;
+        expect(cache.intern(&site_a, label) == interned);
+        expect(cache.intern(&site_a, label) == interned);  // from the cache
+
+        handle_tenant("registers the points");
+        yenable_func("handle_tenant");
+        handle_tenant("acme");
+        handle_tenant(std::string("acme"));
+        handle_tenant("globex");
+        ydisable_func("handle_tenant");
+        uint64_t acme = 0, globex = 0;
+        for (const auto& [key, count] : ytrace::TimerManager::instance().counts()) {
+            if (key.ends_with(" acme")) acme = count;
+            if (key.ends_with(" globex")) globex = count;
+        }
+        expect(acme == 2u && globex == 1u) << acme << globex;
+
+        for (int i = 0; table.size() < YTRACE_DYN_LABELS; ++i) table.intern(&site_b, "filler-" + std::to_string(i));
+        expect(std::string_view(table.intern(&site_b, "one-too-many")) == ytrace::LabelTable::kOverflow);
+        expect(table.intern(&site_a, label) == interned);  // known labels still resolve
+        expect(table.overflowed() == 1u);
+
+        // A thread asks the full table once per refused label
+        expect(std::string_view(cache.intern(&site_b, "also-too-many")) == ytrace::LabelTable::kOverflow);
+        expect(std::string_view(cache.intern(&site_b, "also-too-many")) == ytrace::LabelTable::kOverflow);
+        expect(table.overflowed() == 2u) << table.overflowed();
+        expect(table.size() == YTRACE_DYN_LABELS) << table.size();
+        expect(ytrace::TimerManager::instance().summary().find("answered (other)") != std::string::npos);
+    };
+
+    "scope_tracking_names_innermost_scope"_test = [] {
+        expect(innermost_scope() == nullptr);  // not tracked unless the preload shim asks
+        ytrace::CallPath::instance().track_scopes(true);
+        auto [outer, inner] = nested_scopes();
+        ytrace::CallPath::instance().track_scopes(false);
+        expect(std::string_view(outer) == "nested_scopes");
+        expect(std::string_view(inner) == "innermost_scope");
+        expect(ytrace::detail::t_scope == nullptr);
+    };
+
+#if defined(__linux__)
+    "splice_sink_streams_page_batches"_test = [] {
+        int fds[2];
+        expect(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        ytrace::SpliceSink sink(fds[0], true);
+
+        std::string spliced = "[trace] a.cpp:1 (f): page batch, spliced\n";
+        ytrace::detail::DrainBatch batch(true);
+        batch.append(spliced.data(), spliced.size());
+        sink(batch.view());
+        batch.clear();
+        std::string written = "[trace] a.cpp:2 (f): heap string, written\n";
+        sink(written);
+
+        std::string received;
+        char buffer[256];
+        while (received.size() < spliced.size() + written.size()) {
+            ssize_t n = read(fds[1], buffer, sizeof(buffer));
+            if (n <= 0) break;
+            received.append(buffer, static_cast<size_t>(n));
+        }
+        expect(received == spliced + written) << received;
+        expect(sink.spliced_bytes() == spliced.size());
+        expect(sink.written_bytes() == written.size());
+
+        close(fds[1]);  // consumer gone: the sink closes instead of raising SIGPIPE
+        sink(written);
+        expect(sink.closed());
+    };
+
+    "splice_sink_notices_idle_disconnect"_test = [] {
+        int fds[2];
+        expect(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        ytrace::SpliceSink sink(fds[0], true);
+        expect(!sink.poll_hangup());
+        close(fds[1]);  // no traffic before or after
+        expect(sink.poll_hangup() && sink.closed());
+    };
+
+    "splice_sink_gives_up_on_a_stalled_consumer"_test = [] {
+        int fds[2];
+        expect(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        ytrace::SpliceSink sink(fds[0], true, 50);
+        auto& pool = ytrace::DrainPool::instance();
+        ytrace::DrainOptions options;
+        options.page_batches = true;
+        expect(pool.start(options, sink));
+
+        yenable_func("drained_point");
+        std::thread([] { drained_point(7); }).join();  // through spdlog_record() in spdlog builds
+        std::string received;
+        char buffer[256];
+        while (received.find('\n') == std::string::npos) {
+            ssize_t n = read(fds[1], buffer, sizeof(buffer));
+            if (n <= 0) break;
+            received.append(buffer, static_cast<size_t>(n));
+        }
+        expect(received.find("(drained_point): drained 7\n") != std::string::npos) << received;
+
+        // The consumer stops reading: the worker gives up after 50 ms instead of blocking stop()
+        std::thread([] {
+            for (int i = 0; i < 20000; ++i) drained_point(i);
+        }).join();
+        ydisable_func("drained_point");
+        for (int i = 0; i < 100 && !sink.closed(); ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        expect(sink.closed());
+        pool.stop();
+        close(fds[1]);
+    };
+#endif
+
+    "elastic_buffer_grows_shrinks_within_budget"_test = [] {
+        auto& budget = ytrace::MemoryBudget::instance();
+        size_t limit = budget.limit();
+        size_t base = budget.used();
+        {
+            ytrace::detail::ElasticBuffer buf;
+            buf.begin_use();
+            expect(buf.ensure(1000, 0));
+            expect(buf.capacity() == YTRACE_BUFFER_CHUNK);
+            expect(buf.ensure(5 * YTRACE_BUFFER_CHUNK, 1000));
+            expect(buf.capacity() == 5 * YTRACE_BUFFER_CHUNK);
+            expect(budget.used() == base + 5 * YTRACE_BUFFER_CHUNK);
+
+            uint64_t refused = budget.refused();
+            budget.set_limit(budget.used());
+            expect(!buf.ensure(6 * YTRACE_BUFFER_CHUNK, 0));
+            expect(budget.refused() == refused + 1);
+            budget.set_limit(limit);
+
+            buf.end_use(1000);  // mostly unused: shrinks back to one chunk
+            expect(buf.capacity() == YTRACE_BUFFER_CHUNK);
+            int64_t later = ytrace::detail::steady_seconds() + YTRACE_BUFFER_IDLE_SECONDS;
+            expect(buf.trim_if_idle(later, YTRACE_BUFFER_IDLE_SECONDS) == YTRACE_BUFFER_CHUNK);
+            expect(buf.capacity() == 0u);
+        }
+        expect(budget.used() == base);
+
+        size_t bytes = 0;
+        expect(ytrace::MemoryBudget::parse_size("64M", bytes) && bytes == (size_t(64) << 20));
+        expect(!ytrace::MemoryBudget::parse_size("64X", bytes));
+    };
+
+    "patchable_encode_call"_test = [] {
+        uint8_t site[16] = {};
+        uint8_t out[5];
+        expect(ytrace::detail::encode_call(site, site + 15, out));
+        expect(out[0] == 0xE8 && out[1] == 10 && out[2] == 0 && out[3] == 0 && out[4] == 0);
+        expect(ytrace::detail::is_patchable_alignment(reinterpret_cast<uint8_t*>(uintptr_t(0x1004))));
+        expect(!ytrace::detail::is_patchable_alignment(reinterpret_cast<uint8_t*>(uintptr_t(0x100C))));
+    };
 };
 
 int main() {